@@ -12,6 +12,7 @@
 /* Import customs modules */
 #include "utils.h"
 #include "fileprocessing.h"
+#include "atomindex.h"
 
 #define VERSION "1.2.0"
 
@@ -21,8 +22,8 @@ void create_residues_box(char *box_name, double *Xmin, double *Xmax,
                          double *Ymin, double *Ymax, double *Zmin, double *Zmax,
                          double padding, char PDB_NAME[500]) {
   /* Declare variables */
-  int resnumber;
-  char chain[2];
+  int resnumber, first, *order;
+  char chain[CHAIN_SIZE];
   FILE *box_file;
   atom *p;
 
@@ -34,8 +35,9 @@ void create_residues_box(char *box_name, double *Xmin, double *Xmax,
   *Ymax = -999999;
   *Zmax = -999999;
 
-  /* Load PDB coordinates */
+  /* Load PDB coordinates and index atoms by residue */
   soft_read_pdb(PDB_NAME, 1, 1);
+  order = sort_atoms_by_residue();
 
   /* Open box file */
   box_file = fopen(box_name, "r");
@@ -43,32 +45,37 @@ void create_residues_box(char *box_name, double *Xmin, double *Xmax,
   /* Read file by each element (resnum_chain) */
   while (!feof(box_file)) {
 
-    fscanf(box_file, "%d_%s[^\t][^\n]", &resnumber, chain);
+    fscanf(box_file, "%d_%8s%*[^ \t\n]", &resnumber, chain);
+
+    /* Look up atoms of RESNUM and CHAIN */
+    first = find_residue(order, resnumber, chain);
+    if (first < 0)
+      continue;
 
     /* Check coordinates */
-    for (p = v; p != NULL; p = p->next) {
-
-      /* Find RESNUM and CHAIN */
-      if (p->resnumber == resnumber &&
-          (p->chain == chain[0] || p->chain == chain[1])) {
-
-        /* Update min and max coordinates */
-        if (p->x < *Xmin)
-          *Xmin = p->x;
-        if (p->x > *Xmax)
-          *Xmax = p->x;
-        if (p->y < *Ymin)
-          *Ymin = p->y;
-        if (p->y > *Ymax)
-          *Ymax = p->y;
-        if (p->z < *Zmin)
-          *Zmin = p->z;
-        if (p->z > *Zmax)
-          *Zmax = p->z;
-      }
+    for (; first < natoms && v[order[first]].resnumber == resnumber &&
+           !strcmp(v[order[first]].chain, chain);
+         first++) {
+      p = &v[order[first]];
+
+      /* Update min and max coordinates */
+      if (p->x < *Xmin)
+        *Xmin = p->x;
+      if (p->x > *Xmax)
+        *Xmax = p->x;
+      if (p->y < *Ymin)
+        *Ymin = p->y;
+      if (p->y > *Ymax)
+        *Ymax = p->y;
+      if (p->z < *Zmin)
+        *Zmin = p->z;
+      if (p->z > *Zmax)
+        *Zmax = p->z;
     }
   }
 
+  free(order);
+
   if (*Xmax < *Xmin || *Zmax < *Zmin || *Zmax < *Zmin) {
     fprintf(stderr, "\033[0;31mError:\033[0m Residues provided in residues box "
                     "file has not been found in the PDB file!\n");
@@ -161,8 +168,9 @@ void print_header() {
 
 void print_usage() {
 
-  fprintf(stdout, "Usage: parKVFinder <.pdb> [options],\n");
-  fprintf(stdout, "\twhere PDB is a path to a target PDB file.\n");
+  fprintf(stdout, "Usage: parKVFinder <.pdb|.cif> [options],\n");
+  fprintf(stdout, "\twhere PDB is a path to a target PDB or mmCIF file "
+                  "(optionally\n\tcompressed with gzip or zstd).\n");
   fprintf(stdout, "\n");
   fprintf(stdout, "Options:\n");
   fprintf(stdout, "  -h, --help\n");
@@ -181,7 +189,13 @@ void print_options() {
   fprintf(stdout, "  -p, --parameters\t[<.toml>]\n");
   fprintf(stdout, "\t  Define path to parameters file.\n");
   fprintf(stdout, "  -d, --dictionary\t[<dictionary>]\n");
-  fprintf(stdout, "\t  Define path to a custom dictionary file.\n");
+  fprintf(stdout, "\t  Define path to a custom dictionary file (text or "
+                  "precompiled). The\n");
+  fprintf(stdout, "\t  built-in dictionary is used by default.\n");
+  fprintf(stdout, "  --compile_dictionary\t[<file>]\n");
+  fprintf(stdout, "\t  Precompile the dictionary (custom or built-in) into a "
+                  "binary file\n");
+  fprintf(stdout, "\t  that is mapped in place when passed to -d, and exit.\n");
   fprintf(stdout, "  -r, --resolution\t<enum>\t\t(Low)\n");
   fprintf(stdout, "\t  Define resolution mode. Options include: Off, Low, "
                   "Medium and High.\n");
@@ -199,6 +213,79 @@ void print_options() {
   fprintf(stdout, "  --filled\n");
   fprintf(stdout, "\t  Output filled cavities. Increase memory consumption\n");
   fprintf(stdout, "\t  for molecular visualization.\n");
+  fprintf(stdout, "  --ensemble\n");
+  fprintf(stdout, "\t  Detect cavities in each model of a multi-model "
+                  "structure (e.g. NMR\n");
+  fprintf(stdout, "\t  ensembles) on one grid, writing results per model.\n");
+  fprintf(stdout, "  --trajectory\t\t[<.dcd|.xtc>]\n");
+  fprintf(stdout, "\t  Detect cavities in each frame of a DCD or XTC "
+                  "trajectory on one grid,\n");
+  fprintf(stdout, "\t  using PDB as topology (radii and residues), writing "
+                  "results per\n");
+  fprintf(stdout, "\t  frame.\n");
+  fprintf(stdout, "  --schedule\t\t<enum>\t\t(auto)\n");
+  fprintf(stdout, "\t  Define how models or frames use the cores. Options "
+                  "include: auto,\n");
+  fprintf(stdout, "\t  frames and voxels. frames runs whole frames "
+                  "concurrently, each with\n");
+  fprintf(stdout, "\t  its own grids; voxels runs one frame at a time on all "
+                  "cores; auto\n");
+  fprintf(stdout, "\t  picks frames for small grids.\n");
+  fprintf(stdout, "  --grid_format\t\t<enum>\n");
+  fprintf(stdout, "\t  Also write cavity labels, depth and hydropathy grids, "
+                  "cropped to\n");
+  fprintf(stdout, "\t  cavities, as volumetric maps. Options include: ccp4 "
+                  "(binary CCP4\n");
+  fprintf(stdout, "\t  map), dx (OpenDX), npy (one numpy array per grid, "
+                  "with origin,\n");
+  fprintf(stdout, "\t  step and rotation arrays) and npz (every grid in one "
+                  "uncompressed\n");
+  fprintf(stdout, "\t  numpy archive). rle8 and rle16 write cavity points "
+                  "run-length\n");
+  fprintf(stdout, "\t  encoded, with depth and hydropathy quantized to 8 or "
+                  "16 bits (see\n");
+  fprintf(stdout, "\t  src/cavityrle.h).\n");
+  fprintf(stdout, "  --mesh_format\t\t<enum>\n");
+  fprintf(stdout, "\t  Also write cavity surfaces as triangle meshes. "
+                  "Options include: ply\n");
+  fprintf(stdout, "\t  (binary PLY, with cavity number of each vertex) and "
+                  "obj (Wavefront\n");
+  fprintf(stdout, "\t  OBJ, one object per cavity).\n");
+  fprintf(stdout, "  --results_format\t<enum>\n");
+  fprintf(stdout, "\t  Also write results as one record per cavity. Options "
+                  "include: jsonl\n");
+  fprintf(stdout, "\t  (JSON lines), csv and jsonl,csv.\n");
+  fprintf(stdout, "  --archive\t\t[<file>]\n");
+  fprintf(stdout, "\t  Append output files as records of a single archive "
+                  "file instead of a\n");
+  fprintf(stdout, "\t  KV_Files/<base name> folder: parameters file as "
+                  "<base name> record,\n");
+  fprintf(stdout, "\t  then results of structure (<base name>.structure) "
+                  "or of each model or\n");
+  fprintf(stdout, "\t  frame (<base name>.model1, ...) and log (<base "
+                  "name>.log), indexed\n");
+  fprintf(stdout, "\t  in <file>.idx. Runs may append to the same archive "
+                  "concurrently (see\n");
+  fprintf(stdout, "\t  src/kvarchive.h).\n");
+  fprintf(stdout, "  --metrics_only\n");
+  fprintf(stdout, "\t  Only write results file, skipping cavity PDB file and "
+                  "depth and\n");
+  fprintf(stdout, "\t  hydropathy grids used only by it. Decrease memory "
+                  "consumption.\n");
+  fprintf(stdout, "  --top_k\t\t<integer>\n");
+  fprintf(stdout, "\t  Only characterize and output the k cavities with "
+                  "largest volume,\n");
+  fprintf(stdout, "\t  selected right after clustering.\n");
+  fprintf(stdout, "  --min_depth\t\t<real>\n");
+  fprintf(stdout, "\t  Only output cavities with maximum depth of at least "
+                  "this value,\n");
+  fprintf(stdout, "\t  selected right after depth estimation.\n");
+  fprintf(stdout, "  --near_residues\t[<file>]\n");
+  fprintf(stdout, "\t  Only characterize and output cavities with any "
+                  "residue of a file\n");
+  fprintf(stdout, "\t  (same format as residues box file) among their "
+                  "interface residues,\n");
+  fprintf(stdout, "\t  selected right after interface residues retrieval.\n");
   fprintf(stdout, "  -t, --template\t\t\t(parameters.toml)\n");
   fprintf(stdout, "\t  Create a parameter file template with defined "
                   "parameters in current\n");
@@ -233,8 +320,8 @@ void print_options() {
   fprintf(stdout, "\n");
   /* LIGAND ADJUSTMENT PARAMETERS */
   fprintf(stdout, "Ligand options:\n");
-  fprintf(stdout, "  -L, --ligand\t\t[<.pdb>]\n");
-  fprintf(stdout, "\t  Define path to ligand PDB file.\n");
+  fprintf(stdout, "  -L, --ligand\t\t[<.pdb|.cif>]\n");
+  fprintf(stdout, "\t  Define path to ligand PDB or mmCIF file.\n");
   fprintf(stdout, "  --ligand_cutoff\t<real>\t\t(5.0)\n");
   fprintf(stdout, "\t  Define ligand radius distance cutoff.\n");
   fprintf(stdout, "\n");
@@ -255,27 +342,25 @@ void print_help() {
                   "====================\n");
 }
 
-int argparser(int argc, char **argv, int *box_mode, int *kvp_mode,
+int argparser(int argc, char **argv, int worker, int *box_mode, int *kvp_mode,
               int *ligand_mode, int *surface_mode, int *whole_protein_mode,
-              char PDB_NAME[500], char LIGAND_NAME[500],
-              char dictionary_name[500], char OUTPUT[500], char BASE_NAME[500],
-              char resolution_flag[7], double *h, double *probe_in,
-              double *probe_out, double *volume_cutoff, double *ligand_cutoff,
-              double *removal_distance, double *X1, double *Y1, double *Z1,
+              int *ensemble_mode, int *trajectory_mode, int *schedule,
+              int *grid_format, int *mesh_format, int *metrics_mode,
+              int *results_format, int *top_k, char PDB_NAME[500],
+              char LIGAND_NAME[500],
+              char TRAJECTORY_NAME[500], char NEAR_RESIDUES[500],
+              char ARCHIVE_NAME[500], char dictionary_name[500],
+              char OUTPUT[500], char BASE_NAME[500], char resolution_flag[7],
+              double *h,
+              double *probe_in, double *probe_out, double *volume_cutoff,
+              double *ligand_cutoff, double *removal_distance,
+              double *min_depth, double *X1, double *Y1, double *Z1,
               double *X2, double *Y2, double *Z2, double *X3, double *Y3,
               double *Z3, double *X4, double *Y4, double *Z4, double *bX1,
               double *bY1, double *bZ1, double *bX2, double *bY2, double *bZ2,
               double *bX3, double *bY3, double *bZ3, double *bX4, double *bY4,
               double *bZ4) {
 
-  /* Print Warning! if KVFinder_PATH was not found */
-  if (strcmp(getenv("KVFinder_PATH"), "") == 0) {
-    fprintf(
-        stderr,
-        "\033[0;33mWarning:\033[0m KVFinder_PATH system variable not found.\n");
-    fprintf(stderr, "Export KVFinder_PATH to your system variables.\n\n");
-  }
-
   /* Declare variables */
   /* Flag set by ‘--verbose’. */
   static int verbose_flag = 0;
@@ -286,13 +371,35 @@ int argparser(int argc, char **argv, int *box_mode, int *kvp_mode,
   /* Flag set by '--box or -B' */
   *box_mode = 0;
   *whole_protein_mode = 1;
+  /* Flag set by '--ensemble' */
+  *ensemble_mode = 0;
+  /* Flag set by '--trajectory' */
+  *trajectory_mode = 0;
+  /* Option set by '--schedule' */
+  *schedule = AUTO_SCHEDULE;
+  /* Option set by '--grid_format' */
+  *grid_format = NO_GRID;
+  /* Option set by '--mesh_format' */
+  *mesh_format = NO_MESH;
+  /* Flag set by '--metrics_only' */
+  *metrics_mode = 0;
+  /* Option set by '--results_format' */
+  *results_format = 0;
+  /* Cavity selection set by '--top_k', '--min_depth' and '--near_residues' */
+  *top_k = 0;
+  *min_depth = 0.0;
+  NEAR_RESIDUES[0] = '\0';
+  /* Option set by '--archive' */
+  ARCHIVE_NAME[0] = '\0';
 
   /* Get current directory */
   char cwd[256];
   getcwd(cwd, sizeof(cwd));
 
   /* Declare variables */
-  char *parameters_name, *template_name, *toml_name, *box_name;
+  char *parameters_name = NULL, *template_name, *toml_name, *box_name,
+      *compiled_name, *format, *path;
+  char extension[10], formats[100];
   double padding;
 
   /* Declare counters */
@@ -300,7 +407,8 @@ int argparser(int argc, char **argv, int *box_mode, int *kvp_mode,
 
   /* Declare flags */
   /* Flag for paths */
-  int p_flag = 0, d_flag = 0, pdb_flag = 0, l_flag = 0, t_flag = 0;
+  int p_flag = 0, d_flag = 0, pdb_flag = 0, l_flag = 0, t_flag = 0,
+      cd_flag = 0;
   /* Flag for strings */
   int r_flag = 0, surface_flag = 0;
   /* Flag for doubles */
@@ -319,11 +427,23 @@ int argparser(int argc, char **argv, int *box_mode, int *kvp_mode,
         {"parameters", required_argument, NULL, 'p'},
         {"dictionary", required_argument, NULL, 'd'},
         {"ligand", required_argument, NULL, 'L'},
+        {"trajectory", required_argument, NULL, 0},
         {"template", no_argument, NULL, 't'},
         /* Modes */
         {"filled", no_argument, NULL, 0},
+        {"ensemble", no_argument, NULL, 0},
         {"surface", required_argument, NULL, 'S'},
         {"box", no_argument, NULL, 'B'},
+        {"schedule", required_argument, NULL, 0},
+        {"grid_format", required_argument, NULL, 0},
+        {"mesh_format", required_argument, NULL, 0},
+        {"metrics_only", no_argument, NULL, 0},
+        {"results_format", required_argument, NULL, 0},
+        {"archive", required_argument, NULL, 0},
+        /* Cavity selection */
+        {"top_k", required_argument, NULL, 0},
+        {"min_depth", required_argument, NULL, 0},
+        {"near_residues", required_argument, NULL, 0},
         /* Settings */
         {"resolution", required_argument, NULL, 'r'},
         {"step", required_argument, NULL, 's'},
@@ -336,6 +456,8 @@ int argparser(int argc, char **argv, int *box_mode, int *kvp_mode,
         {"residues_box", required_argument, NULL, 0},
         {"padding", required_argument, NULL, 0},
         {"custom_box", required_argument, NULL, 0},
+        /* Dictionary settings */
+        {"compile_dictionary", required_argument, NULL, 0},
 
         {NULL, no_argument, NULL, 0}
 
@@ -412,10 +534,144 @@ int argparser(int argc, char **argv, int *box_mode, int *kvp_mode,
           exit(-1);
         }
       }
+      /* Precompiled dictionary */
+      if (strcmp("compile_dictionary", long_options[option_index].name) ==
+          0) {
+        compiled_name = optarg;
+        cd_flag = 1;
+      }
       /* FILLED CAVITIES MODE (KVP MODE) */
       if (strcmp("filled", long_options[option_index].name) == 0) {
         *kvp_mode = 1;
       }
+      /* ENSEMBLE MODE */
+      if (strcmp("ensemble", long_options[option_index].name) == 0) {
+        *ensemble_mode = 1;
+      }
+      /* FRAME SCHEDULE */
+      if (strcmp("schedule", long_options[option_index].name) == 0) {
+        if (strcmp(optarg, "auto") == 0)
+          *schedule = AUTO_SCHEDULE;
+        else if (strcmp(optarg, "frames") == 0)
+          *schedule = FRAME_SCHEDULE;
+        else if (strcmp(optarg, "voxels") == 0)
+          *schedule = VOXEL_SCHEDULE;
+        else {
+          fprintf(stderr, "\033[0;31mError:\033[0m Wrong schedule "
+                          "selected!\nPossible inputs: auto, frames, "
+                          "voxels.\n");
+          exit(-1);
+        }
+      }
+      /* METRICS ONLY MODE */
+      if (strcmp("metrics_only", long_options[option_index].name) == 0) {
+        *metrics_mode = 1;
+      }
+      /* MACHINE-ORIENTED RESULTS FILES */
+      if (strcmp("results_format", long_options[option_index].name) == 0) {
+        /* Tokenize a copy, argv is reused by frame workers */
+        snprintf(formats, sizeof(formats), "%s", optarg);
+        for (format = strtok(formats, ","); format != NULL;
+             format = strtok(NULL, ",")) {
+          if (strcmp(format, "jsonl") == 0)
+            *results_format |= JSONL_RESULTS;
+          else if (strcmp(format, "csv") == 0)
+            *results_format |= CSV_RESULTS;
+          else {
+            fprintf(stderr, "\033[0;31mError:\033[0m Wrong results format "
+                            "selected!\nPossible inputs: jsonl, csv or "
+                            "jsonl,csv.\n");
+            exit(-1);
+          }
+        }
+      }
+      /* RESULTS ARCHIVE */
+      if (strcmp("archive", long_options[option_index].name) == 0) {
+        snprintf(ARCHIVE_NAME, 500, "%s", optarg);
+      }
+      /* CAVITY SELECTION */
+      /* largest cavities */
+      if (strcmp("top_k", long_options[option_index].name) == 0) {
+        if (check_input(optarg, "\033[0;31mError:\033[0m Invalid top k "
+                                "input!\n")) {
+          *top_k = atoi(optarg);
+          if (*top_k < 1) {
+            fprintf(stderr, "\033[0;31mError:\033[0m Top k must be at least "
+                            "1!\n");
+            exit(-1);
+          }
+        }
+      }
+      /* minimum depth */
+      if (strcmp("min_depth", long_options[option_index].name) == 0) {
+        if (check_input(
+                optarg,
+                "\033[0;31mError:\033[0m Invalid minimum depth input!\n")) {
+          *min_depth = atof(optarg);
+        }
+      }
+      /* residues near cavities */
+      if (strcmp("near_residues", long_options[option_index].name) == 0) {
+        snprintf(NEAR_RESIDUES, 500, "%s", optarg);
+        if (access(NEAR_RESIDUES, F_OK)) {
+          fprintf(
+              stderr,
+              "\033[0;31mError:\033[0m Residues list file does not exist!\n");
+          exit(-1);
+        }
+      }
+      /* VOLUMETRIC GRID OUTPUT */
+      if (strcmp("grid_format", long_options[option_index].name) == 0) {
+        if (strcmp(optarg, "ccp4") == 0)
+          *grid_format = CCP4_GRID;
+        else if (strcmp(optarg, "dx") == 0)
+          *grid_format = DX_GRID;
+        else if (strcmp(optarg, "npy") == 0)
+          *grid_format = NPY_GRID;
+        else if (strcmp(optarg, "npz") == 0)
+          *grid_format = NPZ_GRID;
+        else if (strcmp(optarg, "rle8") == 0)
+          *grid_format = RLE8_GRID;
+        else if (strcmp(optarg, "rle16") == 0)
+          *grid_format = RLE16_GRID;
+        else {
+          fprintf(stderr, "\033[0;31mError:\033[0m Wrong grid format "
+                          "selected!\nPossible inputs: ccp4, dx, npy, npz, "
+                          "rle8, rle16.\n");
+          exit(-1);
+        }
+      }
+      /* CAVITY SURFACE MESH OUTPUT */
+      if (strcmp("mesh_format", long_options[option_index].name) == 0) {
+        if (strcmp(optarg, "ply") == 0)
+          *mesh_format = PLY_MESH;
+        else if (strcmp(optarg, "obj") == 0)
+          *mesh_format = OBJ_MESH;
+        else {
+          fprintf(stderr, "\033[0;31mError:\033[0m Wrong mesh format "
+                          "selected!\nPossible inputs: ply, obj.\n");
+          exit(-1);
+        }
+      }
+      /* TRAJECTORY MODE + TRAJECTORY PATH */
+      if (strcmp("trajectory", long_options[option_index].name) == 0) {
+        if ((path = realpath(optarg, NULL)) == NULL) {
+          fprintf(stderr,
+                  "\033[0;31mError:\033[0m Trajectory file does not exist.\n");
+          exit(-1);
+        }
+        snprintf(TRAJECTORY_NAME, 500, "%s", path);
+        free(path);
+        *trajectory_mode = 1;
+        if (strcmp(_get_file_extension(TRAJECTORY_NAME), "dcd") &&
+            strcmp(_get_file_extension(TRAJECTORY_NAME), "xtc")) {
+          fprintf(stderr,
+                  "\033[0;31mError:\033[0m Wrong trajectory file "
+                  "extension!\narg: [\'%s\']\n",
+                  TRAJECTORY_NAME);
+          exit(-1);
+        }
+      }
       break;
 
     /* SHORT OPTIONS */
@@ -574,11 +830,20 @@ int argparser(int argc, char **argv, int *box_mode, int *kvp_mode,
 
   /* COMMAND-LINE ARGUMENTS PROCESSING */
 
+  /* Precompile dictionary (defined by -d or built-in) and exit */
+  if (cd_flag) {
+    read_vdw(d_flag ? dictionary_name : BUILTIN_DICTIONARY);
+    write_vdw_binary(compiled_name);
+    fprintf(stdout, "> Precompiled dictionary written to: %s\n",
+            compiled_name);
+    exit(0);
+  }
+
   /* Parameters file test conditions
   Parameters file must be set alone */
   if (p_flag) {
     if (d_flag || l_flag || t_flag || r_flag || o_flag || i_flag || s_flag ||
-        vc_flag || lc_flag || rd_flag) {
+        vc_flag || lc_flag || rd_flag || *trajectory_mode) {
       fprintf(
           stderr,
           "\033[0;31mError:\033[0m Just define parameters file argument!\n");
@@ -675,6 +940,17 @@ int argparser(int argc, char **argv, int *box_mode, int *kvp_mode,
           point = i;
       }
 
+      /* Get PDB extension, before compression extension (.gz or .zst) */
+      snprintf(extension, 10, "%s", _get_file_extension(PDB_NAME));
+      if (!strcmp(extension, "gz") || !strcmp(extension, "zst")) {
+        for (i = point - 1; i > bar && PDB_NAME[i] != '.'; i--)
+          ;
+        if (i > bar) {
+          snprintf(extension, 10, "%.*s", point - i - 1, PDB_NAME + i + 1);
+          point = i;
+        }
+      }
+
       /* Copy PDB name to OUTPUT */
       for (i = 0, j = 0; i < bar + 1; i++, j++)
         OUTPUT[j] = PDB_NAME[i];
@@ -700,7 +976,8 @@ int argparser(int argc, char **argv, int *box_mode, int *kvp_mode,
         exit(-1);
       }
       /* Check PDB file extension*/
-      if (strcmp(_get_file_extension(PDB_NAME), "pdb")) {
+      if (strcmp(extension, "pdb") && strcmp(extension, "cif") &&
+          strcmp(extension, "mmcif")) {
         fprintf(stderr,
                 "\033[0;31mError:\033[0m Wrong PDB file extension!\narg: "
                 "[\'%s\']\n",
@@ -719,11 +996,11 @@ int argparser(int argc, char **argv, int *box_mode, int *kvp_mode,
   /* Path to dictionary file */
   if (!d_flag) {
 
-    /* Set default path to dictionary */
-    strcpy(dictionary_name, getenv("KVFinder_PATH"));
-    strcat(dictionary_name, "/dictionary");
+    /* Set default dictionary (built-in) */
+    strcpy(dictionary_name, BUILTIN_DICTIONARY);
     if (verbose_flag)
-      fprintf(stdout, "> Setting \'dictionary_name\' to default file: %s\n",
+      fprintf(stdout, "> Setting \'dictionary_name\' to default dictionary: "
+                      "%s\n",
               dictionary_name);
   }
   /* Probe in */
@@ -811,6 +1088,23 @@ int argparser(int argc, char **argv, int *box_mode, int *kvp_mode,
               "\'resolution\' to flag: %s\n",
               *h, resolution_flag);
   }
+  /* Ensemble and trajectory modes */
+  if (*ensemble_mode && *trajectory_mode) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Ensemble and trajectory modes "
+                    "should not be combined!\n");
+    exit(-1);
+  }
+  /* Metrics only mode writes no cavity files */
+  if (*metrics_mode && *grid_format != NO_GRID) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Metrics only mode and grid "
+                    "format should not be combined!\n");
+    exit(-1);
+  }
+  if (*metrics_mode && *mesh_format != NO_MESH) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Metrics only mode and mesh "
+                    "format should not be combined!\n");
+    exit(-1);
+  }
   /* Ligand mode */
   if (!l_flag) {
     snprintf(LIGAND_NAME, 7, "%s", "-");
@@ -966,6 +1260,7 @@ int argparser(int argc, char **argv, int *box_mode, int *kvp_mode,
 
   /* Print template parameters file */
   if (t_flag) {
+    mkdir(_combine(OUTPUT, "KV_Files/"), S_IRWXU);
     write_parameters(template_name, OUTPUT, BASE_NAME, dictionary_name,
                      PDB_NAME, LIGAND_NAME, *whole_protein_mode,
                      resolution_flag, *box_mode, *surface_mode, *kvp_mode,
@@ -976,6 +1271,13 @@ int argparser(int argc, char **argv, int *box_mode, int *kvp_mode,
     exit(0);
   }
 
+  /* Parameters file goes to results archive in archive mode, and is written
+   * by parent process only in frame schedule */
+  if (ARCHIVE_NAME[0] || worker >= 0)
+    return verbose_flag;
+
+  /* Create KV_Files directory */
+  mkdir(_combine(OUTPUT, "KV_Files/"), S_IRWXU);
   toml_name = _combine(
       _combine(_combine(OUTPUT, "KV_Files/parameters_"), BASE_NAME), ".toml");
   write_parameters(toml_name, OUTPUT, BASE_NAME, dictionary_name, PDB_NAME,
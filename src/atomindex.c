@@ -0,0 +1,303 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+/* Spatial index */
+
+/*
+ * Function: _cell_coordinate
+ * --------------------------
+ *
+ * Get cell unit of a coordinate along one axis, clamped to the cell list
+ *
+ * x: coordinate
+ * origin: cell list origin along axis
+ * size: cell edge length
+ * n: cell units along axis
+ *
+ * returns: cell unit
+ *
+ */
+int _cell_coordinate(double x, double origin, double size, int n) {
+  double c = floor((x - origin) / size);
+
+  if (c < 0)
+    return 0;
+  if (c > n - 1)
+    return n - 1;
+  return (int)c;
+}
+
+/*
+ * Function: build_cell_list
+ * -------------------------
+ *
+ * Bin points in a uniform cell list. Cell edge should be tied to the query
+ * radius, so a query visits few cells. The cell list keeps a reference to P,
+ * which must outlive it.
+ *
+ * P: point coordinates (x, y, z of each point)
+ * npoints: number of points
+ * size: cell edge length
+ *
+ * returns: cell list
+ *
+ */
+cell_list *build_cell_list(double *P, int npoints, double size) {
+  int a, c, ncells, *cell, *fill;
+  double xmax, ymax, zmax;
+  cell_list *C = (cell_list *)malloc(sizeof(cell_list));
+
+  C->P = P;
+  C->npoints = npoints;
+
+  /* Get points bounding box */
+  C->xmin = C->ymin = C->zmin = 0.0;
+  xmax = ymax = zmax = 0.0;
+  for (a = 0; a < npoints; a++) {
+    if (a == 0 || P[3 * a] < C->xmin)
+      C->xmin = P[3 * a];
+    if (a == 0 || P[3 * a + 1] < C->ymin)
+      C->ymin = P[3 * a + 1];
+    if (a == 0 || P[3 * a + 2] < C->zmin)
+      C->zmin = P[3 * a + 2];
+    if (a == 0 || P[3 * a] > xmax)
+      xmax = P[3 * a];
+    if (a == 0 || P[3 * a + 1] > ymax)
+      ymax = P[3 * a + 1];
+    if (a == 0 || P[3 * a + 2] > zmax)
+      zmax = P[3 * a + 2];
+  }
+
+  /* Enlarge cells while there are too many empty ones */
+  C->size = size > 0.0 ? size : 1.0;
+  do {
+    C->nx = (int)floor((xmax - C->xmin) / C->size) + 1;
+    C->ny = (int)floor((ymax - C->ymin) / C->size) + 1;
+    C->nz = (int)floor((zmax - C->zmin) / C->size) + 1;
+    ncells = C->nx * C->ny * C->nz;
+    if ((double)C->nx * C->ny * C->nz > 8.0 * npoints + 64)
+      C->size *= 2;
+    else
+      break;
+  } while (1);
+
+  /* Counting sort of points by cell, keeping point order inside a cell */
+  cell = (int *)malloc((npoints + 1) * sizeof(int));
+  C->start = (int *)calloc(ncells + 1, sizeof(int));
+  C->points = (int *)malloc((npoints + 1) * sizeof(int));
+  for (a = 0; a < npoints; a++) {
+    cell[a] = (_cell_coordinate(P[3 * a], C->xmin, C->size, C->nx) * C->ny +
+               _cell_coordinate(P[3 * a + 1], C->ymin, C->size, C->ny)) *
+                  C->nz +
+              _cell_coordinate(P[3 * a + 2], C->zmin, C->size, C->nz);
+    C->start[cell[a] + 1]++;
+  }
+  for (c = 0; c < ncells; c++)
+    C->start[c + 1] += C->start[c];
+  fill = (int *)malloc((ncells + 1) * sizeof(int));
+  memcpy(fill, C->start, (ncells + 1) * sizeof(int));
+  for (a = 0; a < npoints; a++)
+    C->points[fill[cell[a]]++] = a;
+
+  free(fill);
+  free(cell);
+
+  return C;
+}
+
+/*
+ * Function: query_radius
+ * ----------------------
+ *
+ * Find points within a radius of a query position. found is grown as needed
+ * and may be reused across queries (e.g. one per thread).
+ *
+ * C: cell list
+ * x: x coordinate of query position
+ * y: y coordinate of query position
+ * z: z coordinate of query position
+ * r: query radius
+ * found: pointer to array of point indexes
+ * capacity: pointer to capacity of found
+ *
+ * returns: number of points found
+ *
+ */
+int query_radius(cell_list *C, double x, double y, double z, double r,
+                 int **found, int *capacity) {
+  int i, j, k, c, a, imin, jmin, kmin, imax, jmax, kmax, nfound = 0;
+  double dx, dy, dz;
+
+  if (C->npoints == 0)
+    return 0;
+
+  imin = _cell_coordinate(x - r, C->xmin, C->size, C->nx);
+  jmin = _cell_coordinate(y - r, C->ymin, C->size, C->ny);
+  kmin = _cell_coordinate(z - r, C->zmin, C->size, C->nz);
+  imax = _cell_coordinate(x + r, C->xmin, C->size, C->nx);
+  jmax = _cell_coordinate(y + r, C->ymin, C->size, C->ny);
+  kmax = _cell_coordinate(z + r, C->zmin, C->size, C->nz);
+
+  for (i = imin; i <= imax; i++)
+    for (j = jmin; j <= jmax; j++)
+      for (k = kmin; k <= kmax; k++) {
+        c = (i * C->ny + j) * C->nz + k;
+        for (a = C->start[c]; a < C->start[c + 1]; a++) {
+          dx = C->P[3 * C->points[a]] - x;
+          dy = C->P[3 * C->points[a] + 1] - y;
+          dz = C->P[3 * C->points[a] + 2] - z;
+          if (dx * dx + dy * dy + dz * dz <= r * r) {
+            if (nfound == *capacity) {
+              *capacity = *capacity ? 2 * (*capacity) : 64;
+              *found = (int *)realloc(*found, (*capacity) * sizeof(int));
+            }
+            (*found)[nfound++] = C->points[a];
+          }
+        }
+      }
+
+  return nfound;
+}
+
+/*
+ * Function: query_nearest
+ * -----------------------
+ *
+ * Find the nearest point within a radius of a query position. Ties are
+ * resolved to the lowest point index.
+ *
+ * C: cell list
+ * x: x coordinate of query position
+ * y: y coordinate of query position
+ * z: z coordinate of query position
+ * r: query radius
+ *
+ * returns: nearest point index or -1 if no point is within radius
+ *
+ */
+int query_nearest(cell_list *C, double x, double y, double z, double r) {
+  int i, j, k, c, a, b, imin, jmin, kmin, imax, jmax, kmax, nearest = -1;
+  double dx, dy, dz, d2, best = r * r;
+
+  if (C->npoints == 0)
+    return -1;
+
+  imin = _cell_coordinate(x - r, C->xmin, C->size, C->nx);
+  jmin = _cell_coordinate(y - r, C->ymin, C->size, C->ny);
+  kmin = _cell_coordinate(z - r, C->zmin, C->size, C->nz);
+  imax = _cell_coordinate(x + r, C->xmin, C->size, C->nx);
+  jmax = _cell_coordinate(y + r, C->ymin, C->size, C->ny);
+  kmax = _cell_coordinate(z + r, C->zmin, C->size, C->nz);
+
+  for (i = imin; i <= imax; i++)
+    for (j = jmin; j <= jmax; j++)
+      for (k = kmin; k <= kmax; k++) {
+        c = (i * C->ny + j) * C->nz + k;
+        for (a = C->start[c]; a < C->start[c + 1]; a++) {
+          b = C->points[a];
+          dx = C->P[3 * b] - x;
+          dy = C->P[3 * b + 1] - y;
+          dz = C->P[3 * b + 2] - z;
+          d2 = dx * dx + dy * dy + dz * dz;
+          if (d2 < best || (d2 == best && (nearest < 0 || b < nearest))) {
+            best = d2;
+            nearest = b;
+          }
+        }
+      }
+
+  return nearest;
+}
+
+/*
+ * Function: free_cell_list
+ * ------------------------
+ *
+ * Free cell list (point coordinates are not owned by it)
+ *
+ * C: cell list
+ *
+ */
+void free_cell_list(cell_list *C) {
+  free(C->start);
+  free(C->points);
+  free(C);
+}
+
+/* Residue index */
+
+/*
+ * Function: _compare_atom_residue
+ * -------------------------------
+ *
+ * Compare two atom indexes by residue number, chain identifier and atom index
+ *
+ */
+int _compare_atom_residue(const void *a, const void *b) {
+  const atom *p = &v[*(const int *)a], *q = &v[*(const int *)b];
+  int c;
+
+  if (p->resnumber != q->resnumber)
+    return p->resnumber < q->resnumber ? -1 : 1;
+  if ((c = strcmp(p->chain, q->chain)))
+    return c;
+  return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * Function: sort_atoms_by_residue
+ * -------------------------------
+ *
+ * Sort atom table indexes by residue number and chain identifier, keeping
+ * table order inside a residue
+ *
+ * returns: sorted atom indexes
+ *
+ */
+int *sort_atoms_by_residue() {
+  int a, *order = (int *)malloc((natoms + 1) * sizeof(int));
+
+  for (a = 0; a < natoms; a++)
+    order[a] = a;
+  qsort(order, natoms, sizeof(int), _compare_atom_residue);
+
+  return order;
+}
+
+/*
+ * Function: find_residue
+ * ----------------------
+ *
+ * Binary search the first atom of a residue in atoms sorted by
+ * sort_atoms_by_residue()
+ *
+ * order: sorted atom indexes
+ * resnumber: residue number
+ * chain: chain identifier
+ *
+ * returns: position of first residue atom in order or -1 if not found
+ *
+ */
+int find_residue(int *order, int resnumber, char *chain) {
+  int lo = 0, hi = natoms, mid;
+  atom *p;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    p = &v[order[mid]];
+    if (p->resnumber < resnumber ||
+        (p->resnumber == resnumber && strcmp(p->chain, chain) < 0))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo < natoms && v[order[lo]].resnumber == resnumber &&
+      !strcmp(v[order[lo]].chain, chain))
+    return lo;
+  return -1;
+}
@@ -0,0 +1,18 @@
+#ifndef ATOMINDEX_H
+#define ATOMINDEX_H
+
+#include "utils.h"
+
+/* Spatial index */
+cell_list *build_cell_list(double *P, int npoints, double size);
+int query_radius(cell_list *C, double x, double y, double z, double r,
+                 int **found, int *capacity);
+int query_nearest(cell_list *C, double x, double y, double z, double r);
+void free_cell_list(cell_list *C);
+
+/* Residue index */
+int _compare_atom_residue(const void *a, const void *b);
+int *sort_atoms_by_residue();
+int find_residue(int *order, int resnumber, char *chain);
+
+#endif
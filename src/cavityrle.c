@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cavityrle.h"
+
+/* Run-length encoded cavity file decoding. Standalone reader: depends on
+ * cavityrle.h only, so tools can build it without parKVFinder sources. */
+
+/*
+ * Function: _get_le
+ * -----------------
+ *
+ * Load an unsigned little-endian integer
+ *
+ * bytes: source
+ * size: number of bytes
+ *
+ * returns: integer value
+ *
+ */
+unsigned long _get_le(unsigned char *bytes, int size) {
+  int i;
+  unsigned long value = 0;
+
+  for (i = size - 1; i >= 0; i--)
+    value = (value << 8) | bytes[i];
+
+  return value;
+}
+
+/*
+ * Function: _get_double
+ * ---------------------
+ *
+ * Load a little-endian 64-bit float
+ *
+ * bytes: source
+ *
+ * returns: float value
+ *
+ */
+double _get_double(unsigned char *bytes) {
+  unsigned long long word = _get_le(bytes, 4) |
+                            (unsigned long long)_get_le(bytes + 4, 4) << 32;
+  double value;
+
+  memcpy(&value, &word, sizeof(value));
+  return value;
+}
+
+/*
+ * Function: _get_float
+ * --------------------
+ *
+ * Load a little-endian 32-bit float
+ *
+ * bytes: source
+ *
+ * returns: float value
+ *
+ */
+float _get_float(unsigned char *bytes) {
+  unsigned int word = _get_le(bytes, 4);
+  float value;
+
+  memcpy(&value, &word, sizeof(value));
+  return value;
+}
+
+/*
+ * Function: _dequantize
+ * ---------------------
+ *
+ * Recover a value quantized on range
+ *
+ * bytes: quantized value
+ * bits: bits of quantized value (8 or 16)
+ * range: minimum and maximum value
+ *
+ * returns: value
+ *
+ */
+float _dequantize(unsigned char *bytes, int bits, float range[2]) {
+  unsigned long q = _get_le(bytes, bits / 8);
+
+  return range[0] + (range[1] - range[0]) * q / ((1UL << bits) - 1);
+}
+
+/*
+ * Function: open_cavity_rle
+ * -------------------------
+ *
+ * Open a run-length encoded cavity file and read its header and cavity
+ * table
+ *
+ * filename: cavity file
+ *
+ * returns: opened cavity file or NULL if it is not a valid cavity file
+ *
+ */
+cavity_rle *open_cavity_rle(const char *filename) {
+  int c, a;
+  unsigned char header[CAVITY_RLE_HEADER_SIZE], entry[CAVITY_RLE_ENTRY_SIZE];
+  cavity_rle *R;
+  FILE *file;
+
+  file = fopen(filename, "rb");
+  if (file == NULL)
+    return NULL;
+  if (fread(header, 1, CAVITY_RLE_HEADER_SIZE, file) !=
+          CAVITY_RLE_HEADER_SIZE ||
+      memcmp(header, CAVITY_RLE_MAGIC, 8) ||
+      (_get_le(header + 8, 2) != 8 && _get_le(header + 8, 2) != 16)) {
+    fclose(file);
+    return NULL;
+  }
+
+  R = (cavity_rle *)calloc(1, sizeof(cavity_rle));
+  R->file = file;
+  R->bits = _get_le(header + 8, 2);
+  R->ncav = _get_le(header + 12, 4);
+  R->m = _get_le(header + 16, 4);
+  R->n = _get_le(header + 20, 4);
+  R->o = _get_le(header + 24, 4);
+  for (a = 0; a < 3; a++)
+    R->origin[a] = _get_double(header + 32 + 8 * a);
+  R->step = _get_double(header + 56);
+  for (a = 0; a < 9; a++)
+    R->rotation[a / 3][a % 3] = _get_double(header + 64 + 8 * a);
+  R->depth_range[0] = _get_float(header + 136);
+  R->depth_range[1] = _get_float(header + 140);
+  R->hydropathy_range[0] = _get_float(header + 144);
+  R->hydropathy_range[1] = _get_float(header + 148);
+
+  /* Cavity table */
+  R->table = (cavity_rle_entry *)calloc(R->ncav ? R->ncav : 1,
+                                        sizeof(cavity_rle_entry));
+  for (c = 0; c < R->ncav; c++) {
+    if (fread(entry, 1, CAVITY_RLE_ENTRY_SIZE, file) !=
+        CAVITY_RLE_ENTRY_SIZE) {
+      close_cavity_rle(R);
+      return NULL;
+    }
+    R->table[c].nrows = _get_le(entry, 4);
+    R->table[c].nruns = _get_le(entry + 4, 4);
+    R->table[c].nvoxels = _get_le(entry + 8, 4);
+    R->table[c].offset =
+        _get_le(entry + 16, 4) | (unsigned long)_get_le(entry + 20, 4) << 32;
+  }
+
+  return R;
+}
+
+/*
+ * Function: read_cavity_rle
+ * -------------------------
+ *
+ * Decode points of a cavity
+ *
+ * R: opened cavity file
+ * cavity: cavity index (0 for KAA)
+ *
+ * returns: cavity points (free with free_cavity_points) or NULL if cavity
+ * block is invalid
+ *
+ */
+cavity_points *read_cavity_rle(cavity_rle *R, int cavity) {
+  unsigned int r, s, l, run, voxel;
+  unsigned long size;
+  unsigned char *block, *rows, *runs, *surface, *depth, *hydropathy;
+  cavity_rle_entry *e;
+  cavity_points *points;
+
+  if (cavity < 0 || cavity >= R->ncav)
+    return NULL;
+  e = &R->table[cavity];
+
+  /* Read cavity block */
+  size = (unsigned long)e->nrows * CAVITY_RLE_ROW_SIZE +
+         (unsigned long)e->nruns * CAVITY_RLE_RUN_SIZE + (e->nvoxels + 7) / 8 +
+         2UL * e->nvoxels * (R->bits / 8);
+  block = (unsigned char *)malloc(size ? size : 1);
+  if (fseek(R->file, e->offset, SEEK_SET) ||
+      fread(block, 1, size, R->file) != size) {
+    free(block);
+    return NULL;
+  }
+  rows = block;
+  runs = rows + (unsigned long)e->nrows * CAVITY_RLE_ROW_SIZE;
+  surface = runs + (unsigned long)e->nruns * CAVITY_RLE_RUN_SIZE;
+  depth = surface + (e->nvoxels + 7) / 8;
+  hydropathy = depth + (unsigned long)e->nvoxels * (R->bits / 8);
+
+  points = (cavity_points *)malloc(sizeof(cavity_points));
+  points->nvoxels = e->nvoxels;
+  points->i = (int *)malloc((e->nvoxels + 1) * sizeof(int));
+  points->j = (int *)malloc((e->nvoxels + 1) * sizeof(int));
+  points->k = (int *)malloc((e->nvoxels + 1) * sizeof(int));
+  points->surface = (unsigned char *)malloc(e->nvoxels + 1);
+  points->depth = (float *)malloc((e->nvoxels + 1) * sizeof(float));
+  points->hydropathy = (float *)malloc((e->nvoxels + 1) * sizeof(float));
+
+  /* Expand runs of each row */
+  for (r = 0, run = 0, voxel = 0; r < e->nrows; r++)
+    for (s = _get_le(rows + r * CAVITY_RLE_ROW_SIZE + 4, 2); s > 0; s--) {
+      if (run == e->nruns) {
+        free(block);
+        free_cavity_points(points);
+        return NULL;
+      }
+      for (l = 0; l < _get_le(runs + run * CAVITY_RLE_RUN_SIZE + 2, 2); l++) {
+        if (voxel == e->nvoxels) {
+          free(block);
+          free_cavity_points(points);
+          return NULL;
+        }
+        points->i[voxel] = _get_le(rows + r * CAVITY_RLE_ROW_SIZE, 2);
+        points->j[voxel] = _get_le(rows + r * CAVITY_RLE_ROW_SIZE + 2, 2);
+        points->k[voxel] = _get_le(runs + run * CAVITY_RLE_RUN_SIZE, 2) + l;
+        voxel++;
+      }
+      run++;
+    }
+  if (voxel != e->nvoxels) {
+    free(block);
+    free_cavity_points(points);
+    return NULL;
+  }
+
+  /* Per point values */
+  for (voxel = 0; voxel < e->nvoxels; voxel++) {
+    points->surface[voxel] = (surface[voxel / 8] >> (voxel % 8)) & 1;
+    points->depth[voxel] = _dequantize(depth + voxel * (R->bits / 8), R->bits,
+                                       R->depth_range);
+    points->hydropathy[voxel] =
+        _dequantize(hydropathy + voxel * (R->bits / 8), R->bits,
+                    R->hydropathy_range);
+  }
+
+  free(block);
+  return points;
+}
+
+/*
+ * Function: cavity_rle_point
+ * --------------------------
+ *
+ * Get real coordinates of a grid point
+ *
+ * R: opened cavity file
+ * i: x grid coordinate
+ * j: y grid coordinate
+ * k: z grid coordinate
+ * P: real coordinates (x, y, z)
+ *
+ */
+void cavity_rle_point(cavity_rle *R, int i, int j, int k, double P[3]) {
+  int a;
+
+  for (a = 0; a < 3; a++)
+    P[a] = R->origin[a] + R->step * (i * R->rotation[0][a] +
+                                     j * R->rotation[1][a] +
+                                     k * R->rotation[2][a]);
+}
+
+/*
+ * Function: free_cavity_points
+ * ----------------------------
+ *
+ * Free decoded points of a cavity
+ *
+ * points: cavity points
+ *
+ */
+void free_cavity_points(cavity_points *points) {
+  free(points->i);
+  free(points->j);
+  free(points->k);
+  free(points->surface);
+  free(points->depth);
+  free(points->hydropathy);
+  free(points);
+}
+
+/*
+ * Function: close_cavity_rle
+ * --------------------------
+ *
+ * Close a run-length encoded cavity file
+ *
+ * R: opened cavity file
+ *
+ */
+void close_cavity_rle(cavity_rle *R) {
+  fclose(R->file);
+  free(R->table);
+  free(R);
+}
@@ -0,0 +1,133 @@
+#ifndef CAVITYRLE_H
+#define CAVITYRLE_H
+
+#include <stdio.h>
+
+/*
+ * Run-length encoded cavity file (<output>.KVFinder.cavities.rle)
+ * ---------------------------------------------------------------
+ *
+ * Little-endian binary file storing cavity points per cavity:
+ *
+ * header (CAVITY_RLE_HEADER_SIZE bytes):
+ *   0: magic (CAVITY_RLE_MAGIC)
+ *   8: uint16 bits of quantized values (8 or 16), uint16 0, uint32 ncav
+ *   16: int32 m, n, o (grid units), int32 0
+ *   32: float64 origin[3] (P1), float64 step, float64 rotation[3][3]
+ *   136: float32 depth range (min, max), hydropathy range (min, max)
+ * cavity table (ncav x CAVITY_RLE_ENTRY_SIZE bytes), KAA first:
+ *   uint32 nrows, uint32 nruns, uint32 nvoxels, uint32 0, uint64 offset
+ * cavity block at offset:
+ *   rows (nrows x uint16 i, j, runs): grid points (i, j, k) of a row have
+ *   same i and j, with rows sorted by i, then j
+ *   runs (nruns x uint16 k, length): points k to k + length - 1 of row
+ *   surface (nvoxels bits, least significant first): surface points
+ *   depth and hydropathy (nvoxels x bits each): quantized as
+ *   q = round((value - min) / (max - min) * (2^bits - 1))
+ *
+ * Voxels are numbered in row order, then run order. Grid point (i, j, k) is
+ * at origin + step * (i * rotation[0] + j * rotation[1] + k * rotation[2]).
+ *
+ */
+
+#define CAVITY_RLE_MAGIC "KVFRLE01"
+#define CAVITY_RLE_HEADER_SIZE 152
+#define CAVITY_RLE_ENTRY_SIZE 24
+#define CAVITY_RLE_ROW_SIZE 6
+#define CAVITY_RLE_RUN_SIZE 4
+#define CAVITY_RLE_MAX_UNITS 65535
+
+/* Structs */
+
+/*
+ * Struct: CAVITY_RLE_ENTRY
+ * ------------------------
+ *
+ * A struct containing cavity table entry of a run-length encoded cavity
+ * file
+ *
+ * nrows: number of rows
+ * nruns: number of runs
+ * nvoxels: number of cavity points
+ * offset: offset of cavity block
+ *
+ */
+typedef struct CAVITY_RLE_ENTRY {
+  unsigned int nrows;
+  unsigned int nruns;
+  unsigned int nvoxels;
+  unsigned long offset;
+} cavity_rle_entry;
+
+/*
+ * Struct: CAVITY_RLE
+ * ------------------
+ *
+ * A struct containing an opened run-length encoded cavity file
+ *
+ * file: cavity file
+ * bits: bits of quantized values (8 or 16)
+ * ncav: number of cavities
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * origin: real coordinates of grid point (0, 0, 0)
+ * step: grid spacing
+ * rotation: real space direction of x, y and z grid axes, one per row
+ * depth_range: minimum and maximum depth
+ * hydropathy_range: minimum and maximum hydropathy
+ * table: cavity table
+ *
+ */
+typedef struct CAVITY_RLE {
+  FILE *file;
+  int bits;
+  int ncav;
+  int m;
+  int n;
+  int o;
+  double origin[3];
+  double step;
+  double rotation[3][3];
+  float depth_range[2];
+  float hydropathy_range[2];
+  cavity_rle_entry *table;
+} cavity_rle;
+
+/*
+ * Struct: CAVITY_POINTS
+ * ---------------------
+ *
+ * A struct containing decoded points of a cavity
+ *
+ * nvoxels: number of cavity points
+ * i: x grid coordinate of each point
+ * j: y grid coordinate of each point
+ * k: z grid coordinate of each point
+ * surface: whether each point is a surface point
+ * depth: depth of each point (dequantized)
+ * hydropathy: hydropathy of each point (dequantized)
+ *
+ */
+typedef struct CAVITY_POINTS {
+  int nvoxels;
+  int *i;
+  int *j;
+  int *k;
+  unsigned char *surface;
+  float *depth;
+  float *hydropathy;
+} cavity_points;
+
+/* Run-length encoded cavity file decoding */
+unsigned long _get_le(unsigned char *bytes, int size);
+double _get_double(unsigned char *bytes);
+float _get_float(unsigned char *bytes);
+float _dequantize(unsigned char *bytes, int bits, float range[2]);
+cavity_rle *open_cavity_rle(const char *filename);
+cavity_points *read_cavity_rle(cavity_rle *R, int cavity);
+void cavity_rle_point(cavity_rle *R, int i, int j, int k, double P[3]);
+void free_cavity_points(cavity_points *points);
+void close_cavity_rle(cavity_rle *R);
+
+#endif
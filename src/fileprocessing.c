@@ -1,12 +1,95 @@
+#include <ctype.h>
 #include <math.h>
+#include <omp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef ZSTD_SUPPORT
+#include <zstd.h>
+#endif
 
 #include "utils.h"
 
 #include "fileprocessing.h"
+#include "gridprocessing.h"
+#include "kvarchive.h"
+
+/* Number of atoms that fit in the atom table before it has to grow */
+static int capacity = 0;
+
+/* Smallest part of a PDB file parsed by a thread */
+#define MIN_CHUNK_SIZE 65536
+
+/* Compression formats detected from magic bytes */
+#define GZIP_FORMAT 1
+#define ZSTD_FORMAT 2
+
+/* Size of decompressed blocks and most blocks waiting to be parsed */
+#define STREAM_BLOCK_SIZE (1 << 20)
+#define STREAM_QUEUE_SIZE 16
+
+/*
+ * Struct: STREAM_BLOCK
+ * --------------------
+ *
+ * A block of decompressed file contents waiting to be parsed
+ *
+ * data: block contents
+ * size: block size
+ * next: pointer to next block
+ *
+ */
+typedef struct STREAM_BLOCK {
+  char *data;
+  size_t size;
+  struct STREAM_BLOCK *next;
+} stream_block;
+
+/*
+ * Struct: STREAM
+ * --------------
+ *
+ * A compressed file being decompressed by a thread and parsed by another
+ *
+ * input: compressed file contents
+ * size: compressed file size
+ * format: compression format
+ * head: first queued block
+ * tail: last queued block
+ * queued: number of queued blocks
+ * done: whether decompression is over
+ * error: decompression error message (NULL if none)
+ * lock: queue lock
+ * ready: signaled when a block is queued or decompression is over
+ * room: signaled when a block is taken from queue
+ *
+ */
+typedef struct STREAM {
+  char *input;
+  size_t size;
+  int format;
+  stream_block *head;
+  stream_block *tail;
+  int queued;
+  int done;
+  char *error;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  pthread_cond_t room;
+} stream;
+
+/* Structures parsed so far */
+static structure *structures = NULL;
+
+/* van der Waals radii table */
+static vdw_table radii = {NULL, NULL, 0, 0, NULL, 0};
 
 /* parKVFinder parameter file processing */
 
@@ -353,7 +436,7 @@ parameters *readTOML(char *path) {
  * OUTPUT: output directory.
  * BASE_NAME: base name.
  * dictionary_name: path of van der Waals dictionary file
- * (KVFinder_PATH/dictionary).
+ * (or "(built-in)").
  * PDB_NAME: a path to a target PDB file.
  * LIGAND_NAME: a path to a target ligand PDB file.
  * whole_protein_mode: Whether to use the whole protein to build the 3D grid.
@@ -388,9 +471,6 @@ void write_parameters(char *toml_name, char OUTPUT[500], char BASE_NAME[500],
   FILE *toml_file;
   char buffer[1024], *wpmode, *bmode, *smode, *kmode, *lmode, *hmode, *emode;
 
-  /* Create KV_Files directory */
-  mkdir(_combine(OUTPUT, "KV_Files/"), S_IRWXU);
-
   /* Open TOML file */
   toml_file = fopen(toml_name, "w");
   /* Create a buffer */
@@ -524,179 +604,345 @@ void write_parameters(char *toml_name, char OUTPUT[500], char BASE_NAME[500],
 
 /* van der Waals file processing */
 
+/*
+ * Function: _vdw_key
+ * ------------------
+ *
+ * Pack residue and atom name in a van der Waals radii table key
+ *
+ * RESIDUE: residue name (up to 3 chars)
+ * ATOM_TYPE: atom name (up to 5 chars)
+ *
+ * returns: packed key or 0 if names do not fit
+ *
+ */
+unsigned long long _vdw_key(const char *RESIDUE, const char *ATOM_TYPE) {
+  int i;
+  unsigned long long key = 0;
+
+  for (i = 0; i < 3 && RESIDUE[i] != '\0'; i++)
+    key |= (unsigned long long)(unsigned char)RESIDUE[i] << (8 * i);
+  if (RESIDUE[i] != '\0')
+    return 0;
+  for (i = 0; i < 5 && ATOM_TYPE[i] != '\0'; i++)
+    key |= (unsigned long long)(unsigned char)ATOM_TYPE[i] << (8 * (i + 3));
+  if (ATOM_TYPE[i] != '\0')
+    return 0;
+
+  return key;
+}
+
+/*
+ * Function: _vdw_slot
+ * -------------------
+ *
+ * Find slot of a key in van der Waals radii table (linear probing)
+ *
+ * key: packed residue and atom name
+ *
+ * returns: slot holding key or empty slot where key would be inserted
+ *
+ */
+int _vdw_slot(unsigned long long key) {
+  int i;
+
+  for (i = ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (radii.capacity - 1);
+       radii.keys[i] != 0 && radii.keys[i] != key;
+       i = (i + 1) & (radii.capacity - 1))
+    ;
+
+  return i;
+}
+
+/*
+ * Function: _insert_vdw
+ * ---------------------
+ *
+ * Insert radius in van der Waals radii table, replacing the radius of a key
+ * already present
+ *
+ * key: packed residue and atom name
+ * radius: atom radius
+ *
+ */
+void _insert_vdw(unsigned long long key, double radius) {
+  int i, capacity;
+  unsigned long long *keys;
+  double *values;
+
+  if (key == 0)
+    return;
+
+  /* Grow table to keep load factor below 1/2 */
+  if (2 * (radii.size + 1) > radii.capacity) {
+    keys = radii.keys;
+    values = radii.radii;
+    capacity = radii.capacity;
+    radii.capacity = capacity ? 2 * capacity : 1024;
+    radii.keys = (unsigned long long *)calloc(radii.capacity,
+                                              sizeof(unsigned long long));
+    radii.radii = (double *)calloc(radii.capacity, sizeof(double));
+    radii.size = 0;
+    for (i = 0; i < capacity; i++)
+      if (keys[i] != 0)
+        _insert_vdw(keys[i], values[i]);
+    free(keys);
+    free(values);
+  }
+
+  i = _vdw_slot(key);
+  if (radii.keys[i] == 0) {
+    radii.keys[i] = key;
+    radii.size++;
+  }
+  radii.radii[i] = radius;
+}
+
+/*
+ * Function: _lookup_vdw
+ * ---------------------
+ *
+ * Look up a radius in van der Waals radii table
+ *
+ * key: packed residue and atom name
+ * radius: pointer to atom radius
+ *
+ * returns: key found (1) or not (0)
+ *
+ */
+int _lookup_vdw(unsigned long long key, double *radius) {
+  int i;
+
+  if (key == 0 || radii.capacity == 0)
+    return 0;
+
+  i = _vdw_slot(key);
+  if (radii.keys[i] == 0)
+    return 0;
+  *radius = radii.radii[i];
+  return 1;
+}
+
 /*
  * Function: _get_vdw_radius
  * -------------------------
  *
- * Get van der Waals radius for an atom of a residue
+ * Get van der Waals radius for an atom of a residue from the table built by
+ * read_vdw(), falling back to the generic (GEN) radius of its element
  *
  * RESIDUE: residue in 3-letter code
  * ATOM_TYPE: atom name
- * DIC: a vector containing atom name and atom radius per residue type
- * tablesize: number of residue types
- * TABLE: a vector containing residues information (index and residue name)
  * ATOM_SYMBOL: atom symbol
  * log_file: path to log file (KVFinder.log)
  *
- * returns: success (1) or fail (0) to read van der Waals radii file
+ * returns: atom radius or 0.0 if atom is excluded from analysis
  *
  */
-double _get_vdw_radius(char RESIDUE[4], char ATOM_TYPE[4], vdw *DIC[500],
-                       int tablesize, char TABLE[500][4], char ATOM_SYMBOL[2],
+double _get_vdw_radius(char RESIDUE[], char ATOM_TYPE[6], char ATOM_SYMBOL[3],
                        FILE **log_file) {
   /* Declare variables */
-  int i;
   double value = 0.0;
-  char ATOM_TYPE_AUX[4], RES_AUX[4];
-  vdw *p;
-
-  for (i = 0; i < tablesize && value == 0.0; i++) {
-
-    /* If TABLE[i] residue is equal to RES residue, do ... */
-    if (!strcmp(RESIDUE, TABLE[i])) {
+  char ATOM_TYPE_AUX[4];
 
-      /* Loop inside residue linked list and look for ATOM name, then retrieve
-       * radius to value */
-      for (p = DIC[i]->next; p != NULL && value == 0.0; p = p->next)
-        if (!strcmp(ATOM_TYPE, p->symbol)) {
+  /* Retrieve radius of an atom of a residue */
+  if (_lookup_vdw(_vdw_key(RESIDUE, ATOM_TYPE), &value))
+    return value;
 
-          /* Retrieve radius of an atom of a residue */
-          value = p->radius;
-          /* Return radius value */
-          return value;
-        }
-    }
-  }
+  /* If radius not found in table, do ... */
+  fprintf(*log_file, "Warning: Atom radius not found in dictionary:%s %s!\n",
+          ATOM_TYPE, RESIDUE);
 
-  /* If radius not found inside linked list, do ... */
-  if (!value) {
+  if (ATOM_SYMBOL[0] > 90 || ATOM_SYMBOL[0] < 65) {
 
-    fprintf(*log_file, "Warning: Atom radius not found in dictionary:%s %s!\n",
-            ATOM_TYPE, RESIDUE);
-    strcpy(RES_AUX, "GEN");
+    ATOM_TYPE_AUX[0] = ATOM_SYMBOL[1];
+    ATOM_TYPE_AUX[1] = '\0';
 
-    if (ATOM_SYMBOL[0] > 90 || ATOM_SYMBOL[0] < 65) {
+  } else {
 
-      ATOM_TYPE_AUX[0] = ATOM_SYMBOL[1];
-      ATOM_TYPE_AUX[1] = '\0';
+    ATOM_TYPE_AUX[0] = ATOM_SYMBOL[0];
+    ATOM_TYPE_AUX[1] = ATOM_SYMBOL[1];
+    ATOM_TYPE_AUX[2] = '\0';
+  }
 
-    } else {
+  /* Look for generic atom radius */
+  if (_lookup_vdw(_vdw_key("GEN", ATOM_TYPE_AUX), &value)) {
 
-      ATOM_TYPE_AUX[0] = ATOM_SYMBOL[0];
-      ATOM_TYPE_AUX[1] = ATOM_SYMBOL[1];
-      ATOM_TYPE_AUX[2] = '\0';
-    }
+    /* Print warning in log file */
+    fprintf(*log_file, "Warning: Using generic atom %s radius value %.2lf\n",
+            ATOM_TYPE_AUX, value);
+    /* Return radius value */
+    return value;
+  }
 
-    /* Loop inside generic residue linked list and look for an atom, then
-     * retrieve its radius to value */
-    for (i = 0; i < tablesize && value == 0.0; i++) {
+  /* Print warning in log file */
+  fprintf(*log_file,
+          "Warning: Radius data not found for atom %s. This atom will be "
+          "excluded from analysis.\n",
+          ATOM_TYPE_AUX);
 
-      if (!strcmp(RES_AUX, TABLE[i])) {
+  /* Atom excluded from analysis and return radius 0.0 */
+  return 0.0;
+}
 
-        for (p = DIC[i]->next; p != NULL && value == 0.0; p = p->next) {
+/*
+ * Function: _load_vdw_entries
+ * ---------------------------
+ *
+ * Insert dictionary entries in van der Waals radii table. Entries of a
+ * residue form a block: inside a block the last radius of an atom is kept,
+ * and a residue listed again in a later block keeps its first block.
+ *
+ * entries: dictionary entries in dictionary order
+ * nentries: number of entries
+ *
+ */
+void _load_vdw_entries(const vdw_entry *entries, int nentries) {
+  int i, j, skip = 0;
 
-          if (!strcmp(ATOM_TYPE_AUX, p->symbol)) {
+  for (i = 0; i < nentries; i++) {
 
-            /* If radius value is found, print generic atom and its radius value
-             */
-            value = p->radius;
-            /* Print warning in log file */
-            fprintf(*log_file,
-                    "Warning: Using generic atom %s radius value %.2lf\n",
-                    ATOM_TYPE_AUX, p->radius);
-            /* Return radius value */
-            return value;
-          }
-        }
-      }
+    /* New residue block, skipped if residue has been listed before */
+    if (i == 0 || strcmp(entries[i].RESIDUE, entries[i - 1].RESIDUE)) {
+      for (j = 0, skip = 0; j < i && !skip; j++)
+        skip = !strcmp(entries[i].RESIDUE, entries[j].RESIDUE);
     }
+    if (skip)
+      continue;
 
-    /* Print warning in log file */
-    fprintf(*log_file,
-            "Warning: Radius data not found for atom %s. This atom will be "
-            "excluded from analysis.\n",
-            ATOM_TYPE_AUX);
+    _insert_vdw(_vdw_key(entries[i].RESIDUE, entries[i].symbol),
+                entries[i].radius);
   }
-
-  /* Atom excluded from analysis and return radius 0.0 */
-  return value;
 }
 
 /*
- * Function: _get_residues_information
- * ----------------------------------
+ * Function: _read_vdw_binary
+ * --------------------------
  *
- * Read a van der Waals radii dictionary file ($KVFinder_PATH/dictionary) and
- * saves residues information inside TABLE vector and return number of residues.
+ * Load a precompiled van der Waals radii dictionary (see write_vdw_binary()).
+ * The file is mapped and its table used in place on little-endian hosts, and
+ * decoded into an allocated table otherwise.
  *
- * TABLE: a vector containing residues information (index and residue name)
- * tablesize: number of residue types
- * dictionary_name: path of van der Waals dictionary file
- * ($KVFinder_PATH/dictionary)
+ * dictionary_name: path of precompiled dictionary
  *
- * returns: number of residues
+ * returns: success (1) or fail (0) to load precompiled dictionary
  *
  */
-int _get_residues_information(char dictionary_name[500], char TABLE[500][4]) {
-  /* Declare variables */
-  int i = 0, j = 0;
-  char AUX[50];
-  FILE *arq;
+int _read_vdw_binary(char dictionary_name[500]) {
+  int fd, i;
+  unsigned int one = 1;
+  unsigned long capacity, word;
+  unsigned char header[VDW_BINARY_HEADER_SIZE], *slots;
+  char *buffer;
+  struct stat st;
+
+  if ((fd = open(dictionary_name, O_RDONLY)) < 0)
+    return 0;
 
-  /* Open dictionary file */
-  arq = fopen(dictionary_name, "r");
+  /* Check magic bytes, version and table size against file size */
+  if (fstat(fd, &st) || st.st_size < VDW_BINARY_HEADER_SIZE ||
+      read(fd, header, VDW_BINARY_HEADER_SIZE) != VDW_BINARY_HEADER_SIZE ||
+      memcmp(header, VDW_BINARY_MAGIC, 8) ||
+      _load_le(header + 8, 4) != VDW_BINARY_VERSION) {
+    close(fd);
+    return 0;
+  }
+  capacity = _load_le(header + 12, 4);
+  if (capacity == 0 || capacity > (1UL << 30) ||
+      (capacity & (capacity - 1)) ||
+      st.st_size != VDW_BINARY_HEADER_SIZE + (off_t)capacity * 16) {
+    close(fd);
+    return 0;
+  }
 
-  /* File has not been found */
-  if (arq == NULL) {
-    /* Print error and exit */
-    fprintf(stderr,
-            "\033[0;31mError:\033[0m Residues dictionary file not found!\n");
-    exit(-1);
+  buffer = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buffer == MAP_FAILED)
+    return 0;
+
+  radii.capacity = capacity;
+  radii.size = _load_le(header + 16, 4);
+  slots = (unsigned char *)buffer + VDW_BINARY_HEADER_SIZE;
+
+  /* Use table in place */
+  if (*(unsigned char *)&one) {
+    radii.keys = (unsigned long long *)slots;
+    radii.radii = (double *)(slots + capacity * 8);
+    radii.mapped = buffer;
+    radii.mapped_size = st.st_size;
+    return 1;
   }
-  /* File has been found */
-  else
-    /* While EOF not read in AUX object, do ... */
-    while (fscanf(arq, "%s", AUX) != EOF) {
-      if (AUX[0] == '>') {
-        /* Copy each letter of residue symbol inside TABLE */
-        for (j = 1; j < strlen(AUX); j++)
-          TABLE[i][j - 1] = AUX[j];
-        /* Put each symbol at the end of residue symbol */
-        TABLE[i][j - 1] = '\0';
-        /* Increment line iterator */
-        i++;
-      }
-    }
 
-  /* Close dictionary file */
-  fclose(arq);
+  /* Decode table */
+  radii.keys = (unsigned long long *)calloc(capacity,
+                                            sizeof(unsigned long long));
+  radii.radii = (double *)calloc(capacity, sizeof(double));
+  for (i = 0; i < (int)capacity; i++) {
+    radii.keys[i] = _load_le(slots + 8 * i, 8);
+    word = _load_le(slots + 8 * (capacity + i), 8);
+    memcpy(&radii.radii[i], &word, sizeof(double));
+  }
+  munmap(buffer, st.st_size);
 
-  /* Return number of residues in TABLE */
-  return i;
+  return 1;
+}
+
+/*
+ * Function: free_vdw
+ * ------------------
+ *
+ * Empty van der Waals radii table, unmapping a precompiled dictionary
+ *
+ */
+void free_vdw() {
+  if (radii.mapped != NULL)
+    munmap(radii.mapped, radii.mapped_size);
+  else {
+    free(radii.keys);
+    free(radii.radii);
+  }
+  radii.keys = NULL;
+  radii.radii = NULL;
+  radii.size = 0;
+  radii.capacity = 0;
+  radii.mapped = NULL;
+  radii.mapped_size = 0;
 }
 
 /*
  * Function: read_vdw
  * ------------------
  *
- * Read a van der Waals radii dictionary file ($KVFinder_PATH/dictionary) to a
- * linked list.
+ * Load a van der Waals radii dictionary into the radii table used by
+ * _get_vdw_radius(), replacing a table loaded before. The dictionary is
+ * either the built-in one (BUILTIN_DICTIONARY), a precompiled dictionary
+ * (mapped in place) or a text dictionary file (parsed once).
  *
- * DIC: a vector containing atom name and atom radius per residue type
- * tablesize: number of residue types
- * dictionary_name: path of van der Waals dictionary file
- * ($KVFinder_PATH/dictionary)
+ * dictionary_name: path of van der Waals dictionary file or
+ * BUILTIN_DICTIONARY
  *
  * returns: success (1) or fail (0) to read van der Waals radii file
  *
  */
-int read_vdw(char dictionary_name[500], vdw *DIC[500], int tablesize) {
+int read_vdw(char dictionary_name[500]) {
   /* Declare variables */
-  int i, flag = 1;
-  char AUX[50];
+  int nentries = 0, capacity = 0, flag = 1;
+  double radius;
+  char AUX[50], RESIDUE[50] = "";
   FILE *dictionary_file;
-  /* Dictionary structure: {symbol, radius, *next} */
-  vdw *p;
+  vdw_entry *entries = NULL;
+
+  /* Empty radii table */
+  free_vdw();
+
+  /* Built-in dictionary */
+  if (!strcmp(dictionary_name, BUILTIN_DICTIONARY)) {
+    _load_vdw_entries(builtin_dictionary, builtin_dictionary_size);
+    return flag;
+  }
+
+  /* Precompiled dictionary */
+  if (_read_vdw_binary(dictionary_name))
+    return flag;
 
   /* Open dictionary file */
   dictionary_file = fopen(dictionary_name, "r");
@@ -708,340 +954,1583 @@ int read_vdw(char dictionary_name[500], vdw *DIC[500], int tablesize) {
     exit(-1);
   }
 
-  /* from zero to tablesize object, attribute NULL to each point of DIC */
-  for (i = 0; i < tablesize; i++)
-    DIC[i] = NULL;
-
-  /* Read lines in dictionary file until reaches EOF and i < tablesize */
-  for (i = -1; fscanf(dictionary_file, "%s", AUX) != EOF && i < tablesize;) {
+  /* Read residues (>RES) and atom name and radius pairs until EOF */
+  while (fscanf(dictionary_file, "%49s", AUX) != EOF) {
 
     if (AUX[0] == '>')
-      /* Count a residue */
-      i++;
-    else {
-
-      /* Allocate a vdw space for p in memory */
-      p = malloc(sizeof(vdw));
-      /* Read radius value and save inside struct p inside radius */
-      fscanf(dictionary_file, "%lf", &p->radius);
-      /* Copy AUX string and paste inside struct p inside symbol */
-      strcpy(p->symbol, AUX);
-      /* NULL pointer to last item inserted in linked list */
-      p->next = NULL;
-
-      /* Create a linked list for accessing each residue information i indicates
-      the residue. So, DIC[i] is the linked list of the residue i */
-      if (DIC[i] == NULL)
-        /* Allocate a vdw space for DIC[i] in memory */
-        DIC[i] = malloc(sizeof(vdw));
-      else
-        p->next = DIC[i]->next;
-      DIC[i]->next = p;
+      strcpy(RESIDUE, AUX + 1);
+    else if (RESIDUE[0] != '\0') {
+
+      /* Double entries capacity when full */
+      if (nentries == capacity) {
+        capacity = capacity ? 2 * capacity : 1024;
+        entries = (vdw_entry *)realloc(entries, capacity * sizeof(vdw_entry));
+      }
+
+      /* Read radius, skipping entries whose residue or atom name does not
+       * fit a table key (as the built-in dictionary does) */
+      if (fscanf(dictionary_file, "%lf", &radius) != 1 ||
+          strlen(RESIDUE) > 3 || strlen(AUX) > 5)
+        continue;
+
+      /* Save residue, atom name and radius */
+      strcpy(entries[nentries].RESIDUE, RESIDUE);
+      strcpy(entries[nentries].symbol, AUX);
+      entries[nentries++].radius = radius;
     }
   }
 
   /* Close dictionary file */
   fclose(dictionary_file);
 
+  /* Build radii table */
+  _load_vdw_entries(entries, nentries);
+  free(entries);
+
   /* Return flag indicating file has been found */
   return flag;
 }
 
+/*
+ * Function: write_vdw_binary
+ * --------------------------
+ *
+ * Write radii table loaded by read_vdw() as a precompiled dictionary: magic
+ * bytes, version, table capacity and size, keys and radii, all little-endian
+ * (see VDW_BINARY_MAGIC). It can be passed as dictionary file and is mapped
+ * in place at load.
+ *
+ * output_name: path of precompiled dictionary
+ *
+ */
+void write_vdw_binary(char *output_name) {
+  int i;
+  unsigned long word;
+  size_t size = VDW_BINARY_HEADER_SIZE + (size_t)radii.capacity * 16;
+  unsigned char *buffer, *slots;
+  FILE *output;
+
+  /* Encode header and table */
+  buffer = (unsigned char *)calloc(size, 1);
+  memcpy(buffer, VDW_BINARY_MAGIC, 8);
+  _store_le(buffer + 8, VDW_BINARY_VERSION, 4);
+  _store_le(buffer + 12, radii.capacity, 4);
+  _store_le(buffer + 16, radii.size, 4);
+  slots = buffer + VDW_BINARY_HEADER_SIZE;
+  for (i = 0; i < radii.capacity; i++) {
+    _store_le(slots + 8 * i, radii.keys[i], 8);
+    memcpy(&word, &radii.radii[i], sizeof(double));
+    _store_le(slots + 8 * ((size_t)radii.capacity + i), word, 8);
+  }
+
+  output = fopen(output_name, "wb");
+  if (output == NULL || fwrite(buffer, 1, size, output) != size ||
+      fclose(output) != 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Cannot write precompiled "
+                    "dictionary file!\n");
+    exit(-1);
+  }
+  free(buffer);
+}
+
+/*
+ * Function: max_vdw_radius
+ * ------------------------
+ *
+ * Get largest radius of van der Waals radii table
+ *
+ * returns: largest atom radius
+ *
+ */
+double max_vdw_radius() {
+  int i;
+  double radius = 0.0;
+
+  for (i = 0; i < radii.capacity; i++)
+    if (radii.keys[i] != 0 && radii.radii[i] > radius)
+      radius = radii.radii[i];
+
+  return radius;
+}
+
 /* Protein DataBank (PDB) file processing */
 
 /*
- * Function: _create_atom
- * ----------------------
+ * Function: _set_atom
+ * -------------------
  *
- * Create a atom node
+ * Fill an atom of the atom table. The hydropathy of the residue is looked up
+ * once here, so cavity hydropathy does not need to.
  *
+ * new: atom to be filled
  * x: X-axis coordinate
  * y: Y-axis coordinate
  * z: Z-axis coordinate
  * radius: atom radius
  * resnumber: residue number
- * resname: residue name
+ * resname: residue name (one-letter code)
+ * RESIDUE: residue name
  * chain: chain identifier
- * next: pointer to next ATOM struct
  *
- * returns: atom node with atomic information
  */
-atom *_create_atom(double x, double y, double z, double radius, int resnumber,
-                   char resname, char chain) {
-  atom *new = (atom *)malloc(sizeof(atom));
-
+void _set_atom(atom *new, double x, double y, double z, double radius,
+               int resnumber, char resname, char *RESIDUE, char *chain) {
   new->x = x;
   new->y = y;
   new->z = z;
   new->radius = radius;
   new->resnumber = resnumber;
-  new->chain = chain;
+  snprintf(new->chain, CHAIN_SIZE, "%s", chain);
   new->resname = resname;
-  new->next = NULL;
-
-  return new;
+  snprintf(new->RESIDUE, RESIDUE_SIZE, "%s", RESIDUE);
+  new->hydropathy =
+      get_hydrophobicity_value(_code2residue(resname), resn, scale);
 }
 
 /*
  * Function: _insert_atom
  * ----------------------
  *
- * Insert atom node in linked list
+ * Append atom to the contiguous atom table (v), growing it when needed. The
+ * position of an atom in the table is its atom index.
  *
- * head: pointer to linked list head
- * new: atom node
+ * x: X-axis coordinate
+ * y: Y-axis coordinate
+ * z: Z-axis coordinate
+ * radius: atom radius
+ * resnumber: residue number
+ * resname: residue name (one-letter code)
+ * RESIDUE: residue name
+ * chain: chain identifier
  *
  */
-void _insert_atom(atom **head, atom *new) {
-  atom *current;
-
-  if (*head == NULL || (*head)->resnumber >= new->resnumber) {
-    new->next = *head;
-    *head = new;
-  } else {
-    current = *head;
-    while (current->next != NULL && current->next->resnumber < new->resnumber) {
-      current = current->next;
-    }
-    new->next = current->next;
-    current->next = new;
+void _insert_atom(double x, double y, double z, double radius, int resnumber,
+                  char resname, char *RESIDUE, char *chain) {
+  /* Double table capacity when full */
+  if (natoms == capacity) {
+    capacity = capacity ? 2 * capacity : 1024;
+    v = (atom *)realloc(v, capacity * sizeof(atom));
   }
+
+  _set_atom(&v[natoms++], x, y, z, radius, resnumber, resname, RESIDUE,
+            chain);
 }
 
 /*
- * Function: soft_read_pdb
- * -----------------------
+ * Function: _map_file
+ * -------------------
  *
- * Soft read atomic information of a target PDB file
+ * Map a file in memory (read-only). Files that cannot be mapped (e.g. pipes)
+ * are read into a buffer instead.
  *
- * PDB_NAME: path to a target PDB file
- * has_resnumber: whether to save residue number
- * has_chain: whether to save chain identifier
+ * name: path to file
+ * size: pointer to file size
+ * mapped: pointer to flag indicating whether buffer is mapped (1) or
+ * allocated (0)
+ *
+ * returns: file contents or NULL if file can not be opened
  *
  */
-int soft_read_pdb(char PDB_NAME[500], int has_resnumber, int has_chain) {
-  /* Declare variables */
-  int flag = 1, i, resnumber;
-  double x, y, z;
-  char AUX[10] = "", X[10] = "", Y[10] = "", Z[10] = "", LINE[100],
-       CHAIN[10] = "";
-  atom *new;
-  FILE *arqPDB;
-
-  /* NULL pointer to last item in PDB information linked list */
-  v = NULL;
-
-  /* Open PDB file */
-  arqPDB = fopen(PDB_NAME, "r");
-
-  /* PDB file not found */
-  if (arqPDB == NULL) {
-
-    /* Print error and exit */
-    printf("\033[0;31mError:\033[0m PDB file not found!\n");
-    exit(-1);
-
-  } else {
-
-    /* Parse PDB */
-    /* While PDB is not over, do ... */
-    while (_read_line(arqPDB, LINE, 100)) {
-
-      /* Extract Record Name */
-      _extract(LINE, strlen(LINE), AUX, strlen(AUX), 0, 6);
-      /* If Record Name is equal to ATOM or HETATM, do ... */
-      if (!strcmp(AUX, "ATOM  ") || !strcmp(AUX, "HETATM")) {
-
-        /*Get residue sequence number*/
-        if (has_resnumber) {
-          _extract(LINE, strlen(LINE), AUX, strlen(AUX), 22, 26);
-          resnumber = atoi(AUX);
-        }
-
-        /* Extract x coordinate */
-        _extract(LINE, strlen(LINE), X, strlen(X), 30, 38);
-        x = atof(X);
-        /* Extract y coordinate */
-        _extract(LINE, strlen(LINE), Y, strlen(Y), 38, 46);
-        y = atof(Y);
-        /* Extract z coordinate */
-        _extract(LINE, strlen(LINE), Z, strlen(Z), 46, 54);
-        z = atof(Z);
-
-        /* Extract chain identifier */
-        if (has_chain)
-          _extract(LINE, strlen(LINE), CHAIN, strlen(CHAIN), 21, 22);
-
-        /* Save coordinate (x,y,z), residue number and chain */
-        new = _create_atom(x, y, z, 0.0, resnumber, 0, CHAIN[0]);
-        if (has_resnumber && has_chain)
-          _insert_atom(&v, new);
-        else
-          _insert_atom(&v, new);
-      }
+char *_map_file(char *name, size_t *size, int *mapped) {
+  int fd;
+  ssize_t nread;
+  size_t allocated;
+  struct stat st;
+  char *buffer;
+
+  if ((fd = open(name, O_RDONLY)) < 0)
+    return NULL;
+
+  /* Map regular files */
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    buffer = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buffer != MAP_FAILED) {
+      madvise(buffer, st.st_size, MADV_SEQUENTIAL);
+      close(fd);
+      *size = st.st_size;
+      *mapped = 1;
+      return buffer;
     }
   }
 
-  /* Close PDB file */
-  fclose(arqPDB);
+  /* Read anything else */
+  allocated = 1 << 16;
+  buffer = (char *)malloc(allocated);
+  *size = 0;
+  while ((nread = read(fd, buffer + *size, allocated - *size)) > 0) {
+    *size += nread;
+    if (*size == allocated) {
+      allocated *= 2;
+      buffer = (char *)realloc(buffer, allocated);
+    }
+  }
+  close(fd);
+  *mapped = 0;
 
-  /* Return flag indicating file has been read */
-  return flag;
+  return buffer;
 }
 
 /*
- * Function: read_pdb
- * ------------------
+ * Function: _unmap_file
+ * ---------------------
  *
- * Read atomic information of a target PDB file
+ * Release file contents returned by _map_file()
  *
- * PDB_NAME: path to a target PDB file
- * DIC: a vector containing atom name and atom radius per residue type
- * tablesize: number of residue types
- * TABLE: a vector containing residues information (index and residue name)
- * probe: probe size
- * m: x grid units
- * n: y grid units
- * o: z grid units
- * h: grid spacing (step)
- * X1: x coordinate of P1
- * Y1: y coordinate of P1
- * Z1: z coordinate of P1
- * log_file: path to log file (KVFinder.log)
+ * buffer: file contents
+ * size: file size
+ * mapped: whether buffer is mapped (1) or allocated (0)
  *
  */
-int read_pdb(char PDB_NAME[500], vdw *DIC[500], int tablesize,
-             char TABLE[500][4], double probe, int m, int n, int o, double h,
-             double X1, double Y1, double Z1, FILE **log_file) {
-  /* Declare variables */
-  int flag = 1, i, j, number;
-  char AUX[10] = "", LINE[100] = "", X[10] = "", Y[10] = "", Z[10] = "",
-       RESIDUE[10] = "", ATOM_TYPE[10] = "", ATOM_SYMBOL[10] = "",
-       CHAIN[10] = "";
-  double x, y, z, x1, y1, z1, xaux, yaux, zaux, radius;
-  atom *new;
-  FILE *arqPDB;
-
-  /* Open PDB file */
-  arqPDB = fopen(PDB_NAME, "r");
-
-  /* PDB file not found */
-  if (arqPDB == NULL) {
+void _unmap_file(char *buffer, size_t size, int mapped) {
+  if (mapped)
+    munmap(buffer, size);
+  else
+    free(buffer);
+}
 
-    /* Print error and exit*/
-    printf("\033[0;31mError:\033[0m PDB file not found!\n");
-    exit(-1);
+/*
+ * Function: _next_line
+ * --------------------
+ *
+ * Walk to next line of a file in memory, without copying it
+ *
+ * cursor: pointer to current position (moved to next line)
+ * end: end of file contents
+ * length: pointer to line length (without line break)
+ *
+ * returns: line start or NULL if file is over
+ *
+ */
+char *_next_line(char **cursor, char *end, int *length) {
+  char *line = *cursor, *eol;
 
-  }
-  /* PDB file found */
-  else {
+  if (line >= end)
+    return NULL;
 
-    /* Parse PDB */
-    /* While PDB file is not over, do ... */
-    while (_read_line(arqPDB, LINE, 100)) {
-
-      /* Extract Record Name */
-      _extract(LINE, strlen(LINE), AUX, strlen(AUX), 0, 6);
-      /* If Record Name is equal to ATOM or HETATM, do ... */
-      if (!strcmp(AUX, "ATOM  ") || !strcmp(AUX, "HETATM")) {
-        /* Get atom type */
-        _extract(LINE, strlen(LINE), ATOM_TYPE, strlen(ATOM_TYPE), 12, 17);
-        _remove_char(ATOM_TYPE, strlen(ATOM_TYPE), ' ');
-        _remove_char(ATOM_TYPE, strlen(ATOM_TYPE), ' ');
-
-        /* Get residue name */
-        _extract(LINE, strlen(LINE), RESIDUE, strlen(RESIDUE), 17, 20);
-        _remove_char(RESIDUE, strlen(RESIDUE), ' ');
-        _remove_char(ATOM_TYPE, strlen(ATOM_TYPE), ' ');
-
-        /* Get residue sequence number */
-        _extract(LINE, strlen(LINE), AUX, strlen(AUX), 22, 26);
-        number = atoi(AUX);
-
-        /* Extract atom symbol */
-        _extract(LINE, strlen(LINE), ATOM_SYMBOL, strlen(ATOM_SYMBOL), 76, 78);
-        _remove_char(ATOM_SYMBOL, strlen(ATOM_SYMBOL), ' ');
-
-        /* Extract chain identifier */
-        _extract(LINE, strlen(LINE), CHAIN, strlen(CHAIN), 21, 22);
-
-        /* Extract x coordinate */
-        _extract(LINE, strlen(LINE), X, strlen(X), 30, 38);
-        x = atof(X);
-        /* Extract y coordinate */
-        _extract(LINE, strlen(LINE), Y, strlen(Y), 38, 46);
-        y = atof(Y);
-        /* Extract z coordinate */
-        _extract(LINE, strlen(LINE), Z, strlen(Z), 46, 54);
-        z = atof(Z);
-
-        /* Get radius for an atom in a specific residue based on VdW radius
-         * dictionary */
-        radius = _get_vdw_radius(RESIDUE, ATOM_TYPE, DIC, tablesize, TABLE,
-                                 ATOM_SYMBOL, log_file);
-
-        /* Calculate coordinate (x1, y1, z1) for atom */
-        x1 = (x - X1) / h;
-        y1 = (y - Y1) / h;
-        z1 = (z - Z1) / h;
-        xaux = x1 * cosb + z1 * sinb;
-        yaux = y1;
-        zaux = -x1 * sinb + z1 * cosb;
-        x1 = xaux;
-        y1 = yaux * cosa - zaux * sina;
-        z1 = yaux * sina + zaux * cosa;
-
-        /* Create a linked list only for atoms inside search box */
-        if (x1 > 0.0 - (probe + radius) / h &&
-            x1 < (double)m + (probe + radius) / h &&
-            y1 > 0.0 - (probe + radius) / h &&
-            y1 < (double)n + (probe + radius) / h &&
-            z1 > 0.0 - (probe + radius) / h &&
-            z1 < (double)o + (probe + radius) / h) {
-
-          /* Save coordinates (x,y,z), radius, residue number and chain */
-          new = _create_atom(x, y, z, radius, number, _residue2code(RESIDUE),
-                             CHAIN[0]);
-          _insert_atom(&v, new);
-        }
-      }
-    }
-  }
+  eol = (char *)memchr(line, '\n', end - line);
+  if (eol == NULL)
+    eol = end;
+  *cursor = eol + 1;
 
-  /* Close PDB file */
-  fclose(arqPDB);
+  /* Ignore carriage return of DOS line breaks */
+  if (eol > line && eol[-1] == '\r')
+    eol--;
+  *length = eol - line;
 
-  /* Return flag indicating file has been read */
-  return flag;
+  return line;
 }
 
 /*
- * Function: _free_atom
- * --------------------
+ * Function: _column
+ * -----------------
+ *
+ * Get a character of a fixed-column record, treating columns past the end of
+ * the line as blank
  *
- * Free linked list with PDB atomic information
+ * line: line start
+ * length: line length
+ * i: column (0-based)
+ *
+ * returns: character at column i
  *
  */
-void _free_atom() {
-  atom *p;
-
-  while (v != NULL) {
-    p = v;
-    v = v->next;
-    free(p);
-  }
+char _column(char *line, int length, int i) {
+  return i < length ? line[i] : ' ';
 }
 
-/* parKVFinder results file processing */
-
 /*
- * Function: write_results
- * -----------------------
+ * Function: _parse_int
+ * --------------------
  *
- * Write parKVFinder TOML-formatted results to file
+ * Parse an integer from columns [start, end) of a fixed-column record, like
+ * atoi() on the field
  *
- * output_results: a path to a TOML-formatted results file
- * pdb_name: path to target PDB file
+ * line: line start
+ * length: line length
+ * start: first column (0-based)
+ * end: column after last one
+ *
+ * returns: integer value
+ *
+ */
+int _parse_int(char *line, int length, int start, int end) {
+  int i = start, sign = 1, value = 0;
+
+  if (end > length)
+    end = length;
+  while (i < end && (line[i] == ' ' || line[i] == '\t'))
+    i++;
+  if (i < end && (line[i] == '-' || line[i] == '+'))
+    sign = line[i++] == '-' ? -1 : 1;
+  for (; i < end && line[i] >= '0' && line[i] <= '9'; i++)
+    value = 10 * value + (line[i] - '0');
+
+  return sign * value;
+}
+
+/*
+ * Function: _parse_fixed
+ * ----------------------
+ *
+ * Parse a fixed-point decimal number (e.g. PDB coordinates) from columns
+ * [start, end) of a fixed-column record. Digits are accumulated in an integer
+ * and divided once by a power of ten, which rounds exactly as atof() does.
+ * Fields in any other form (e.g. with exponents) are handed to strtod().
+ *
+ * line: line start
+ * length: line length
+ * start: first column (0-based)
+ * end: column after last one
+ *
+ * returns: decimal value
+ *
+ */
+double _parse_fixed(char *line, int length, int start, int end) {
+  static const double power[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5,  1e6,  1e7,
+                                 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+  int i = start, sign = 1, digits = 0, decimals = -1;
+  long long mantissa = 0;
+  char field[32];
+
+  if (end > length)
+    end = length;
+  while (i < end && line[i] == ' ')
+    i++;
+  if (i < end && (line[i] == '-' || line[i] == '+'))
+    sign = line[i++] == '-' ? -1 : 1;
+  for (; i < end; i++) {
+    if (line[i] >= '0' && line[i] <= '9') {
+      mantissa = 10 * mantissa + (line[i] - '0');
+      digits++;
+      if (decimals >= 0)
+        decimals++;
+    } else if (line[i] == '.' && decimals < 0)
+      decimals = 0;
+    else
+      break;
+  }
+
+  /* Plain fixed-point field */
+  if ((i == end || line[i] == ' ') && digits <= 15)
+    return sign *
+           (decimals > 0 ? mantissa / power[decimals] : (double)mantissa);
+
+  /* Anything else */
+  if (end - start > 31)
+    end = start + 31;
+  memcpy(field, line + start, end - start);
+  field[end - start] = '\0';
+  return atof(field);
+}
+
+/*
+ * Function: _copy_field
+ * ---------------------
+ *
+ * Copy columns [start, end) of a fixed-column record to a string, skipping
+ * blanks. The rest of the string is zero-filled.
+ *
+ * line: line start
+ * length: line length
+ * start: first column (0-based)
+ * end: column after last one
+ * TO: destination string (at least end - start + 1 chars)
+ *
+ */
+void _copy_field(char *line, int length, int start, int end, char TO[]) {
+  int i, j = 0;
+
+  for (i = start; i < end && i < length; i++)
+    if (line[i] != ' ')
+      TO[j++] = line[i];
+  while (j <= end - start)
+    TO[j++] = '\0';
+}
+
+/*
+ * Function: _is_atom_record
+ * -------------------------
+ *
+ * Check whether a line is an ATOM or HETATM record
+ *
+ * line: line start
+ * length: line length
+ *
+ * returns: record is ATOM or HETATM (1) or not (0)
+ *
+ */
+int _is_atom_record(char *line, int length) {
+  return length >= 6 && (!strncmp(line, "ATOM  ", 6) ||
+                         !strncmp(line, "HETATM", 6));
+}
+
+/*
+ * Function: _split_lines
+ * ----------------------
+ *
+ * Split a file in memory in chunks of about the same size, each one starting
+ * at a line start
+ *
+ * buffer: file contents
+ * size: file size
+ * nchunks: number of chunks
+ *
+ * returns: chunk starts (nchunks + 1 entries, the last one is the file end)
+ *
+ */
+char **_split_lines(char *buffer, size_t size, int nchunks) {
+  int c;
+  char *eol, **bounds = (char **)malloc((nchunks + 1) * sizeof(char *));
+
+  bounds[0] = buffer;
+  for (c = 1; c < nchunks; c++) {
+    bounds[c] = buffer + (size / nchunks) * c;
+    if (bounds[c] < bounds[c - 1])
+      bounds[c] = bounds[c - 1];
+
+    /* Move chunk start to the start of next line */
+    if (bounds[c] > buffer && bounds[c][-1] != '\n') {
+      eol = (char *)memchr(bounds[c], '\n', buffer + size - bounds[c]);
+      bounds[c] = eol == NULL ? buffer + size : eol + 1;
+    }
+  }
+  bounds[nchunks] = buffer + size;
+
+  return bounds;
+}
+
+/*
+ * Function: _parse_chunk
+ * ----------------------
+ *
+ * Parse ATOM and HETATM records of a chunk of a PDB file in memory. Model
+ * index of records counts MODEL records of the chunk only.
+ *
+ * start: chunk start (a line start)
+ * end: chunk end
+ * atoms: pointer to parsed records (allocated here)
+ * nmodels: pointer to number of MODEL records of the chunk
+ *
+ * returns: number of parsed records
+ *
+ */
+int _parse_chunk(char *start, char *end, pdb_atom **atoms, int *nmodels) {
+  int length, count = 0, capacity = 0;
+  char *cursor, *line;
+  pdb_atom *p;
+
+  *atoms = NULL;
+  *nmodels = 0;
+
+  /* While chunk is not over, do ... */
+  for (cursor = start; (line = _next_line(&cursor, end, &length));)
+    /* Count models */
+    if (length >= 6 && !strncmp(line, "MODEL ", 6))
+      (*nmodels)++;
+    /* If Record Name is equal to ATOM or HETATM, do ... */
+    else if (_is_atom_record(line, length)) {
+
+      /* Double record table capacity when full */
+      if (count == capacity) {
+        capacity = capacity ? 2 * capacity : 1024;
+        *atoms = (pdb_atom *)realloc(*atoms, capacity * sizeof(pdb_atom));
+      }
+      p = &(*atoms)[count++];
+
+      /* Get atom type, residue name and atom symbol */
+      _copy_field(line, length, 12, 17, p->ATOM_TYPE);
+      _copy_field(line, length, 17, 20, p->RESIDUE);
+      _copy_field(line, length, 76, 78, p->ATOM_SYMBOL);
+
+      /* Get residue sequence number and chain identifier */
+      p->resnumber = _parse_int(line, length, 22, 26);
+      p->chain[0] = _column(line, length, 21);
+      memset(p->chain + 1, 0, CHAIN_SIZE - 1);
+
+      /* Extract x, y and z coordinates */
+      p->x = _parse_fixed(line, length, 30, 38);
+      p->y = _parse_fixed(line, length, 38, 46);
+      p->z = _parse_fixed(line, length, 46, 54);
+      p->radius = 0.0;
+      p->model = *nmodels;
+    }
+
+  return count;
+}
+
+/* mmCIF file processing */
+
+/*
+ * Function: _next_token
+ * ---------------------
+ *
+ * Walk to next token of a CIF file in memory, without copying it. Comments
+ * are skipped and quotes (or semicolon text fields) are removed from values.
+ *
+ * cursor: pointer to current position (moved past token)
+ * end: end of file contents
+ * length: pointer to token length
+ * quoted: pointer to flag indicating whether token is a quoted value
+ *
+ * returns: token start or NULL if file is over
+ *
+ */
+char *_next_token(char **cursor, char *end, int *length, int *quoted) {
+  char *p = *cursor, *token;
+
+  /* Skip blanks and comments */
+  while (p < end) {
+    if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+      p++;
+    else if (*p == '#')
+      while (p < end && *p != '\n')
+        p++;
+    else
+      break;
+  }
+  if (p >= end)
+    return NULL;
+
+  *quoted = 1;
+
+  /* Text field (semicolon at line start; a token never ends right before a
+   * line start, so only the file start has no blank before it) */
+  if (*p == ';' && (p == *cursor || p[-1] == '\n')) {
+    token = ++p;
+    while (p < end && !(*p == ';' && p[-1] == '\n'))
+      p++;
+    *length = p - token;
+    if (*length > 0 && token[*length - 1] == '\n')
+      (*length)--;
+    *cursor = p < end ? p + 1 : end;
+    return token;
+  }
+
+  /* Quoted value (quote closes only when followed by a blank) */
+  if (*p == '\'' || *p == '"') {
+    token = ++p;
+    while (p < end && !(*p == token[-1] &&
+                        (p + 1 == end || p[1] == ' ' || p[1] == '\t' ||
+                         p[1] == '\r' || p[1] == '\n')))
+      p++;
+    *length = p - token;
+    *cursor = p < end ? p + 1 : end;
+    return token;
+  }
+
+  /* Bare token */
+  *quoted = 0;
+  token = p;
+  while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+    p++;
+  *length = p - token;
+  *cursor = p;
+  return token;
+}
+
+/*
+ * Function: _is_keyword
+ * ---------------------
+ *
+ * Check whether a bare CIF token starts with a keyword (case insensitive)
+ *
+ * token: token start
+ * length: token length
+ * keyword: lowercase keyword (e.g. loop_, data_)
+ *
+ * returns: token starts with keyword (1) or not (0)
+ *
+ */
+int _is_keyword(char *token, int length, char *keyword) {
+  int i;
+
+  for (i = 0; keyword[i] != '\0'; i++)
+    if (i >= length || tolower(token[i]) != keyword[i])
+      return 0;
+  return 1;
+}
+
+/*
+ * Function: _is_cif
+ * -----------------
+ *
+ * Check whether a file in memory is a CIF file, i.e. its first token is a
+ * data block header (data_)
+ *
+ * buffer: file contents
+ * size: file size
+ *
+ * returns: file is CIF (1) or not (0)
+ *
+ */
+int _is_cif(char *buffer, size_t size) {
+  int length, quoted;
+  char *cursor = buffer, *token;
+
+  token = _next_token(&cursor, buffer + size, &length, &quoted);
+  return token != NULL && !quoted && _is_keyword(token, length, "data_");
+}
+
+/*
+ * Function: _copy_token
+ * ---------------------
+ *
+ * Copy a CIF value to a string, truncated to its size. Unknown (?) and
+ * inapplicable (.) values are copied as empty strings.
+ *
+ * token: token start
+ * length: token length
+ * TO: destination string
+ * size: destination size
+ *
+ */
+void _copy_token(char *token, int length, char TO[], int size) {
+  int i;
+
+  if (length == 1 && (token[0] == '?' || token[0] == '.'))
+    length = 0;
+  for (i = 0; i < size; i++)
+    TO[i] = i < length && i < size - 1 ? token[i] : '\0';
+}
+
+/*
+ * Function: _parse_cif
+ * --------------------
+ *
+ * Parse ATOM and HETATM rows of the _atom_site loop of a mmCIF file in memory.
+ * Tokens are streamed: only the columns read into records are looked at.
+ * Author-defined atom names, residue names, chains and residue numbers are
+ * preferred, falling back to label ones. Each change of model number starts
+ * a new model.
+ *
+ * buffer: file contents
+ * size: file size
+ * atoms: pointer to parsed records (allocated here)
+ * nmodels: pointer to number of models
+ *
+ * returns: number of parsed records
+ *
+ */
+int _parse_cif(char *buffer, size_t size, pdb_atom **atoms, int *nmodels) {
+  /* Column of each field in _atom_site loop */
+  enum {
+    GROUP,
+    AUTH_ATOM,
+    LABEL_ATOM,
+    AUTH_COMP,
+    LABEL_COMP,
+    AUTH_ASYM,
+    LABEL_ASYM,
+    AUTH_SEQ,
+    LABEL_SEQ,
+    CARTN_X,
+    CARTN_Y,
+    CARTN_Z,
+    SYMBOL,
+    MODEL,
+    NFIELDS
+  };
+  static char *names[NFIELDS] = {"_atom_site.group_pdb",
+                                 "_atom_site.auth_atom_id",
+                                 "_atom_site.label_atom_id",
+                                 "_atom_site.auth_comp_id",
+                                 "_atom_site.label_comp_id",
+                                 "_atom_site.auth_asym_id",
+                                 "_atom_site.label_asym_id",
+                                 "_atom_site.auth_seq_id",
+                                 "_atom_site.label_seq_id",
+                                 "_atom_site.cartn_x",
+                                 "_atom_site.cartn_y",
+                                 "_atom_site.cartn_z",
+                                 "_atom_site.type_symbol",
+                                 "_atom_site.pdbx_pdb_model_num"};
+  int i, f, length, quoted, column, ncolumns, count = 0, capacity = 0;
+  int model, last_model = 0;
+  int field[NFIELDS], tlength[NFIELDS];
+  char *cursor = buffer, *end = buffer + size, *token, *value[NFIELDS];
+  pdb_atom *p;
+
+  *atoms = NULL;
+  *nmodels = 0;
+
+  while ((token = _next_token(&cursor, end, &length, &quoted))) {
+
+    /* Look for a loop whose first tag belongs to _atom_site */
+    if (quoted || !_is_keyword(token, length, "loop_"))
+      continue;
+    token = _next_token(&cursor, end, &length, &quoted);
+    if (token == NULL || quoted || !_is_keyword(token, length, "_atom_site."))
+      continue;
+
+    /* Read loop tags */
+    for (f = 0; f < NFIELDS; f++)
+      field[f] = -1;
+    for (ncolumns = 0; token != NULL && !quoted && token[0] == '_';
+         ncolumns++) {
+      for (f = 0; f < NFIELDS; f++)
+        if ((int)strlen(names[f]) == length &&
+            _is_keyword(token, length, names[f]))
+          field[f] = ncolumns;
+      token = _next_token(&cursor, end, &length, &quoted);
+    }
+
+    /* Coordinates are mandatory */
+    if (field[CARTN_X] < 0 || field[CARTN_Y] < 0 || field[CARTN_Z] < 0) {
+      fprintf(stderr, "\033[0;31mError:\033[0m mmCIF _atom_site loop has no "
+                      "Cartesian coordinates!\n");
+      exit(-1);
+    }
+    if (field[AUTH_ATOM] < 0)
+      field[AUTH_ATOM] = field[LABEL_ATOM];
+    if (field[AUTH_COMP] < 0)
+      field[AUTH_COMP] = field[LABEL_COMP];
+    if (field[AUTH_ASYM] < 0)
+      field[AUTH_ASYM] = field[LABEL_ASYM];
+    if (field[AUTH_SEQ] < 0)
+      field[AUTH_SEQ] = field[LABEL_SEQ];
+
+    /* Read loop rows until a tag or keyword ends the loop */
+    column = 0;
+    for (i = 0; i < NFIELDS; i++) {
+      value[i] = "";
+      tlength[i] = 0;
+    }
+    while (token != NULL &&
+           (quoted ||
+            (token[0] != '_' && !_is_keyword(token, length, "loop_") &&
+             !_is_keyword(token, length, "data_") &&
+             !_is_keyword(token, length, "save_") &&
+             !_is_keyword(token, length, "global_") &&
+             !_is_keyword(token, length, "stop_")))) {
+
+      /* Keep tokens of the columns of interest */
+      for (f = 0; f < NFIELDS; f++)
+        if (field[f] == column) {
+          value[f] = token;
+          tlength[f] = length;
+        }
+
+      /* Row is over */
+      if (++column == ncolumns) {
+        column = 0;
+
+        if (field[GROUP] < 0 ||
+            (tlength[GROUP] == 4 && !strncmp(value[GROUP], "ATOM", 4)) ||
+            (tlength[GROUP] == 6 && !strncmp(value[GROUP], "HETATM", 6))) {
+
+          /* Double record table capacity when full */
+          if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            *atoms = (pdb_atom *)realloc(*atoms, capacity * sizeof(pdb_atom));
+          }
+          p = &(*atoms)[count++];
+
+          /* Reject chain identifiers and residue names not fitting their
+           * buffers, which would merge residues once truncated */
+          if (tlength[AUTH_ASYM] >= CHAIN_SIZE ||
+              tlength[AUTH_COMP] >= RESIDUE_SIZE) {
+            fprintf(stderr,
+                    "\033[0;31mError:\033[0m mmCIF chain identifier (up to "
+                    "%d characters) or residue name (up to %d characters) "
+                    "too long: %.*s %.*s\n",
+                    CHAIN_SIZE - 1, RESIDUE_SIZE - 1, tlength[AUTH_ASYM],
+                    value[AUTH_ASYM], tlength[AUTH_COMP], value[AUTH_COMP]);
+            exit(-1);
+          }
+
+          /* Get atom type, residue name and atom symbol */
+          _copy_token(value[AUTH_ATOM], tlength[AUTH_ATOM], p->ATOM_TYPE, 6);
+          _copy_token(value[AUTH_COMP], tlength[AUTH_COMP], p->RESIDUE,
+                      RESIDUE_SIZE);
+          _copy_token(value[SYMBOL], tlength[SYMBOL], p->ATOM_SYMBOL, 3);
+          for (i = 0; p->ATOM_SYMBOL[i] != '\0'; i++)
+            p->ATOM_SYMBOL[i] = toupper(p->ATOM_SYMBOL[i]);
+
+          /* Get residue sequence number and chain identifier */
+          p->resnumber = _parse_int(value[AUTH_SEQ], tlength[AUTH_SEQ], 0,
+                                    tlength[AUTH_SEQ]);
+          _copy_token(value[AUTH_ASYM], tlength[AUTH_ASYM], p->chain,
+                      CHAIN_SIZE);
+
+          /* Extract x, y and z coordinates */
+          p->x = _parse_fixed(value[CARTN_X], tlength[CARTN_X], 0,
+                              tlength[CARTN_X]);
+          p->y = _parse_fixed(value[CARTN_Y], tlength[CARTN_Y], 0,
+                              tlength[CARTN_Y]);
+          p->z = _parse_fixed(value[CARTN_Z], tlength[CARTN_Z], 0,
+                              tlength[CARTN_Z]);
+          p->radius = 0.0;
+
+          /* Get model index */
+          if (field[MODEL] >= 0) {
+            model = _parse_int(value[MODEL], tlength[MODEL], 0, tlength[MODEL]);
+            if (*nmodels == 0 || model != last_model)
+              (*nmodels)++;
+            last_model = model;
+          }
+          p->model = *nmodels;
+        }
+      }
+
+      token = _next_token(&cursor, end, &length, &quoted);
+    }
+
+    /* Loop tokens were consumed up to the one ending it */
+    if (token != NULL)
+      cursor = token;
+  }
+
+  return count;
+}
+
+/* Compressed file processing */
+
+/*
+ * Function: _get_compression
+ * --------------------------
+ *
+ * Detect compression format of a file in memory from its magic bytes
+ *
+ * buffer: file contents
+ * size: file size
+ *
+ * returns: GZIP_FORMAT, ZSTD_FORMAT or 0 if file is not compressed
+ *
+ */
+int _get_compression(char *buffer, size_t size) {
+  unsigned char *magic = (unsigned char *)buffer;
+
+  if (size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    return GZIP_FORMAT;
+  if (size >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f &&
+      magic[3] == 0xfd)
+    return ZSTD_FORMAT;
+  return 0;
+}
+
+/*
+ * Function: _push_block
+ * ---------------------
+ *
+ * Hand a decompressed block to the parsing thread, waiting while too many
+ * blocks are queued
+ *
+ * z: decompression stream
+ * data: block contents (owned by the queue from now on)
+ * size: block size
+ *
+ */
+void _push_block(stream *z, char *data, size_t size) {
+  stream_block *block = (stream_block *)malloc(sizeof(stream_block));
+
+  block->data = data;
+  block->size = size;
+  block->next = NULL;
+
+  pthread_mutex_lock(&z->lock);
+  while (z->queued >= STREAM_QUEUE_SIZE)
+    pthread_cond_wait(&z->room, &z->lock);
+  if (z->tail != NULL)
+    z->tail->next = block;
+  else
+    z->head = block;
+  z->tail = block;
+  z->queued++;
+  pthread_cond_signal(&z->ready);
+  pthread_mutex_unlock(&z->lock);
+}
+
+/*
+ * Function: _pop_block
+ * --------------------
+ *
+ * Wait for next decompressed block
+ *
+ * z: decompression stream
+ *
+ * returns: next block or NULL if decompression is over
+ *
+ */
+stream_block *_pop_block(stream *z) {
+  stream_block *block;
+
+  pthread_mutex_lock(&z->lock);
+  while (z->head == NULL && !z->done)
+    pthread_cond_wait(&z->ready, &z->lock);
+  block = z->head;
+  if (block != NULL) {
+    z->head = block->next;
+    if (z->head == NULL)
+      z->tail = NULL;
+    z->queued--;
+    pthread_cond_signal(&z->room);
+  }
+  pthread_mutex_unlock(&z->lock);
+
+  return block;
+}
+
+/*
+ * Function: _inflate_gzip
+ * -----------------------
+ *
+ * Decompress a gzip file (one or more members) in blocks with zlib
+ *
+ * z: decompression stream
+ *
+ * returns: error message or NULL on success
+ *
+ */
+char *_inflate_gzip(stream *z) {
+  int ret = Z_OK;
+  size_t offset = 0;
+  char *data;
+  z_stream zs;
+
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, 15 + 16) != Z_OK)
+    return "Failed to initialize gzip decompression";
+
+  do {
+    data = (char *)malloc(STREAM_BLOCK_SIZE);
+    zs.next_out = (Bytef *)data;
+    zs.avail_out = STREAM_BLOCK_SIZE;
+
+    /* Fill block */
+    while (zs.avail_out > 0) {
+      /* Feed input in pieces zlib can count */
+      if (zs.avail_in == 0 && offset < z->size) {
+        zs.next_in = (Bytef *)z->input + offset;
+        zs.avail_in = z->size - offset > (1U << 30) ? (1U << 30)
+                                                      : z->size - offset;
+        offset += zs.avail_in;
+      }
+      ret = inflate(&zs, Z_NO_FLUSH);
+
+      /* Concatenated gzip members */
+      if (ret == Z_STREAM_END &&
+          (zs.avail_in > 0 || offset < z->size) &&
+          _get_compression((char *)zs.next_in, zs.avail_in) == GZIP_FORMAT)
+        ret = inflateReset(&zs);
+      else if (ret == Z_BUF_ERROR && zs.avail_in == 0 && offset == z->size)
+        break;
+      if (ret != Z_OK)
+        break;
+    }
+
+    _push_block(z, data, STREAM_BLOCK_SIZE - zs.avail_out);
+  } while (ret == Z_OK && zs.avail_out == 0);
+
+  inflateEnd(&zs);
+  if (ret != Z_STREAM_END)
+    return "Corrupted or truncated gzip file";
+  return NULL;
+}
+
+/*
+ * Function: _inflate_zstd
+ * -----------------------
+ *
+ * Decompress a zstd file (one or more frames) in blocks with libzstd, when
+ * built with zstd support (make ZSTD=1)
+ *
+ * z: decompression stream
+ *
+ * returns: error message or NULL on success
+ *
+ */
+char *_inflate_zstd(stream *z) {
+#ifdef ZSTD_SUPPORT
+  ZSTD_DStream *dstream;
+  ZSTD_inBuffer in = {z->input, z->size, 0};
+  ZSTD_outBuffer out;
+  size_t ret = 0;
+  char *error;
+
+  dstream = ZSTD_createDStream();
+  if (dstream == NULL)
+    return "Could not create zstd decompression stream";
+  ZSTD_initDStream(dstream);
+
+  do {
+    out.dst = malloc(STREAM_BLOCK_SIZE);
+    out.size = STREAM_BLOCK_SIZE;
+    out.pos = 0;
+
+    /* Fill block */
+    while (out.pos < out.size && (in.pos < in.size || ret != 0)) {
+      ret = ZSTD_decompressStream(dstream, &out, &in);
+      if (ZSTD_isError(ret) || (in.pos == in.size && out.pos < out.size))
+        break;
+    }
+
+    _push_block(z, (char *)out.dst, out.pos);
+  } while (!ZSTD_isError(ret) && out.pos == out.size);
+
+  /* A complete frame leaves no hint of more input to read */
+  error = ZSTD_isError(ret) || ret != 0 ? "Corrupted or truncated zstd file"
+                                        : NULL;
+  ZSTD_freeDStream(dstream);
+
+  return error;
+#else
+  return "zstd input needs parKVFinder built with zstd support (make ZSTD=1)";
+#endif
+}
+
+/*
+ * Function: _decompress
+ * ---------------------
+ *
+ * Decompression thread: decompress file in blocks and queue them for
+ * parsing
+ *
+ * arg: decompression stream
+ *
+ */
+void *_decompress(void *arg) {
+  stream *z = (stream *)arg;
+  char *error;
+
+  error = z->format == GZIP_FORMAT ? _inflate_gzip(z) : _inflate_zstd(z);
+
+  pthread_mutex_lock(&z->lock);
+  z->error = error;
+  z->done = 1;
+  pthread_cond_signal(&z->ready);
+  pthread_mutex_unlock(&z->lock);
+
+  return NULL;
+}
+
+/*
+ * Function: _parse_compressed
+ * ---------------------------
+ *
+ * Parse a compressed PDB or mmCIF file in memory. A thread decompresses the
+ * file in blocks while whole lines of PDB files are parsed as soon as they
+ * are decompressed. mmCIF files are parsed once decompressed, since their
+ * text fields may span lines.
+ *
+ * buffer: compressed file contents
+ * size: compressed file size
+ * format: compression format (GZIP_FORMAT or ZSTD_FORMAT)
+ * atoms: pointer to parsed records (allocated here)
+ * nmodels: pointer to number of models
+ *
+ * returns: number of parsed records
+ *
+ */
+int _parse_compressed(char *buffer, size_t size, int format, pdb_atom **atoms,
+                      int *nmodels) {
+  int natoms = 0, cif = -1;
+  size_t length = 0, allocated = 0, parsed;
+  char *text = NULL;
+  stream z;
+  stream_block *block;
+  pthread_t decompressor;
+
+  /* Start decompression thread */
+  memset(&z, 0, sizeof(z));
+  z.input = buffer;
+  z.size = size;
+  z.format = format;
+  pthread_mutex_init(&z.lock, NULL);
+  pthread_cond_init(&z.ready, NULL);
+  pthread_cond_init(&z.room, NULL);
+  pthread_create(&decompressor, NULL, _decompress, &z);
+
+  *atoms = NULL;
+  *nmodels = 0;
+  while ((block = _pop_block(&z)) != NULL) {
+
+    /* Append block to decompressed text */
+    if (length + block->size > allocated) {
+      allocated = 2 * (length + block->size);
+      text = (char *)realloc(text, allocated);
+    }
+    memcpy(text + length, block->data, block->size);
+    length += block->size;
+    free(block->data);
+    free(block);
+
+    /* File format is known from first block */
+    if (cif < 0 && length > 0)
+      cif = _is_cif(text, length);
+
+    /* Parse whole lines of PDB and keep the last partial line */
+    if (cif == 0) {
+      for (parsed = length; parsed > 0 && text[parsed - 1] != '\n'; parsed--)
+        ;
+      if (parsed > 0) {
+        natoms = _parse_pdb(text, parsed, atoms, natoms, nmodels);
+        memmove(text, text + parsed, length - parsed);
+        length -= parsed;
+      }
+    }
+  }
+  pthread_join(decompressor, NULL);
+  pthread_mutex_destroy(&z.lock);
+  pthread_cond_destroy(&z.ready);
+  pthread_cond_destroy(&z.room);
+
+  /* Decompression failed */
+  if (z.error != NULL) {
+    fprintf(stderr, "\033[0;31mError:\033[0m %s!\n", z.error);
+    exit(-1);
+  }
+
+  /* Parse rest of file */
+  if (cif == 1)
+    natoms = _parse_cif(text, length, atoms, nmodels);
+  else if (length > 0)
+    natoms = _parse_pdb(text, length, atoms, natoms, nmodels);
+
+  free(text);
+
+  return natoms;
+}
+
+/*
+ * Function: _parse_pdb
+ * --------------------
+ *
+ * Parse ATOM and HETATM records of a PDB file in memory, appending them to
+ * a record table. Large files are split at line starts and chunks are parsed
+ * in parallel, then joined in file order.
+ *
+ * buffer: file contents (whole lines)
+ * size: file size
+ * atoms: pointer to record table (grown here)
+ * natoms: number of records already in table
+ * nmodels: pointer to number of MODEL records read so far (updated here)
+ *
+ * returns: number of records in table
+ *
+ */
+int _parse_pdb(char *buffer, size_t size, pdb_atom **atoms, int natoms,
+               int *nmodels) {
+  /* Declare variables */
+  int a, c, nchunks, *count, *offset, *models;
+  char **bounds;
+  pdb_atom **chunk;
+
+  /* Set number of processes in OpenMP */
+  int ncores = omp_get_num_procs() - 1;
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
+
+  /* Split PDB in chunks of whole lines */
+  nchunks = size / MIN_CHUNK_SIZE + 1;
+  if (nchunks > omp_get_max_threads())
+    nchunks = omp_get_max_threads();
+  bounds = _split_lines(buffer, size, nchunks);
+  chunk = (pdb_atom **)malloc(nchunks * sizeof(pdb_atom *));
+  count = (int *)malloc(nchunks * sizeof(int));
+  offset = (int *)malloc((nchunks + 1) * sizeof(int));
+  models = (int *)malloc((nchunks + 1) * sizeof(int));
+
+  /* Parse PDB chunks */
+#pragma omp parallel for schedule(static, 1) if (nchunks > 1)
+  for (c = 0; c < nchunks; c++)
+    count[c] = _parse_chunk(bounds[c], bounds[c + 1], &chunk[c], &models[c]);
+
+  /* Join parsed chunks in file order, with models of previous chunks */
+  offset[0] = natoms;
+  for (c = 0; c < nchunks; c++) {
+    offset[c + 1] = offset[c] + count[c];
+    for (a = 0; a < count[c]; a++)
+      chunk[c][a].model += *nmodels;
+    *nmodels += models[c];
+  }
+  *atoms =
+      (pdb_atom *)realloc(*atoms, (offset[nchunks] + 1) * sizeof(pdb_atom));
+#pragma omp parallel for schedule(static, 1) if (nchunks > 1)
+  for (c = 0; c < nchunks; c++) {
+    if (count[c] > 0)
+      memcpy(*atoms + offset[c], chunk[c], count[c] * sizeof(pdb_atom));
+    free(chunk[c]);
+  }
+  natoms = offset[nchunks];
+
+  free(bounds);
+  free(chunk);
+  free(count);
+  free(offset);
+  free(models);
+
+  return natoms;
+}
+
+/*
+ * Function: load_structure
+ * ------------------------
+ *
+ * Get a parsed structure, parsing its PDB or mmCIF file on first use only.
+ * Every step reading the same file (box, ligand and protein atoms) shares it.
+ * gzip and zstd compressed files are detected by their magic bytes and
+ * decompressed while being parsed.
+ *
+ * PDB_NAME: path to a target PDB or mmCIF file
+ *
+ * returns: parsed structure
+ *
+ */
+structure *load_structure(char PDB_NAME[500]) {
+  /* Declare variables */
+  int mapped, format;
+  size_t size;
+  char *buffer;
+  structure *s;
+
+  /* Structure already parsed */
+  for (s = structures; s != NULL; s = s->next)
+    if (!strcmp(s->name, PDB_NAME))
+      return s;
+
+  /* Map PDB file */
+  buffer = _map_file(PDB_NAME, &size, &mapped);
+
+  /* PDB file not found */
+  if (buffer == NULL) {
+
+    /* Print error and exit */
+    printf("\033[0;31mError:\033[0m PDB file not found!\n");
+    exit(-1);
+  }
+
+  s = (structure *)calloc(1, sizeof(structure));
+  strncpy(s->name, PDB_NAME, 499);
+
+  /* Parse compressed, mmCIF or PDB file */
+  if ((format = _get_compression(buffer, size)))
+    s->natoms =
+        _parse_compressed(buffer, size, format, &s->atoms, &s->nmodels);
+  else if (_is_cif(buffer, size))
+    s->natoms = _parse_cif(buffer, size, &s->atoms, &s->nmodels);
+  else
+    s->natoms = _parse_pdb(buffer, size, &s->atoms, 0, &s->nmodels);
+
+  /* Release PDB file */
+  _unmap_file(buffer, size, mapped);
+
+  s->next = structures;
+  structures = s;
+
+  return s;
+}
+
+/*
+ * Function: free_structures
+ * -------------------------
+ *
+ * Free parsed structures
+ *
+ */
+void free_structures() {
+  structure *s;
+
+  while (structures != NULL) {
+    s = structures;
+    structures = structures->next;
+    free(s->atoms);
+    free(s);
+  }
+}
+
+/*
+ * Function: soft_read_pdb
+ * -----------------------
+ *
+ * Soft read atomic information of a target PDB file
+ *
+ * PDB_NAME: path to a target PDB file
+ * has_resnumber: whether to save residue number
+ * has_chain: whether to save chain identifier
+ *
+ */
+int soft_read_pdb(char PDB_NAME[500], int has_resnumber, int has_chain) {
+  /* Declare variables */
+  int flag = 1;
+  structure *s;
+  pdb_atom *p;
+
+  /* Empty atom table */
+  _free_atom();
+
+  /* Get parsed PDB */
+  s = load_structure(PDB_NAME);
+
+  /* Save coordinate (x,y,z), residue number and chain */
+  for (p = s->atoms; p < s->atoms + s->natoms; p++)
+    _insert_atom(p->x, p->y, p->z, 0.0, has_resnumber ? p->resnumber : 0, 0,
+                 p->RESIDUE, has_chain ? p->chain : "");
+
+  /* Return flag indicating file has been read */
+  return flag;
+}
+
+/*
+ * Function: _filter_atoms
+ * -----------------------
+ *
+ * Get radius (when not known yet) of a range of parsed atoms and keep those
+ * of a model inside search box
+ *
+ * first: first parsed atom
+ * last: parsed atom after last one
+ * has_radius: whether atom radii are already known
+ * model: model index of kept atoms (ALL_MODELS to keep atoms of any model)
+ * probe: probe size
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * h: grid spacing (step)
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ * kept: array of atoms inside search box (at least last - first atoms)
+ * log_file: path to log file (KVFinder.log)
+ *
+ * returns: number of atoms inside search box
+ *
+ */
+int _filter_atoms(pdb_atom *first, pdb_atom *last, int has_radius, int model,
+                  double probe, int m, int n, int o, double h, double X1,
+                  double Y1, double Z1, atom *kept, FILE **log_file) {
+  int count = 0;
+  double x1, y1, z1, xaux, yaux, zaux;
+  pdb_atom *p;
+
+  /* Loop around parsed atoms */
+  for (p = first; p < last; p++) {
+
+    /* Get radius for atom based on VdW radius dictionary */
+    if (!has_radius)
+      p->radius =
+          _get_vdw_radius(p->RESIDUE, p->ATOM_TYPE, p->ATOM_SYMBOL, log_file);
+
+    /* Skip atoms of other models */
+    if (model != ALL_MODELS && p->model != model)
+      continue;
+
+    /* Calculate coordinate (x1, y1, z1) for atom */
+    x1 = (p->x - X1) / h;
+    y1 = (p->y - Y1) / h;
+    z1 = (p->z - Z1) / h;
+    xaux = x1 * cosb + z1 * sinb;
+    yaux = y1;
+    zaux = -x1 * sinb + z1 * cosb;
+    x1 = xaux;
+    y1 = yaux * cosa - zaux * sina;
+    z1 = yaux * sina + zaux * cosa;
+
+    /* Keep only atoms inside search box */
+    if (x1 > 0.0 - (probe + p->radius) / h &&
+        x1 < (double)m + (probe + p->radius) / h &&
+        y1 > 0.0 - (probe + p->radius) / h &&
+        y1 < (double)n + (probe + p->radius) / h &&
+        z1 > 0.0 - (probe + p->radius) / h &&
+        z1 < (double)o + (probe + p->radius) / h) {
+
+      /* Save coordinates (x,y,z), radius, residue number and chain */
+      _set_atom(&kept[count++], p->x, p->y, p->z, p->radius, p->resnumber,
+                _residue2code(p->RESIDUE), p->RESIDUE, p->chain);
+    }
+  }
+
+  return count;
+}
+
+/*
+ * Function: read_pdb
+ * ------------------
+ *
+ * Read atomic information of a target PDB file (atoms of every model)
+ *
+ * PDB_NAME: path to a target PDB file
+ * probe: probe size
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * h: grid spacing (step)
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ * log_file: path to log file (KVFinder.log)
+ *
+ */
+int read_pdb(char PDB_NAME[500], double probe, int m, int n, int o, double h,
+             double X1, double Y1, double Z1, FILE **log_file) {
+  return read_model(PDB_NAME, ALL_MODELS, probe, m, n, o, h, X1, Y1, Z1,
+                    log_file);
+}
+
+/*
+ * Function: read_model
+ * --------------------
+ *
+ * Read atomic information of a model of a target PDB file. Parsed atoms are
+ * split in ranges, which get their radii and are filtered by model and search
+ * box in parallel. Atom table and log warnings keep file order.
+ *
+ * PDB_NAME: path to a target PDB file
+ * model: model index (ALL_MODELS for atoms of every model)
+ * probe: probe size
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * h: grid spacing (step)
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ * log_file: path to log file (KVFinder.log)
+ *
+ */
+int read_model(char PDB_NAME[500], int model, double probe, int m, int n,
+               int o, double h, double X1, double Y1, double Z1,
+               FILE **log_file) {
+  /* Declare variables */
+  int c, nchunks, flag = 1, *count;
+  size_t *log_size;
+  char **log_text;
+  structure *s;
+  atom **kept;
+  FILE **chunk_log;
+
+  /* Get parsed PDB */
+  s = load_structure(PDB_NAME);
+
+  /* Set number of processes in OpenMP */
+  int ncores = omp_get_num_procs() - 1;
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
+
+  /* Split parsed atoms in ranges */
+  nchunks = s->natoms / 4096 + 1;
+  if (nchunks > omp_get_max_threads())
+    nchunks = omp_get_max_threads();
+  count = (int *)malloc(nchunks * sizeof(int));
+  kept = (atom **)malloc(nchunks * sizeof(atom *));
+  chunk_log = (FILE **)malloc(nchunks * sizeof(FILE *));
+  log_text = (char **)malloc(nchunks * sizeof(char *));
+  log_size = (size_t *)malloc(nchunks * sizeof(size_t));
+
+  /* Get radius and keep atoms inside search box of each range. Warnings are
+   * written to a buffer per range */
+#pragma omp parallel for schedule(static, 1) if (nchunks > 1)
+  for (c = 0; c < nchunks; c++) {
+    pdb_atom *first = s->atoms + (long)s->natoms * c / nchunks,
+             *last = s->atoms + (long)s->natoms * (c + 1) / nchunks;
+
+    kept[c] = (atom *)malloc((last - first + 1) * sizeof(atom));
+    chunk_log[c] = open_memstream(&log_text[c], &log_size[c]);
+    count[c] = _filter_atoms(first, last, s->has_radius, model, probe, m, n,
+                             o, h, X1, Y1, Z1, kept[c], &chunk_log[c]);
+    fclose(chunk_log[c]);
+  }
+  s->has_radius = 1;
+
+  /* Append kept atoms and warnings in file order */
+  for (c = 0; c < nchunks; c++) {
+    if (natoms + count[c] > capacity) {
+      while (natoms + count[c] > capacity)
+        capacity = capacity ? 2 * capacity : 1024;
+      v = (atom *)realloc(v, capacity * sizeof(atom));
+    }
+    memcpy(v + natoms, kept[c], count[c] * sizeof(atom));
+    natoms += count[c];
+    fwrite(log_text[c], 1, log_size[c], *log_file);
+    free(log_text[c]);
+    free(kept[c]);
+  }
+
+  free(count);
+  free(kept);
+  free(chunk_log);
+  free(log_text);
+  free(log_size);
+
+  /* Return flag indicating file has been read */
+  return flag;
+}
+
+/*
+ * Function: _free_atom
+ * --------------------
+ *
+ * Free atom table with PDB atomic information
+ *
+ */
+void _free_atom() {
+  free(v);
+  v = NULL;
+  natoms = 0;
+  capacity = 0;
+}
+
+/* Residues list file processing */
+
+/*
+ * Function: read_residues_list
+ * ----------------------------
+ *
+ * Read a residues list file (resnum_chain elements separated by blanks, as
+ * in residues box file)
+ *
+ * filename: path to residues list file
+ * nresidues: pointer to number of residues read
+ *
+ * returns: array of residues (residue number and chain identifier)
+ *
+ */
+residues_info *read_residues_list(char *filename, int *nresidues) {
+  int resnumber, size = 16;
+  char chain[CHAIN_SIZE];
+  residues_info *list;
+  FILE *list_file;
+
+  list_file = fopen(filename, "r");
+  if (list_file == NULL) {
+    fprintf(stderr,
+            "\033[0;31mError:\033[0m Residues list file does not exist!\n");
+    exit(-1);
+  }
+
+  /* Read file by each element (resnum_chain) */
+  list = (residues_info *)calloc(size, sizeof(residues_info));
+  *nresidues = 0;
+  while (fscanf(list_file, "%d_%8s%*[^ \t\n]", &resnumber, chain) == 2) {
+    if (*nresidues == size) {
+      size *= 2;
+      list = (residues_info *)realloc(list, size * sizeof(residues_info));
+    }
+    memset(&list[*nresidues], 0, sizeof(residues_info));
+    list[*nresidues].resnumber = resnumber;
+    strcpy(list[*nresidues].chain, chain);
+    (*nresidues)++;
+  }
+  fclose(list_file);
+
+  if (*nresidues == 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Residues list file has no "
+                    "resnum_chain element!\n");
+    exit(-1);
+  }
+
+  return list;
+}
+
+/* parKVFinder results file processing */
+
+/*
+ * Function: write_results
+ * -----------------------
+ *
+ * Write parKVFinder TOML-formatted results to file
+ *
+ * output_results: a path to a TOML-formatted results file
+ * pdb_name: path to target PDB file
  * output_pdb: path to cavity PDB file
  * LIGAND_NAME: path to target ligand PDB file
  * h: grid spacing (step)
@@ -1054,7 +2543,8 @@ void write_results(char *output_results, char *pdb_name, char *output_pdb,
   /* Declare variables */
   FILE *results_file;
   char results[1024];
-  int kvnum, iterator;
+  int kvnum, iterator, i;
+  residues_info *r;
 
   /* Open KVFinder.results.toml */
   results_file = fopen(output_results, "w");
@@ -1136,15 +2626,16 @@ void write_results(char *output_results, char *pdb_name, char *output_pdb,
     fprintf(results_file, "\tK%c%c = [", 65 + (((kvnum) / 26) % 26),
             65 + ((kvnum) % 26));
 
-    for (t = KVFinder_results[kvnum].res_info; t != NULL; t = t->next) {
+    for (i = 0; i < KVFinder_results[kvnum].nres; i++) {
+      r = &KVFinder_results[kvnum].res_info[i];
 
-      if (t->next != NULL)
-        fprintf(results_file, "[\"%d\",\"%c\",\"%c\"],", t->resnumber, t->chain,
-                t->resname);
+      if (i < KVFinder_results[kvnum].nres - 1)
+        fprintf(results_file, "[\"%d\",\"%s\",\"%c\"],", r->resnumber, r->chain,
+                r->resname);
 
       else
-        fprintf(results_file, "[\"%d\",\"%c\",\"%c\"]", t->resnumber, t->chain,
-                t->resname);
+        fprintf(results_file, "[\"%d\",\"%s\",\"%c\"]", r->resnumber, r->chain,
+                r->resname);
     }
 
     fprintf(results_file, "]\n");
@@ -1156,3 +2647,343 @@ void write_results(char *output_results, char *pdb_name, char *output_pdb,
   /* Close KVFinder.results.toml */
   fclose(results_file);
 }
+
+/*
+ * Function: _write_json_string
+ * ----------------------------
+ *
+ * Write a JSON string literal, escaping quotes, backslashes and control
+ * characters
+ *
+ * output: output file
+ * text: string
+ *
+ */
+void _write_json_string(FILE *output, const char *text) {
+  fputc('"', output);
+  for (; *text; text++) {
+    if (*text == '"' || *text == '\\')
+      fprintf(output, "\\%c", *text);
+    else if ((unsigned char)*text < 0x20)
+      fprintf(output, "\\u%04x", *text);
+    else
+      fputc(*text, output);
+  }
+  fputc('"', output);
+}
+
+/*
+ * Function: _write_csv_string
+ * ---------------------------
+ *
+ * Write a quoted CSV field, doubling quotes
+ *
+ * output: output file
+ * text: string
+ *
+ */
+void _write_csv_string(FILE *output, const char *text) {
+  fputc('"', output);
+  for (; *text; text++) {
+    if (*text == '"')
+      fputc('"', output);
+    fputc(*text, output);
+  }
+  fputc('"', output);
+}
+
+/*
+ * Function: _write_json_number
+ * ----------------------------
+ *
+ * Write a descriptor as JSON number (null when not finite)
+ *
+ * output: output file
+ * value: descriptor
+ *
+ */
+void _write_json_number(FILE *output, double value) {
+  if (isfinite(value))
+    fprintf(output, "%.2lf", value);
+  else
+    fprintf(output, "null");
+}
+
+/*
+ * Function: write_cavity_record
+ * -----------------------------
+ *
+ * Write descriptors of one cavity as a JSON lines object or a CSV row.
+ * Residues are [number, chain, name] arrays in JSON and a quoted list of
+ * number:chain:name entries, separated by ';', in CSV.
+ *
+ * output: output file
+ * results_format: JSONL_RESULTS or CSV_RESULTS
+ * pdb_name: path to target PDB file
+ * kvnum: cavity index
+ *
+ */
+void write_cavity_record(FILE *output, int results_format, char *pdb_name,
+                         int kvnum) {
+  int i;
+  char name[4], *residues;
+  size_t size = 0;
+  KVresults *p = &KVFinder_results[kvnum];
+  residues_info *r;
+  FILE *list;
+
+  snprintf(name, sizeof(name), "K%c%c", 65 + ((kvnum / 26) % 26),
+           65 + (kvnum % 26));
+
+  if (results_format == JSONL_RESULTS) {
+    fprintf(output, "{\"input\": ");
+    _write_json_string(output, pdb_name);
+    fprintf(output, ", \"cavity\": \"%s\", \"volume\": ", name);
+    _write_json_number(output, p->volume);
+    fprintf(output, ", \"area\": ");
+    _write_json_number(output, p->area);
+    fprintf(output, ", \"max_depth\": ");
+    _write_json_number(output, p->max_depth);
+    fprintf(output, ", \"avg_depth\": ");
+    _write_json_number(output, p->avg_depth);
+    fprintf(output, ", \"avg_hydropathy\": ");
+    _write_json_number(output, p->avg_hydropathy);
+    fprintf(output, ", \"residues\": [");
+    for (i = 0; i < p->nres; i++) {
+      r = &p->res_info[i];
+      fprintf(output, "%s[%d, ", i ? ", " : "", r->resnumber);
+      _write_json_string(output, r->chain);
+      fprintf(output, ", ");
+      _write_json_string(output, r->RESIDUE);
+      fprintf(output, "]");
+    }
+    fprintf(output, "]}\n");
+  } else {
+    _write_csv_string(output, pdb_name);
+    fprintf(output, ",%s,%.2lf,%.2lf,%.2lf,%.2lf,%.2lf,", name, p->volume,
+            p->area, p->max_depth, p->avg_depth, p->avg_hydropathy);
+    list = open_memstream(&residues, &size);
+    for (i = 0; i < p->nres; i++) {
+      r = &p->res_info[i];
+      fprintf(list, "%s%d:%s:%s", i ? ";" : "", r->resnumber, r->chain,
+              r->RESIDUE);
+    }
+    fclose(list);
+    _write_csv_string(output, residues);
+    fputc('\n', output);
+    free(residues);
+  }
+}
+
+/*
+ * Function: write_results_records
+ * -------------------------------
+ *
+ * Write parKVFinder results as one record per cavity, streamed cavity by
+ * cavity, to JSON lines (<output>.KVFinder.results.jsonl) and/or CSV
+ * (<output>.KVFinder.results.csv) files
+ *
+ * output: output path without suffixes
+ * results_format: JSONL_RESULTS and/or CSV_RESULTS flags
+ * pdb_name: path to target PDB file
+ * ncav: number of cavities
+ *
+ */
+void write_results_records(char *output, int results_format, char *pdb_name,
+                           int ncav) {
+  int format, kvnum;
+  char filename[700];
+  FILE *records;
+
+  for (format = JSONL_RESULTS; format <= CSV_RESULTS; format <<= 1) {
+    if (!(results_format & format))
+      continue;
+
+    snprintf(filename, sizeof(filename), "%s.KVFinder.results.%s", output,
+             format == JSONL_RESULTS ? "jsonl" : "csv");
+    records = fopen(filename, "w");
+    if (records == NULL) {
+      fprintf(stderr,
+              "\033[0;31mError:\033[0m Could not write results file: %s\n",
+              filename);
+      exit(-1);
+    }
+
+    if (format == CSV_RESULTS)
+      fprintf(records, "input,cavity,volume,area,max_depth,avg_depth,"
+                       "avg_hydropathy,residues\n");
+    for (kvnum = 0; kvnum < ncav; kvnum++)
+      write_cavity_record(records, format, pdb_name, kvnum);
+
+    if (fclose(records) != 0) {
+      fprintf(stderr,
+              "\033[0;31mError:\033[0m Could not write results file: %s\n",
+              filename);
+      exit(-1);
+    }
+  }
+}
+
+/* parKVFinder results archive processing */
+
+/*
+ * Function: open_archive
+ * ----------------------
+ *
+ * Open a results archive and its index file (<archive>.idx) for appending,
+ * creating them if needed. Every process appending to an archive opens it
+ * once.
+ *
+ * ARCHIVE_NAME: path to results archive
+ * index: index file descriptor
+ *
+ * returns: archive file descriptor
+ *
+ */
+int open_archive(char ARCHIVE_NAME[500], int *index) {
+  int archive;
+
+  archive = open(ARCHIVE_NAME, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  *index = open(_combine(ARCHIVE_NAME, KV_ARCHIVE_INDEX_SUFFIX),
+                O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (archive < 0 || *index < 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Could not open archive: %s\n",
+            ARCHIVE_NAME);
+    exit(-1);
+  }
+
+  return archive;
+}
+
+/*
+ * Function: _append_archive
+ * -------------------------
+ *
+ * Append a record to results archive, exiting on failure
+ *
+ * archive: archive file descriptor
+ * index: index file descriptor
+ * name: record name
+ * nmembers: number of members
+ * names: name of each member
+ * data: data of each member
+ * sizes: size of each member data
+ *
+ */
+void _append_archive(int archive, int index, char *name, int nmembers,
+                     char **names, unsigned char **data,
+                     unsigned long *sizes) {
+  switch (append_kv_archive(archive, index, name, nmembers, names, data,
+                            sizes)) {
+  case -1:
+    fprintf(stderr, "\033[0;31mError:\033[0m Could not append record %s to "
+                    "archive!\n", name);
+    exit(-1);
+  case -2:
+    fprintf(stderr, "\033[0;31mError:\033[0m Could not append record %s to "
+                    "archive, which now ends with an incomplete record!\n",
+            name);
+    exit(-1);
+  }
+}
+
+/*
+ * Function: _compare_names
+ * ------------------------
+ *
+ * Compare two file names (qsort callback)
+ *
+ */
+int _compare_names(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Function: write_archive_record
+ * ------------------------------
+ *
+ * Move output files of a run (or of a model or frame) from a folder into a
+ * record of results archive, with file names as member names (sorted)
+ *
+ * archive: archive file descriptor
+ * index: index file descriptor
+ * name: record name
+ * folder: folder holding only output files of record
+ *
+ */
+void write_archive_record(int archive, int index, char *name, char *folder) {
+  int i, nfiles = 0, capacity = 16, *mapped;
+  char path[1100], **names;
+  unsigned char **data;
+  unsigned long *sizes;
+  size_t size;
+  DIR *directory;
+  struct dirent *entry;
+
+  /* Output files */
+  names = (char **)malloc(capacity * sizeof(char *));
+  directory = opendir(folder);
+  while (directory != NULL && (entry = readdir(directory)) != NULL) {
+    if (entry->d_name[0] == '.')
+      continue;
+    if (nfiles == capacity) {
+      capacity *= 2;
+      names = (char **)realloc(names, capacity * sizeof(char *));
+    }
+    names[nfiles++] = strdup(entry->d_name);
+  }
+  if (directory != NULL)
+    closedir(directory);
+  qsort(names, nfiles, sizeof(char *), _compare_names);
+
+  /* Load and append them */
+  data = (unsigned char **)malloc((nfiles + 1) * sizeof(unsigned char *));
+  sizes = (unsigned long *)malloc((nfiles + 1) * sizeof(unsigned long));
+  mapped = (int *)malloc((nfiles + 1) * sizeof(int));
+  for (i = 0; i < nfiles; i++) {
+    snprintf(path, sizeof(path), "%s/%s", folder, names[i]);
+    data[i] = (unsigned char *)_map_file(path, &size, &mapped[i]);
+    sizes[i] = size;
+    if (data[i] == NULL) {
+      fprintf(stderr, "\033[0;31mError:\033[0m Could not read output file: "
+                      "%s\n", path);
+      exit(-1);
+    }
+  }
+  _append_archive(archive, index, name, nfiles, names, data, sizes);
+
+  /* Remove appended files */
+  for (i = 0; i < nfiles; i++) {
+    _unmap_file((char *)data[i], sizes[i], mapped[i]);
+    snprintf(path, sizeof(path), "%s/%s", folder, names[i]);
+    unlink(path);
+    free(names[i]);
+  }
+  free(names);
+  free(data);
+  free(sizes);
+  free(mapped);
+}
+
+/*
+ * Function: write_archive_log
+ * ---------------------------
+ *
+ * Append log of a run to results archive, as KVFinder.log member of a
+ * record
+ *
+ * archive: archive file descriptor
+ * index: index file descriptor
+ * name: record name
+ * text: log text
+ * size: size of log text
+ *
+ */
+void write_archive_log(int archive, int index, char *name, char *text,
+                       size_t size) {
+  char *names[1] = {"KVFinder.log"};
+  unsigned char *data[1] = {(unsigned char *)text};
+  unsigned long sizes[1] = {size};
+
+  _append_archive(archive, index, name, 1, names, data, sizes);
+}
@@ -23,24 +23,90 @@ void write_parameters(char *toml_name, char OUTPUT[500], char BASE_NAME[500],
                       double bZ3, double bX4, double bY4, double bZ4);
 
 /* van der Waals file processing */
-double _get_vdw_radius(char RESIDUE[4], char ATOM_TYPE[4], vdw *DIC[500],
-                       int tablesize, char TABLE[500][4], char ATOM_SYMBOL[2],
+unsigned long long _vdw_key(const char *RESIDUE, const char *ATOM_TYPE);
+int _vdw_slot(unsigned long long key);
+void _insert_vdw(unsigned long long key, double radius);
+int _lookup_vdw(unsigned long long key, double *radius);
+double _get_vdw_radius(char RESIDUE[], char ATOM_TYPE[6], char ATOM_SYMBOL[3],
                        FILE **log_file);
-int _get_residues_information(char dictionary_name[500], char TABLE[500][4]);
-int read_vdw(char dictionary_name[500], vdw *DIC[500], int tablesize);
+void _load_vdw_entries(const vdw_entry *entries, int nentries);
+int _read_vdw_binary(char dictionary_name[500]);
+void free_vdw();
+int read_vdw(char dictionary_name[500]);
+void write_vdw_binary(char *output_name);
+double max_vdw_radius();
+
+/* Built-in van der Waals radii dictionary (generated at build time) */
+extern const vdw_entry builtin_dictionary[];
+extern const int builtin_dictionary_size;
 
 /* Protein DataBank (PDB) file processing */
-void _insert_atom(atom **head, atom *new);
-atom *_create_atom(double x, double y, double z, double radius, int resnumber,
-                   char resname, char chain);
+char *_map_file(char *name, size_t *size, int *mapped);
+void _unmap_file(char *buffer, size_t size, int mapped);
+char *_next_line(char **cursor, char *end, int *length);
+char _column(char *line, int length, int i);
+int _parse_int(char *line, int length, int start, int end);
+double _parse_fixed(char *line, int length, int start, int end);
+void _copy_field(char *line, int length, int start, int end, char TO[]);
+int _is_atom_record(char *line, int length);
+char **_split_lines(char *buffer, size_t size, int nchunks);
+int _parse_chunk(char *start, char *end, pdb_atom **atoms, int *nmodels);
+
+/* mmCIF file processing */
+char *_next_token(char **cursor, char *end, int *length, int *quoted);
+int _is_keyword(char *token, int length, char *keyword);
+int _is_cif(char *buffer, size_t size);
+void _copy_token(char *token, int length, char TO[], int size);
+int _parse_cif(char *buffer, size_t size, pdb_atom **atoms, int *nmodels);
+
+/* Compressed file processing (stream helpers are private to
+ * fileprocessing.c) */
+int _get_compression(char *buffer, size_t size);
+int _parse_compressed(char *buffer, size_t size, int format, pdb_atom **atoms,
+                      int *nmodels);
+
+/* Parsed structures */
+int _parse_pdb(char *buffer, size_t size, pdb_atom **atoms, int natoms,
+               int *nmodels);
+structure *load_structure(char PDB_NAME[500]);
+void free_structures();
+void _set_atom(atom *new, double x, double y, double z, double radius,
+               int resnumber, char resname, char *RESIDUE, char *chain);
+void _insert_atom(double x, double y, double z, double radius, int resnumber,
+                  char resname, char *RESIDUE, char *chain);
 int soft_read_pdb(char PDB_NAME[500], int has_resnum, int has_chain);
-int read_pdb(char PDB_NAME[500], vdw *DIC[500], int tablesize,
-             char TABLE[500][4], double probe, int m, int n, int o, double h,
+int _filter_atoms(pdb_atom *first, pdb_atom *last, int has_radius, int model,
+                  double probe, int m, int n, int o, double h, double X1,
+                  double Y1, double Z1, atom *kept, FILE **log_file);
+int read_pdb(char PDB_NAME[500], double probe, int m, int n, int o, double h,
              double X1, double Y1, double Z1, FILE **log_file);
+int read_model(char PDB_NAME[500], int model, double probe, int m, int n,
+               int o, double h, double X1, double Y1, double Z1,
+               FILE **log_file);
 void _free_atom();
 
+/* Residues list file processing */
+residues_info *read_residues_list(char *filename, int *nresidues);
+
 /* parKVFinder results file processing */
 void write_results(char *output_results, char *pdb_name, char *output_pdb,
                    char LIGAND_NAME[500], double h, int ncav);
+void _write_json_string(FILE *output, const char *text);
+void _write_csv_string(FILE *output, const char *text);
+void _write_json_number(FILE *output, double value);
+void write_cavity_record(FILE *output, int results_format, char *pdb_name,
+                         int kvnum);
+void write_results_records(char *output, int results_format, char *pdb_name,
+                           int ncav);
+
+/* parKVFinder results archive processing */
+int open_archive(char ARCHIVE_NAME[500], int *index);
+void _append_archive(int archive, int index, char *name, int nmembers,
+                     char **names, unsigned char **data,
+                     unsigned long *sizes);
+int _compare_names(const void *a, const void *b);
+void write_archive_record(int archive, int index, char *name, char *folder);
+void write_archive_log(int archive, int index, char *name, char *text,
+                       size_t size);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,1373 @@
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "utils.h"
+#include "cavityrle.h"
+#include "gridoutput.h"
+#include "gridprocessing.h"
+
+/* Size of CCP4 map header */
+#define CCP4_HEADER_SIZE 1024
+
+/* Values written per line of OpenDX arrays */
+#define DX_VALUES_PER_LINE 3
+
+/* Alignment of .npy array data */
+#define NPY_ALIGNMENT 64
+
+/* Room for .npy header */
+#define NPY_HEADER_SIZE 1024
+
+/* Sizes of zip records, central directory of .npz grid files and largest
+ * member without zip64 extensions */
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_END_SIZE 22
+#define ZIP_DIRECTORY_SIZE 1024
+#define ZIP_MAX_SIZE 0xffffffffUL
+
+/* Edge of cubes of grid cells merged into one mesh vertex */
+#define MESH_CLUSTER 2
+
+/* Grid names, used in output file names */
+static const char *grid_names[] = {"labels", "depth", "hydropathy"};
+
+/* Volumetric grid output */
+
+/*
+ * Function: _cavity_region
+ * ------------------------
+ *
+ * Get grid region enclosing every cavity, from cavity boundaries found by
+ * filter_boundary
+ *
+ * ncav: number of cavities
+ * region: first (imin, jmin, kmin) and last (imax, jmax, kmax) grid indexes
+ *
+ */
+void _cavity_region(int ncav, int region[6]) {
+  int tag;
+
+  region[0] = (int)cavity[0].Xmin;
+  region[1] = (int)cavity[0].Ymin;
+  region[2] = (int)cavity[0].Zmin;
+  region[3] = (int)cavity[0].Xmax;
+  region[4] = (int)cavity[0].Ymax;
+  region[5] = (int)cavity[0].Zmax;
+  for (tag = 1; tag < ncav; tag++) {
+    region[0] = min(region[0], (int)cavity[tag].Xmin);
+    region[1] = min(region[1], (int)cavity[tag].Ymin);
+    region[2] = min(region[2], (int)cavity[tag].Zmin);
+    region[3] = max(region[3], (int)cavity[tag].Xmax);
+    region[4] = max(region[4], (int)cavity[tag].Ymax);
+    region[5] = max(region[5], (int)cavity[tag].Zmax);
+  }
+}
+
+/*
+ * Function: _grid_value
+ * ---------------------
+ *
+ * Get value of a grid point in a volumetric grid: cavity number (1 for KAA)
+ * in labels grid, depth or hydropathy of cavity points otherwise. Points
+ * outside cavities are 0.
+ *
+ * A: cavities 3D grid
+ * M: depth 3D grid
+ * HP: hydropathy 3D grid
+ * grid: LABELS_GRID, DEPTH_GRID or HYDROPATHY_GRID
+ * i: x grid coordinate
+ * j: y grid coordinate
+ * k: z grid coordinate
+ *
+ * returns: grid value
+ *
+ */
+float _grid_value(int ***A, double ***M, double ***HP, int grid, int i, int j,
+                  int k) {
+  if (A[i][j][k] < 2)
+    return 0.0;
+
+  switch (grid) {
+  case LABELS_GRID:
+    return (float)(A[i][j][k] - 1);
+  case DEPTH_GRID:
+    return (float)M[i][j][k];
+  default:
+    return (float)HP[i][j][k];
+  }
+}
+
+/*
+ * Function: _grid_axes
+ * --------------------
+ *
+ * Get real space direction of grid axes, from rotation of grid (sina, cosa,
+ * sinb, cosb)
+ *
+ * axes: unit vectors of x, y and z grid axes, one per row
+ *
+ */
+void _grid_axes(double axes[3][3]) {
+  axes[0][0] = cosb;
+  axes[0][1] = 0.0;
+  axes[0][2] = sinb;
+  axes[1][0] = sina * sinb;
+  axes[1][1] = cosa;
+  axes[1][2] = -sina * cosb;
+  axes[2][0] = -cosa * sinb;
+  axes[2][1] = sina;
+  axes[2][2] = cosa * cosb;
+}
+
+/*
+ * Function: _grid_origin
+ * ----------------------
+ *
+ * Get real coordinates of first point of a grid region
+ *
+ * h: Grid spacing (A)
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ * region: first and last grid indexes of region
+ * origin: real coordinates (x, y, z)
+ *
+ */
+void _grid_origin(double h, double X1, double Y1, double Z1, int region[6],
+                  double origin[3]) {
+  int i, j;
+  double axes[3][3];
+
+  _grid_axes(axes);
+  origin[0] = X1;
+  origin[1] = Y1;
+  origin[2] = Z1;
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      origin[j] += region[i] * h * axes[i][j];
+}
+
+/*
+ * Function: _write_ccp4
+ * ---------------------
+ *
+ * Write a volumetric grid, cropped to region, as CCP4 map of 32-bit floats.
+ * Map frame is grid frame, with grid spacing as voxel size. Rotation and
+ * translation from map frame to atom frame are stored as CCP4 skew matrix
+ * and translation.
+ *
+ * filename: CCP4 map filename
+ * A: cavities 3D grid
+ * M: depth 3D grid
+ * HP: hydropathy 3D grid
+ * grid: LABELS_GRID, DEPTH_GRID or HYDROPATHY_GRID
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * h: Grid spacing (A)
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ * region: first and last grid indexes of cropped region
+ *
+ */
+void _write_ccp4(char *filename, int ***A, double ***M, double ***HP,
+                 int grid, int m, int n, int o, double h, double X1,
+                 double Y1, double Z1, int region[6]) {
+  int i, j, k, nx, ny, nz, *words;
+  long c, size;
+  float *data, *fields;
+  double sum, squares, axes[3][3];
+  unsigned char *header;
+  unsigned int order = 1;
+  FILE *output;
+
+  // Set number of threads in OpenMP
+  int ncores = omp_get_num_procs() - 1;
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
+
+  nx = region[3] - region[0] + 1;
+  ny = region[4] - region[1] + 1;
+  nz = region[5] - region[2] + 1;
+  size = (long)nx * ny * nz;
+
+  /* Map data: columns along x, rows along y, sections along z */
+  data = (float *)malloc(size * sizeof(float));
+#pragma omp parallel for default(shared) private(i, j, k, c) schedule(static)
+  for (k = 0; k < nz; k++)
+    for (j = 0; j < ny; j++)
+      for (i = 0; i < nx; i++) {
+        c = ((long)k * ny + j) * nx + i;
+        data[c] = _grid_value(A, M, HP, grid, region[0] + i, region[1] + j,
+                              region[2] + k);
+      }
+
+  /* Header */
+  header = (unsigned char *)calloc(CCP4_HEADER_SIZE, 1);
+  words = (int *)header;
+  fields = (float *)header;
+  words[0] = nx;
+  words[1] = ny;
+  words[2] = nz;
+  words[3] = 2; /* 32-bit floats */
+  words[4] = region[0];
+  words[5] = region[1];
+  words[6] = region[2];
+  words[7] = m;
+  words[8] = n;
+  words[9] = o;
+  fields[10] = m * h;
+  fields[11] = n * h;
+  fields[12] = o * h;
+  fields[13] = fields[14] = fields[15] = 90.0;
+  words[16] = 1;
+  words[17] = 2;
+  words[18] = 3;
+  fields[19] = fields[20] = data[0];
+  for (c = 0, sum = 0.0, squares = 0.0; c < size; c++) {
+    fields[19] = data[c] < fields[19] ? data[c] : fields[19];
+    fields[20] = data[c] > fields[20] ? data[c] : fields[20];
+    sum += data[c];
+    squares += (double)data[c] * data[c];
+  }
+  fields[21] = sum / size;
+  words[22] = 1; /* P1 */
+  words[24] = 1; /* Skew transformation */
+  /* Map frame = S (atom frame - t), S rows are grid axes */
+  _grid_axes(axes);
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      fields[25 + 3 * i + j] = axes[i][j];
+  fields[34] = X1;
+  fields[35] = Y1;
+  fields[36] = Z1;
+  memcpy(header + 52 * 4, "MAP ", 4);
+  if (*(unsigned char *)&order) {
+    header[53 * 4] = 0x44;
+    header[53 * 4 + 1] = 0x41;
+  } else {
+    header[53 * 4] = 0x11;
+    header[53 * 4 + 1] = 0x11;
+  }
+  fields[54] = sqrt(squares / size - (sum / size) * (sum / size));
+  words[55] = 1;
+  snprintf((char *)header + 56 * 4, 80, "parKVFinder cavity %s grid",
+           grid_names[grid]);
+
+  /* Write map */
+  output = fopen(filename, "wb");
+  if (output == NULL ||
+      fwrite(header, 1, CCP4_HEADER_SIZE, output) != CCP4_HEADER_SIZE ||
+      fwrite(data, sizeof(float), size, output) != (size_t)size ||
+      fclose(output) != 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Could not write grid file: %s\n",
+            filename);
+    exit(-1);
+  }
+
+  free(header);
+  free(data);
+}
+
+/*
+ * Function: _write_dx
+ * -------------------
+ *
+ * Write a volumetric grid, cropped to region, as OpenDX field. Rotation of
+ * grid is carried by delta vectors of grid positions.
+ *
+ * filename: OpenDX filename
+ * A: cavities 3D grid
+ * M: depth 3D grid
+ * HP: hydropathy 3D grid
+ * grid: LABELS_GRID, DEPTH_GRID or HYDROPATHY_GRID
+ * h: Grid spacing (A)
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ * region: first and last grid indexes of cropped region
+ *
+ */
+void _write_dx(char *filename, int ***A, double ***M, double ***HP, int grid,
+               double h, double X1, double Y1, double Z1, int region[6]) {
+  int i, j, k, nx, ny, nz, count = 0;
+  double axes[3][3], origin[3];
+  FILE *output;
+
+  nx = region[3] - region[0] + 1;
+  ny = region[4] - region[1] + 1;
+  nz = region[5] - region[2] + 1;
+
+  _grid_axes(axes);
+  _grid_origin(h, X1, Y1, Z1, region, origin);
+
+  output = fopen(filename, "w");
+  if (output == NULL) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Could not write grid file: %s\n",
+            filename);
+    exit(-1);
+  }
+
+  fprintf(output, "# parKVFinder cavity %s grid\n", grid_names[grid]);
+  fprintf(output, "object 1 class gridpositions counts %d %d %d\n", nx, ny,
+          nz);
+  fprintf(output, "origin %.6lf %.6lf %.6lf\n", origin[0], origin[1],
+          origin[2]);
+  for (i = 0; i < 3; i++)
+    fprintf(output, "delta %.6lf %.6lf %.6lf\n", h * axes[i][0],
+            h * axes[i][1], h * axes[i][2]);
+  fprintf(output, "object 2 class gridconnections counts %d %d %d\n", nx, ny,
+          nz);
+  fprintf(output,
+          "object 3 class array type float rank 0 items %ld data follows\n",
+          (long)nx * ny * nz);
+
+  /* Data: z index varies fastest */
+  for (i = region[0]; i <= region[3]; i++)
+    for (j = region[1]; j <= region[4]; j++)
+      for (k = region[2]; k <= region[5]; k++)
+        fprintf(output, "%g%c", _grid_value(A, M, HP, grid, i, j, k),
+                ++count % DX_VALUES_PER_LINE ? ' ' : '\n');
+  if (count % DX_VALUES_PER_LINE)
+    fprintf(output, "\n");
+
+  fprintf(output, "attribute \"dep\" string \"positions\"\n");
+  fprintf(output, "object \"%s\" class field\n", grid_names[grid]);
+  fprintf(output, "component \"positions\" value 1\n");
+  fprintf(output, "component \"connections\" value 2\n");
+  fprintf(output, "component \"data\" value 3\n");
+
+  if (fclose(output) != 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Could not write grid file: %s\n",
+            filename);
+    exit(-1);
+  }
+}
+
+/*
+ * Function: _put_le
+ * -----------------
+ *
+ * Store an unsigned integer in little-endian byte order
+ *
+ * bytes: destination
+ * value: integer value
+ * size: number of bytes
+ *
+ */
+void _put_le(unsigned char *bytes, unsigned long value, int size) {
+  int i;
+
+  for (i = 0; i < size; i++)
+    bytes[i] = (value >> (8 * i)) & 0xff;
+}
+
+/*
+ * Function: _npy_header
+ * ---------------------
+ *
+ * Build a .npy (version 1.0) header of a C-ordered array, padded so array
+ * data starts at a multiple of NPY_ALIGNMENT bytes
+ *
+ * header: destination (NPY_HEADER_SIZE bytes)
+ * type: 'i' (signed integer) or 'f' (floating point)
+ * size: bytes per element
+ * ndims: number of dimensions (0 to 3)
+ * shape: size of each dimension
+ *
+ * returns: header length
+ *
+ */
+int _npy_header(unsigned char *header, char type, int size, int ndims,
+                long shape[3]) {
+  int i, length;
+  char *text = (char *)header + 10, dims[100];
+  unsigned int order = 1;
+
+  /* Shape tuple */
+  if (ndims == 1)
+    snprintf(dims, sizeof(dims), "(%ld,)", shape[0]);
+  else
+    for (i = 0, length = snprintf(dims, sizeof(dims), "("); i < ndims; i++)
+      length += snprintf(dims + length, sizeof(dims) - length, "%s%ld",
+                         i ? ", " : "", shape[i]);
+  if (ndims != 1)
+    strcat(dims, ")");
+
+  length = snprintf(
+      text, NPY_HEADER_SIZE - 11,
+      "{'descr': '%c%c%d', 'fortran_order': False, 'shape': %s, }",
+      *(unsigned char *)&order ? '<' : '>', type, size, dims);
+
+  /* Pad with spaces up to alignment, then newline */
+  while ((10 + length + 1) % NPY_ALIGNMENT)
+    text[length++] = ' ';
+  text[length++] = '\n';
+
+  memcpy(header, "\x93NUMPY\x01\x00", 8);
+  _put_le(header + 8, length, 2);
+
+  return 10 + length;
+}
+
+/*
+ * Function: _grid_array
+ * ---------------------
+ *
+ * Get a volumetric grid, cropped to region, as C-ordered array: 32-bit
+ * integers for labels grid, 32-bit floats otherwise
+ *
+ * A: cavities 3D grid
+ * M: depth 3D grid
+ * HP: hydropathy 3D grid
+ * grid: LABELS_GRID, DEPTH_GRID or HYDROPATHY_GRID
+ * region: first and last grid indexes of cropped region
+ * shape: size of array along x, y and z
+ *
+ * returns: array (4 bytes per element)
+ *
+ */
+void *_grid_array(int ***A, double ***M, double ***HP, int grid,
+                  int region[6], long shape[3]) {
+  int i, j, k;
+  long c;
+  void *data;
+
+  // Set number of threads in OpenMP
+  int ncores = omp_get_num_procs() - 1;
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
+
+  shape[0] = region[3] - region[0] + 1;
+  shape[1] = region[4] - region[1] + 1;
+  shape[2] = region[5] - region[2] + 1;
+  data = malloc(shape[0] * shape[1] * shape[2] * 4);
+
+#pragma omp parallel for default(shared) private(i, j, k, c) schedule(static)
+  for (i = 0; i < shape[0]; i++)
+    for (j = 0; j < shape[1]; j++)
+      for (k = 0; k < shape[2]; k++) {
+        c = (i * shape[1] + j) * shape[2] + k;
+        if (grid == LABELS_GRID)
+          ((int *)data)[c] = (int)_grid_value(A, M, HP, grid, region[0] + i,
+                                              region[1] + j, region[2] + k);
+        else
+          ((float *)data)[c] = _grid_value(A, M, HP, grid, region[0] + i,
+                                           region[1] + j, region[2] + k);
+      }
+
+  return data;
+}
+
+/*
+ * Function: _write_npy_file
+ * -------------------------
+ *
+ * Write a C-ordered array as .npy file
+ *
+ * filename: .npy filename
+ * type: 'i' (signed integer) or 'f' (floating point)
+ * size: bytes per element
+ * ndims: number of dimensions (0 to 3)
+ * shape: size of each dimension
+ * data: array data
+ *
+ */
+void _write_npy_file(char *filename, char type, int size, int ndims,
+                     long shape[3], void *data) {
+  int i, length;
+  long count;
+  unsigned char header[NPY_HEADER_SIZE];
+  FILE *output;
+
+  for (i = 0, count = 1; i < ndims; i++)
+    count *= shape[i];
+  length = _npy_header(header, type, size, ndims, shape);
+
+  output = fopen(filename, "wb");
+  if (output == NULL ||
+      fwrite(header, 1, length, output) != (size_t)length ||
+      fwrite(data, size, count, output) != (size_t)count ||
+      fclose(output) != 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Could not write grid file: %s\n",
+            filename);
+    exit(-1);
+  }
+}
+
+/*
+ * Function: _write_npy
+ * --------------------
+ *
+ * Write a volumetric grid, cropped to region, as .npy file, loadable with
+ * numpy.load(mmap_mode='r')
+ *
+ * filename: .npy filename
+ * A: cavities 3D grid
+ * M: depth 3D grid
+ * HP: hydropathy 3D grid
+ * grid: LABELS_GRID, DEPTH_GRID or HYDROPATHY_GRID
+ * region: first and last grid indexes of cropped region
+ *
+ */
+void _write_npy(char *filename, int ***A, double ***M, double ***HP, int grid,
+                int region[6]) {
+  long shape[3];
+  void *data;
+
+  data = _grid_array(A, M, HP, grid, region, shape);
+  _write_npy_file(filename, grid == LABELS_GRID ? 'i' : 'f', 4, 3, shape,
+                  data);
+  free(data);
+}
+
+/*
+ * Function: _write_npy_placement
+ * ------------------------------
+ *
+ * Write placement of grids cropped to region as .npy files next to them
+ * (<output>.KVFinder.origin.npy, .step.npy and .rotation.npy): point
+ * (i, j, k) of a grid is at origin + step * (i * rotation[0] + j *
+ * rotation[1] + k * rotation[2])
+ *
+ * output: output path without suffixes
+ * h: Grid spacing (A)
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ * region: first and last grid indexes of cropped region
+ *
+ */
+void _write_npy_placement(char *output, double h, double X1, double Y1,
+                          double Z1, int region[6]) {
+  long shape[3] = {3, 3, 0};
+  char filename[700];
+  double axes[3][3], origin[3];
+
+  _grid_axes(axes);
+  _grid_origin(h, X1, Y1, Z1, region, origin);
+
+  snprintf(filename, sizeof(filename), "%s.KVFinder.origin.npy", output);
+  _write_npy_file(filename, 'f', 8, 1, shape, origin);
+  snprintf(filename, sizeof(filename), "%s.KVFinder.step.npy", output);
+  _write_npy_file(filename, 'f', 8, 0, shape, &h);
+  snprintf(filename, sizeof(filename), "%s.KVFinder.rotation.npy", output);
+  _write_npy_file(filename, 'f', 8, 2, shape, axes);
+}
+
+/*
+ * Function: _zip_entry
+ * --------------------
+ *
+ * Write a stored (uncompressed) member of a zip file: local header, then
+ * .npy header and array data. Its central directory record is appended to
+ * directory.
+ *
+ * output: zip file
+ * name: member name
+ * header: .npy header
+ * header_size: .npy header length
+ * data: array data
+ * size: array data length
+ * offset: offset of member in zip file, advanced past member
+ * directory: central directory
+ * directory_size: central directory length, advanced past record
+ *
+ * returns: 1 on success, 0 on write error or member too large
+ *
+ */
+int _zip_entry(FILE *output, const char *name, unsigned char *header,
+               int header_size, void *data, size_t size, unsigned long *offset,
+               unsigned char *directory, int *directory_size) {
+  int length = strlen(name);
+  unsigned long crc, total = header_size + size;
+  unsigned char local[ZIP_LOCAL_SIZE];
+  unsigned char *central = directory + *directory_size;
+
+  if (total > ZIP_MAX_SIZE || *offset > ZIP_MAX_SIZE)
+    return 0;
+
+  crc = crc32(0L, header, header_size);
+  crc = crc32(crc, data, size);
+
+  /* Local file header */
+  memset(local, 0, ZIP_LOCAL_SIZE);
+  _put_le(local, 0x04034b50, 4);
+  _put_le(local + 4, 20, 2);    /* Version needed */
+  _put_le(local + 12, 0x21, 2); /* 1980-01-01 */
+  _put_le(local + 14, crc, 4);
+  _put_le(local + 18, total, 4);
+  _put_le(local + 22, total, 4);
+  _put_le(local + 26, length, 2);
+
+  /* Central directory record */
+  memset(central, 0, ZIP_CENTRAL_SIZE);
+  _put_le(central, 0x02014b50, 4);
+  _put_le(central + 4, 20, 2); /* Version made by */
+  memcpy(central + 6, local + 4, 26);
+  _put_le(central + 42, *offset, 4);
+  memcpy(central + ZIP_CENTRAL_SIZE, name, length);
+  *directory_size += ZIP_CENTRAL_SIZE + length;
+
+  if (fwrite(local, 1, ZIP_LOCAL_SIZE, output) != ZIP_LOCAL_SIZE ||
+      fwrite(name, 1, length, output) != (size_t)length ||
+      fwrite(header, 1, header_size, output) != (size_t)header_size ||
+      fwrite(data, 1, size, output) != size)
+    return 0;
+  *offset += ZIP_LOCAL_SIZE + length + total;
+
+  return 1;
+}
+
+/*
+ * Function: _write_npz
+ * --------------------
+ *
+ * Write labels, depth and hydropathy grids, cropped to region, in one
+ * uncompressed .npz file, with origin, step and rotation arrays describing
+ * grid placement (see _write_npy_placement)
+ *
+ * filename: .npz filename
+ * A: cavities 3D grid
+ * M: depth 3D grid
+ * HP: hydropathy 3D grid
+ * h: Grid spacing (A)
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ * region: first and last grid indexes of cropped region
+ *
+ */
+void _write_npz(char *filename, int ***A, double ***M, double ***HP,
+                double h, double X1, double Y1, double Z1, int region[6]) {
+  int grid, size, ok = 1, directory_size = 0, entries = 0;
+  long shape[3];
+  unsigned long offset = 0;
+  unsigned char header[NPY_HEADER_SIZE], end[ZIP_END_SIZE];
+  unsigned char directory[ZIP_DIRECTORY_SIZE];
+  char name[100];
+  double axes[3][3], origin[3];
+  void *data;
+  FILE *output;
+
+  output = fopen(filename, "wb");
+  if (output == NULL) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Could not write grid file: %s\n",
+            filename);
+    exit(-1);
+  }
+
+  /* Grids */
+  for (grid = LABELS_GRID; ok && grid <= HYDROPATHY_GRID; grid++) {
+    data = _grid_array(A, M, HP, grid, region, shape);
+    size = _npy_header(header, grid == LABELS_GRID ? 'i' : 'f', 4, 3, shape);
+    snprintf(name, sizeof(name), "%s.npy", grid_names[grid]);
+    ok = _zip_entry(output, name, header, size, data,
+                    shape[0] * shape[1] * shape[2] * 4, &offset, directory,
+                    &directory_size);
+    entries++;
+    free(data);
+  }
+
+  /* Grid placement */
+  _grid_axes(axes);
+  _grid_origin(h, X1, Y1, Z1, region, origin);
+  shape[0] = shape[1] = 3;
+  size = _npy_header(header, 'f', 8, 1, shape);
+  ok = ok && _zip_entry(output, "origin.npy", header, size, origin,
+                        sizeof(origin), &offset, directory, &directory_size);
+  size = _npy_header(header, 'f', 8, 0, shape);
+  ok = ok && _zip_entry(output, "step.npy", header, size, &h, sizeof(h),
+                        &offset, directory, &directory_size);
+  size = _npy_header(header, 'f', 8, 2, shape);
+  ok = ok && _zip_entry(output, "rotation.npy", header, size, axes,
+                        sizeof(axes), &offset, directory, &directory_size);
+  entries += 3;
+
+  /* End of central directory */
+  memset(end, 0, ZIP_END_SIZE);
+  _put_le(end, 0x06054b50, 4);
+  _put_le(end + 8, entries, 2);
+  _put_le(end + 10, entries, 2);
+  _put_le(end + 12, directory_size, 4);
+  _put_le(end + 16, offset, 4);
+
+  if (!ok ||
+      fwrite(directory, 1, directory_size, output) !=
+          (size_t)directory_size ||
+      fwrite(end, 1, ZIP_END_SIZE, output) != ZIP_END_SIZE ||
+      fclose(output) != 0) {
+    fprintf(stderr,
+            "\033[0;31mError:\033[0m Could not write grid file: %s (npz "
+            "members are limited to 4 GB, use npy)\n",
+            filename);
+    exit(-1);
+  }
+}
+
+/*
+ * Function: _quantize
+ * -------------------
+ *
+ * Store a value quantized on range as little-endian integer
+ *
+ * bytes: destination
+ * value: value
+ * bits: bits of quantized value (8 or 16)
+ * range: minimum and maximum value
+ *
+ */
+void _quantize(unsigned char *bytes, double value, int bits, float range[2]) {
+  unsigned long levels = (1UL << bits) - 1, q = 0;
+
+  if (range[1] > range[0])
+    q = lround((value - range[0]) / (range[1] - range[0]) * levels);
+  _put_le(bytes, q > levels ? levels : q, bits / 8);
+}
+
+/*
+ * Function: _write_cavity_rle
+ * ---------------------------
+ *
+ * Write cavity points as run-length encoded cavity file (see cavityrle.h),
+ * with depth and hydropathy quantized to bits
+ *
+ * filename: cavity filename
+ * A: cavities 3D grid
+ * S: surface points 3D grid
+ * M: depth 3D grid
+ * HP: hydropathy 3D grid
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * h: Grid spacing (A)
+ * ncav: number of cavities
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ * bits: bits of quantized values (8 or 16)
+ *
+ */
+void _write_cavity_rle(char *filename, int ***A, int ***S, double ***M,
+                       double ***HP, int m, int n, int o, double h, int ncav,
+                       double X1, double Y1, double Z1, int bits) {
+  int i, j, k, tag, a, ok;
+  long c, *voxels, *start, *nrows, *nruns;
+  unsigned long offset, size, nvoxels, row, run, voxel, word;
+  unsigned int row_runs = 0, run_length = 0, word32;
+  unsigned char header[CAVITY_RLE_HEADER_SIZE], *table, *block;
+  unsigned char *rows, *runs, *surface, *depth, *hydropathy;
+  unsigned char *last_row = NULL, *last_run = NULL;
+  float ranges[4];
+  double axes[3][3], value, origin[3] = {X1, Y1, Z1};
+  FILE *output;
+
+  // Set number of threads in OpenMP
+  int ncores = omp_get_num_procs() - 1;
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
+
+  if (m > CAVITY_RLE_MAX_UNITS || n > CAVITY_RLE_MAX_UNITS ||
+      o > CAVITY_RLE_MAX_UNITS) {
+    fprintf(stderr,
+            "\033[0;31mError:\033[0m Grid is too large for run-length "
+            "encoded cavity file (at most %d units per axis)!\n",
+            CAVITY_RLE_MAX_UNITS);
+    exit(-1);
+  }
+
+  /* Cavity points grouped by cavity, in grid order */
+  voxels = _cavity_voxels(A, m, n, o, ncav, &start);
+
+  /* Rows and runs of each cavity: a row starts when i or j changes, a run
+   * when k is not next to previous point */
+  nrows = (long *)calloc(ncav, sizeof(long));
+  nruns = (long *)calloc(ncav, sizeof(long));
+#pragma omp parallel for default(shared) private(tag, c) schedule(dynamic)
+  for (tag = 0; tag < ncav; tag++)
+    for (c = start[tag]; c < start[tag + 1]; c++) {
+      if (c == start[tag] || voxels[c] / o != voxels[c - 1] / o)
+        nrows[tag]++;
+      if (c == start[tag] || voxels[c] != voxels[c - 1] + 1 ||
+          voxels[c] / o != voxels[c - 1] / o)
+        nruns[tag]++;
+    }
+
+  /* Quantization ranges of depth and hydropathy */
+  ranges[0] = ranges[2] = INFINITY;
+  ranges[1] = ranges[3] = -INFINITY;
+  for (c = 0; c < start[ncav]; c++) {
+    i = voxels[c] / ((long)n * o);
+    j = (voxels[c] / o) % n;
+    k = voxels[c] % o;
+    ranges[0] = fminf(ranges[0], M[i][j][k]);
+    ranges[1] = fmaxf(ranges[1], M[i][j][k]);
+    ranges[2] = fminf(ranges[2], HP[i][j][k]);
+    ranges[3] = fmaxf(ranges[3], HP[i][j][k]);
+  }
+  if (start[ncav] == 0)
+    ranges[0] = ranges[1] = ranges[2] = ranges[3] = 0.0;
+
+  /* Header */
+  memset(header, 0, CAVITY_RLE_HEADER_SIZE);
+  memcpy(header, CAVITY_RLE_MAGIC, 8);
+  _put_le(header + 8, bits, 2);
+  _put_le(header + 12, ncav, 4);
+  _put_le(header + 16, m, 4);
+  _put_le(header + 20, n, 4);
+  _put_le(header + 24, o, 4);
+  _grid_axes(axes);
+  for (a = 0; a < 16; a++) {
+    value = a < 3 ? origin[a] : a == 3 ? h : axes[(a - 4) / 3][(a - 4) % 3];
+    memcpy(&word, &value, sizeof(value));
+    _put_le(header + 32 + 8 * a, word, 8);
+  }
+  for (a = 0; a < 4; a++) {
+    memcpy(&word32, &ranges[a], sizeof(float));
+    _put_le(header + 136 + 4 * a, word32, 4);
+  }
+
+  output = fopen(filename, "wb");
+  ok = output != NULL &&
+       fwrite(header, 1, CAVITY_RLE_HEADER_SIZE, output) ==
+           CAVITY_RLE_HEADER_SIZE;
+
+  /* Cavity table */
+  table = (unsigned char *)calloc(ncav + 1, CAVITY_RLE_ENTRY_SIZE);
+  offset = CAVITY_RLE_HEADER_SIZE + (unsigned long)ncav * CAVITY_RLE_ENTRY_SIZE;
+  for (tag = 0; tag < ncav; tag++) {
+    nvoxels = start[tag + 1] - start[tag];
+    _put_le(table + tag * CAVITY_RLE_ENTRY_SIZE, nrows[tag], 4);
+    _put_le(table + tag * CAVITY_RLE_ENTRY_SIZE + 4, nruns[tag], 4);
+    _put_le(table + tag * CAVITY_RLE_ENTRY_SIZE + 8, nvoxels, 4);
+    _put_le(table + tag * CAVITY_RLE_ENTRY_SIZE + 16, offset, 8);
+    offset += nrows[tag] * CAVITY_RLE_ROW_SIZE +
+              nruns[tag] * CAVITY_RLE_RUN_SIZE + (nvoxels + 7) / 8 +
+              2 * nvoxels * (bits / 8);
+  }
+  ok = ok && fwrite(table, CAVITY_RLE_ENTRY_SIZE, ncav, output) ==
+                 (size_t)ncav;
+
+  /* Cavity blocks */
+  for (tag = 0; ok && tag < ncav; tag++) {
+    nvoxels = start[tag + 1] - start[tag];
+    size = nrows[tag] * CAVITY_RLE_ROW_SIZE +
+           nruns[tag] * CAVITY_RLE_RUN_SIZE + (nvoxels + 7) / 8 +
+           2 * nvoxels * (bits / 8);
+    block = (unsigned char *)calloc(size + 1, 1);
+    rows = block;
+    runs = rows + nrows[tag] * CAVITY_RLE_ROW_SIZE;
+    surface = runs + nruns[tag] * CAVITY_RLE_RUN_SIZE;
+    depth = surface + (nvoxels + 7) / 8;
+    hydropathy = depth + nvoxels * (bits / 8);
+
+    for (voxel = 0, row = 0, run = 0; voxel < nvoxels; voxel++) {
+      c = start[tag] + voxel;
+      i = voxels[c] / ((long)n * o);
+      j = (voxels[c] / o) % n;
+      k = voxels[c] % o;
+      if (voxel == 0 || voxels[c] / o != voxels[c - 1] / o) {
+        last_row = rows + row++ * CAVITY_RLE_ROW_SIZE;
+        _put_le(last_row, i, 2);
+        _put_le(last_row + 2, j, 2);
+        row_runs = 0;
+      }
+      if (voxel == 0 || voxels[c] != voxels[c - 1] + 1 ||
+          voxels[c] / o != voxels[c - 1] / o) {
+        last_run = runs + run++ * CAVITY_RLE_RUN_SIZE;
+        _put_le(last_run, k, 2);
+        _put_le(last_row + 4, ++row_runs, 2);
+        run_length = 0;
+      }
+      _put_le(last_run + 2, ++run_length, 2);
+      if (S[i][j][k] == tag + 2)
+        surface[voxel / 8] |= 1 << (voxel % 8);
+      _quantize(depth + voxel * (bits / 8), M[i][j][k], bits, ranges);
+      _quantize(hydropathy + voxel * (bits / 8), HP[i][j][k], bits,
+                ranges + 2);
+    }
+
+    ok = fwrite(block, 1, size, output) == size;
+    free(block);
+  }
+
+  if (!ok || fclose(output) != 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Could not write grid file: %s\n",
+            filename);
+    exit(-1);
+  }
+
+  free(table);
+  free(nrows);
+  free(nruns);
+  free(voxels);
+  free(start);
+}
+
+/*
+ * Function: export_grids
+ * ----------------------
+ *
+ * Export cavity labels, depth and hydropathy grids, cropped to region of
+ * cavities, as volumetric maps (<output>.KVFinder.<grid>.<format>, npy
+ * grids with their placement, see _write_npy_placement) or in one .npz
+ * file (<output>.KVFinder.grids.npz), or cavity points as run-length
+ * encoded cavity file (<output>.KVFinder.cavities.rle)
+ *
+ * output: output path without suffixes
+ * A: cavities 3D grid
+ * S: surface points 3D grid
+ * M: depth 3D grid
+ * HP: hydropathy 3D grid
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * h: Grid spacing (A)
+ * ncav: number of cavities
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ * grid_format: CCP4_GRID, DX_GRID, NPY_GRID, NPZ_GRID, RLE8_GRID or
+ * RLE16_GRID
+ *
+ */
+void export_grids(char *output, int ***A, int ***S, double ***M, double ***HP,
+                  int m, int n, int o, double h, int ncav, double X1,
+                  double Y1, double Z1, int grid_format) {
+  int grid, region[6];
+  char filename[700];
+  static const char *extensions[] = {"", "ccp4", "dx", "npy"};
+
+  /* Cavity points, run-length encoded */
+  if (grid_format == RLE8_GRID || grid_format == RLE16_GRID) {
+    snprintf(filename, sizeof(filename), "%s.KVFinder.cavities.rle", output);
+    _write_cavity_rle(filename, A, S, M, HP, m, n, o, h, ncav, X1, Y1, Z1,
+                      grid_format == RLE8_GRID ? 8 : 16);
+    return;
+  }
+
+  _cavity_region(ncav, region);
+
+  /* Every grid in one file */
+  if (grid_format == NPZ_GRID) {
+    snprintf(filename, sizeof(filename), "%s.KVFinder.grids.npz", output);
+    _write_npz(filename, A, M, HP, h, X1, Y1, Z1, region);
+    return;
+  }
+
+  for (grid = LABELS_GRID; grid <= HYDROPATHY_GRID; grid++) {
+    snprintf(filename, sizeof(filename), "%s.KVFinder.%s.%s", output,
+             grid_names[grid], extensions[grid_format]);
+    if (grid_format == DX_GRID)
+      _write_dx(filename, A, M, HP, grid, h, X1, Y1, Z1, region);
+    else if (grid_format == NPY_GRID)
+      _write_npy(filename, A, M, HP, grid, region);
+    else
+      _write_ccp4(filename, A, M, HP, grid, m, n, o, h, X1, Y1, Z1, region);
+  }
+
+  /* Grid placement, next to numpy arrays */
+  if (grid_format == NPY_GRID)
+    _write_npy_placement(output, h, X1, Y1, Z1, region);
+}
+
+/* Cavity surface mesh output */
+
+/*
+ * Function: _inside_cavity
+ * ------------------------
+ *
+ * Check whether a grid point belongs to a cavity (points outside grid do
+ * not)
+ *
+ * A: cavities 3D grid
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * i: x grid coordinate
+ * j: y grid coordinate
+ * k: z grid coordinate
+ * tag: cavity integer identifier
+ *
+ * returns: 1 if point belongs to cavity, 0 otherwise
+ *
+ */
+int _inside_cavity(int ***A, int m, int n, int o, int i, int j, int k,
+                   int tag) {
+  if (i < 0 || j < 0 || k < 0 || i >= m || j >= n || k >= o)
+    return 0;
+  return A[i][j][k] == tag;
+}
+
+/*
+ * Function: _cavity_mesh
+ * ----------------------
+ *
+ * Build triangle mesh of a cavity surface by surface nets, over cavity
+ * region found by filter_boundary (enlarged by one point). Each grid cell
+ * with corners inside and outside cavity gets a vertex at centroid of its
+ * crossed edge midpoints; each cavity point edge to a point outside cavity
+ * gets a quad (two triangles) joining vertices of the four cells around it.
+ * Mesh is then decimated by _cluster_mesh.
+ *
+ * A: cavities 3D grid
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * h: Grid spacing (A)
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ * tag: cavity index (0 for KAA)
+ * mesh: cavity mesh
+ *
+ */
+void _cavity_mesh(int ***A, int m, int n, int o, double h, double X1,
+                  double Y1, double Z1, int tag, cavity_mesh *mesh) {
+  int a, b, c, e, d, u, w, corners, count, capacity, quad[4], p[3], q[3];
+  int first[3], size[3], *index;
+  long cell, ncells;
+  double axes[3][3], x[3];
+  static const int edges[12][2] = {{0, 1}, {2, 3}, {4, 5}, {6, 7},
+                                   {0, 2}, {1, 3}, {4, 6}, {5, 7},
+                                   {0, 4}, {1, 5}, {2, 6}, {3, 7}};
+  static const int triangles[6] = {0, 1, 2, 0, 2, 3};
+
+  _grid_axes(axes);
+
+  /* Cells (i, j, k) to (i + 1, j + 1, k + 1) around cavity region */
+  first[0] = (int)cavity[tag].Xmin - 1;
+  first[1] = (int)cavity[tag].Ymin - 1;
+  first[2] = (int)cavity[tag].Zmin - 1;
+  size[0] = (int)cavity[tag].Xmax - first[0] + 1;
+  size[1] = (int)cavity[tag].Ymax - first[1] + 1;
+  size[2] = (int)cavity[tag].Zmax - first[2] + 1;
+  ncells = (long)size[0] * size[1] * size[2];
+  index = (int *)malloc(ncells * sizeof(int));
+
+  /* Vertices */
+  capacity = 1024;
+  mesh->vertices = (float *)malloc(3 * capacity * sizeof(float));
+  mesh->nvertices = 0;
+  for (cell = 0; cell < ncells; cell++) {
+    index[cell] = -1;
+    p[0] = first[0] + cell / ((long)size[1] * size[2]);
+    p[1] = first[1] + (cell / size[2]) % size[1];
+    p[2] = first[2] + cell % size[2];
+
+    /* Corner b is at p + (b & 1, b >> 1 & 1, b >> 2 & 1) */
+    for (corners = 0, b = 0; b < 8; b++)
+      if (_inside_cavity(A, m, n, o, p[0] + (b & 1), p[1] + (b >> 1 & 1),
+                         p[2] + (b >> 2 & 1), tag + 2))
+        corners |= 1 << b;
+    if (corners == 0 || corners == 255)
+      continue;
+
+    /* Centroid of crossed edge midpoints */
+    x[0] = x[1] = x[2] = 0.0;
+    for (count = 0, e = 0; e < 12; e++)
+      if ((corners >> edges[e][0] ^ corners >> edges[e][1]) & 1) {
+        for (a = 0; a < 3; a++)
+          x[a] += (edges[e][0] >> a & 1) + (edges[e][1] >> a & 1);
+        count += 2;
+      }
+
+    if (mesh->nvertices == capacity) {
+      capacity *= 2;
+      mesh->vertices = (float *)realloc(mesh->vertices,
+                                        3 * capacity * sizeof(float));
+    }
+    for (c = 0; c < 3; c++) {
+      mesh->vertices[3 * mesh->nvertices + c] =
+          c == 0 ? X1 : c == 1 ? Y1 : Z1;
+      for (a = 0; a < 3; a++)
+        mesh->vertices[3 * mesh->nvertices + c] +=
+            (p[a] + x[a] / count) * h * axes[a][c];
+    }
+    index[cell] = mesh->nvertices++;
+  }
+
+  /* Faces: quad of edge p-q along axis a, counterclockwise seen from q */
+  capacity = 2048;
+  mesh->faces = (int *)malloc(3 * capacity * sizeof(int));
+  mesh->nfaces = 0;
+  for (p[0] = first[0] + 1; p[0] < first[0] + size[0]; p[0]++)
+    for (p[1] = first[1] + 1; p[1] < first[1] + size[1]; p[1]++)
+      for (p[2] = first[2] + 1; p[2] < first[2] + size[2]; p[2]++) {
+        if (A[p[0]][p[1]][p[2]] != tag + 2)
+          continue;
+        for (a = 0; a < 3; a++)
+          for (d = -1; d <= 1; d += 2) {
+            q[0] = p[0];
+            q[1] = p[1];
+            q[2] = p[2];
+            q[a] += d;
+            if (_inside_cavity(A, m, n, o, q[0], q[1], q[2], tag + 2))
+              continue;
+
+            /* Cells around edge, in (u, w) plane with u x w along a */
+            u = (a + 1) % 3;
+            w = (a + 2) % 3;
+            for (c = 0; c < 4; c++) {
+              q[0] = p[0];
+              q[1] = p[1];
+              q[2] = p[2];
+              q[a] -= d < 0;
+              q[u] -= c == 0 || c == 3;
+              q[w] -= c < 2;
+              quad[d > 0 ? c : 3 - c] =
+                  index[((long)(q[0] - first[0]) * size[1] + q[1] - first[1]) *
+                            size[2] +
+                        q[2] - first[2]];
+            }
+
+            if (mesh->nfaces + 2 > capacity) {
+              capacity *= 2;
+              mesh->faces =
+                  (int *)realloc(mesh->faces, 3 * capacity * sizeof(int));
+            }
+            for (c = 0; c < 6; c++)
+              mesh->faces[3 * mesh->nfaces + c] = quad[triangles[c]];
+            mesh->nfaces += 2;
+          }
+      }
+
+  _cluster_mesh(mesh, index, size);
+  free(index);
+}
+
+/*
+ * Function: _cluster_mesh
+ * -----------------------
+ *
+ * Decimate a cavity mesh by vertex clustering: vertices of cells in the same
+ * cube of MESH_CLUSTER^3 cells are merged at their mean position, and
+ * triangles left with repeated vertices are dropped
+ *
+ * mesh: cavity mesh
+ * index: vertex of each cell (-1 for none)
+ * size: cells along x, y and z
+ *
+ */
+void _cluster_mesh(cavity_mesh *mesh, int *index, int size[3]) {
+  int a, v, f, count, nclusters, *cluster, *remap, *counts, csize[3];
+  long cell, ncells;
+  double *sums;
+
+  for (a = 0; a < 3; a++)
+    csize[a] = (size[a] + MESH_CLUSTER - 1) / MESH_CLUSTER;
+  nclusters = csize[0] * csize[1] * csize[2];
+  ncells = (long)size[0] * size[1] * size[2];
+  cluster = (int *)malloc(nclusters * sizeof(int));
+  for (a = 0; a < nclusters; a++)
+    cluster[a] = -1;
+  remap = (int *)malloc((mesh->nvertices + 1) * sizeof(int));
+  counts = (int *)calloc(mesh->nvertices + 1, sizeof(int));
+  sums = (double *)calloc(3 * mesh->nvertices + 1, sizeof(double));
+
+  /* Merge vertices of each cube of cells */
+  for (count = 0, cell = 0; cell < ncells; cell++) {
+    if ((v = index[cell]) < 0)
+      continue;
+    a = ((cell / ((long)size[1] * size[2]) / MESH_CLUSTER) * csize[1] +
+         (cell / size[2]) % size[1] / MESH_CLUSTER) *
+            csize[2] +
+        cell % size[2] / MESH_CLUSTER;
+    if (cluster[a] < 0)
+      cluster[a] = count++;
+    remap[v] = cluster[a];
+    counts[remap[v]]++;
+    for (f = 0; f < 3; f++)
+      sums[3 * remap[v] + f] += mesh->vertices[3 * v + f];
+  }
+  for (v = 0; v < 3 * count; v++)
+    mesh->vertices[v] = sums[v] / counts[v / 3];
+  mesh->nvertices = count;
+
+  /* Keep triangles with three distinct vertices */
+  for (count = 0, f = 0; f < mesh->nfaces; f++) {
+    for (a = 0; a < 3; a++)
+      mesh->faces[3 * count + a] = remap[mesh->faces[3 * f + a]];
+    if (mesh->faces[3 * count] != mesh->faces[3 * count + 1] &&
+        mesh->faces[3 * count + 1] != mesh->faces[3 * count + 2] &&
+        mesh->faces[3 * count + 2] != mesh->faces[3 * count])
+      count++;
+  }
+  mesh->nfaces = count;
+
+  free(cluster);
+  free(remap);
+  free(counts);
+  free(sums);
+}
+
+/*
+ * Function: _write_ply
+ * --------------------
+ *
+ * Write cavity meshes as one binary little-endian PLY file. Each vertex
+ * has a cavity property (1 for KAA).
+ *
+ * filename: PLY filename
+ * meshes: mesh of each cavity
+ * ncav: number of cavities
+ *
+ */
+void _write_ply(char *filename, cavity_mesh *meshes, int ncav) {
+  int tag, ok;
+  long c, nvertices, nfaces, base;
+  unsigned int word;
+  unsigned char *records;
+  FILE *output;
+
+  for (nvertices = 0, nfaces = 0, tag = 0; tag < ncav; tag++) {
+    nvertices += meshes[tag].nvertices;
+    nfaces += meshes[tag].nfaces;
+  }
+
+  output = fopen(filename, "wb");
+  ok = output != NULL &&
+       fprintf(output,
+               "ply\nformat binary_little_endian 1.0\n"
+               "comment parKVFinder cavity surface meshes (cavity 1 is "
+               "KAA)\nelement vertex %ld\nproperty float x\n"
+               "property float y\nproperty float z\n"
+               "property ushort cavity\nelement face %ld\n"
+               "property list uchar int vertex_indices\nend_header\n",
+               nvertices, nfaces) > 0;
+
+  /* Vertices: x, y, z (float32) and cavity (uint16) */
+  for (tag = 0; ok && tag < ncav; tag++) {
+    records = (unsigned char *)malloc(14L * meshes[tag].nvertices + 1);
+    for (c = 0; c < 3L * meshes[tag].nvertices; c++) {
+      memcpy(&word, &meshes[tag].vertices[c], sizeof(float));
+      _put_le(records + c / 3 * 14 + c % 3 * 4, word, 4);
+      if (c % 3 == 2)
+        _put_le(records + c / 3 * 14 + 12, tag + 1, 2);
+    }
+    ok = fwrite(records, 14, meshes[tag].nvertices, output) ==
+         (size_t)meshes[tag].nvertices;
+    free(records);
+  }
+
+  /* Faces: 3 (uint8) and vertex indexes (int32) */
+  for (base = 0, tag = 0; ok && tag < ncav; tag++) {
+    records = (unsigned char *)malloc(13L * meshes[tag].nfaces + 1);
+    for (c = 0; c < 3L * meshes[tag].nfaces; c++) {
+      if (c % 3 == 0)
+        records[c / 3 * 13] = 3;
+      _put_le(records + c / 3 * 13 + 1 + c % 3 * 4,
+              base + meshes[tag].faces[c], 4);
+    }
+    ok = fwrite(records, 13, meshes[tag].nfaces, output) ==
+         (size_t)meshes[tag].nfaces;
+    base += meshes[tag].nvertices;
+    free(records);
+  }
+
+  if (!ok || fclose(output) != 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Could not write mesh file: %s\n",
+            filename);
+    exit(-1);
+  }
+}
+
+/*
+ * Function: _write_obj
+ * --------------------
+ *
+ * Write cavity meshes as one Wavefront OBJ file, with one object per
+ * cavity (KAA, KAB, ...)
+ *
+ * filename: OBJ filename
+ * meshes: mesh of each cavity
+ * ncav: number of cavities
+ *
+ */
+void _write_obj(char *filename, cavity_mesh *meshes, int ncav) {
+  int tag, ok;
+  long c, base;
+  FILE *output;
+
+  output = fopen(filename, "w");
+  ok = output != NULL &&
+       fprintf(output, "# parKVFinder cavity surface meshes\n") > 0;
+
+  for (base = 1, tag = 0; ok && tag < ncav; tag++) {
+    fprintf(output, "o K%c%c\n", 65 + ((tag / 26) % 26), 65 + (tag % 26));
+    for (c = 0; c < 3L * meshes[tag].nvertices; c += 3)
+      fprintf(output, "v %.3f %.3f %.3f\n", meshes[tag].vertices[c],
+              meshes[tag].vertices[c + 1], meshes[tag].vertices[c + 2]);
+    for (c = 0; c < 3L * meshes[tag].nfaces; c += 3)
+      fprintf(output, "f %ld %ld %ld\n", base + meshes[tag].faces[c],
+              base + meshes[tag].faces[c + 1],
+              base + meshes[tag].faces[c + 2]);
+    base += meshes[tag].nvertices;
+    ok = !ferror(output);
+  }
+
+  if (!ok || fclose(output) != 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Could not write mesh file: %s\n",
+            filename);
+    exit(-1);
+  }
+}
+
+/*
+ * Function: export_meshes
+ * -----------------------
+ *
+ * Export cavity surfaces as triangle meshes, built in parallel cavity by
+ * cavity over cavity regions (<output>.KVFinder.cavities.<format>)
+ *
+ * output: output path without suffixes
+ * A: cavities 3D grid
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * h: Grid spacing (A)
+ * ncav: number of cavities
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ * mesh_format: PLY_MESH or OBJ_MESH
+ *
+ */
+void export_meshes(char *output, int ***A, int m, int n, int o, double h,
+                   int ncav, double X1, double Y1, double Z1,
+                   int mesh_format) {
+  int tag;
+  char filename[700];
+  cavity_mesh *meshes;
+
+  // Set number of threads in OpenMP
+  int ncores = omp_get_num_procs() - 1;
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
+
+  meshes = (cavity_mesh *)calloc(ncav, sizeof(cavity_mesh));
+#pragma omp parallel for default(shared) private(tag) schedule(dynamic)
+  for (tag = 0; tag < ncav; tag++)
+    _cavity_mesh(A, m, n, o, h, X1, Y1, Z1, tag, &meshes[tag]);
+
+  if (mesh_format == PLY_MESH) {
+    snprintf(filename, sizeof(filename), "%s.KVFinder.cavities.ply", output);
+    _write_ply(filename, meshes, ncav);
+  } else {
+    snprintf(filename, sizeof(filename), "%s.KVFinder.cavities.obj", output);
+    _write_obj(filename, meshes, ncav);
+  }
+
+  for (tag = 0; tag < ncav; tag++) {
+    free(meshes[tag].vertices);
+    free(meshes[tag].faces);
+  }
+  free(meshes);
+}
@@ -0,0 +1,59 @@
+#ifndef GRIDOUTPUT_H
+#define GRIDOUTPUT_H
+
+#include <stdio.h>
+
+/* Volumetric grids */
+#define LABELS_GRID 0
+#define DEPTH_GRID 1
+#define HYDROPATHY_GRID 2
+
+/* Volumetric grid output */
+void _cavity_region(int ncav, int region[6]);
+float _grid_value(int ***A, double ***M, double ***HP, int grid, int i, int j,
+                  int k);
+void _grid_axes(double axes[3][3]);
+void _grid_origin(double h, double X1, double Y1, double Z1, int region[6],
+                  double origin[3]);
+void _write_ccp4(char *filename, int ***A, double ***M, double ***HP,
+                 int grid, int m, int n, int o, double h, double X1,
+                 double Y1, double Z1, int region[6]);
+void _write_dx(char *filename, int ***A, double ***M, double ***HP, int grid,
+               double h, double X1, double Y1, double Z1, int region[6]);
+void _put_le(unsigned char *bytes, unsigned long value, int size);
+int _npy_header(unsigned char *header, char type, int size, int ndims,
+                long shape[3]);
+void *_grid_array(int ***A, double ***M, double ***HP, int grid,
+                  int region[6], long shape[3]);
+void _write_npy_file(char *filename, char type, int size, int ndims,
+                     long shape[3], void *data);
+void _write_npy(char *filename, int ***A, double ***M, double ***HP, int grid,
+                int region[6]);
+void _write_npy_placement(char *output, double h, double X1, double Y1,
+                          double Z1, int region[6]);
+int _zip_entry(FILE *output, const char *name, unsigned char *header,
+               int header_size, void *data, size_t size, unsigned long *offset,
+               unsigned char *directory, int *directory_size);
+void _write_npz(char *filename, int ***A, double ***M, double ***HP,
+                double h, double X1, double Y1, double Z1, int region[6]);
+void _quantize(unsigned char *bytes, double value, int bits, float range[2]);
+void _write_cavity_rle(char *filename, int ***A, int ***S, double ***M,
+                       double ***HP, int m, int n, int o, double h, int ncav,
+                       double X1, double Y1, double Z1, int bits);
+void export_grids(char *output, int ***A, int ***S, double ***M, double ***HP,
+                  int m, int n, int o, double h, int ncav, double X1,
+                  double Y1, double Z1, int grid_format);
+
+/* Cavity surface mesh output */
+int _inside_cavity(int ***A, int m, int n, int o, int i, int j, int k,
+                   int tag);
+void _cavity_mesh(int ***A, int m, int n, int o, double h, double X1,
+                  double Y1, double Z1, int tag, cavity_mesh *mesh);
+void _cluster_mesh(cavity_mesh *mesh, int *index, int size[3]);
+void _write_ply(char *filename, cavity_mesh *meshes, int ncav);
+void _write_obj(char *filename, cavity_mesh *meshes, int ncav);
+void export_meshes(char *output, int ***A, int m, int n, int o, double h,
+                   int ncav, double X1, double Y1, double Z1,
+                   int mesh_format);
+
+#endif
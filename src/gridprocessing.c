@@ -1,3 +1,4 @@
+#include <fcntl.h>
 #include <math.h>
 #include <omp.h>
 #include <stdio.h>
@@ -6,6 +7,14 @@
 #include <unistd.h>
 
 #include "utils.h"
+#include "atomindex.h"
+
+/* Length of a cavity point PDB record with in-width fields */
+#define RECORD_SIZE 67
+/* Room for one record with out-of-width fields */
+#define RECORD_BUFFER_SIZE 2048
+/* Per-thread write buffer of export */
+#define WRITE_BUFFER_SIZE (1 << 16)
 
 /* Grid initialization */
 
@@ -66,6 +75,100 @@ double ***dgrid(int m, int n, int o) {
   return M;
 }
 
+/*
+ * Function: reset_igrid
+ * ---------------------
+ *
+ * Fill an allocated integer grid with a value, so it can be reused
+ *
+ * A: 3D grid
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * value: fill value
+ *
+ */
+void reset_igrid(int ***A, int m, int n, int o, int value) {
+  int i, j, k;
+
+  /* Set number of processes in OpenMP */
+  int ncores = omp_get_num_procs() - 1;
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
+
+#pragma omp parallel for collapse(2) schedule(static) default(none),           \
+    shared(A, m, n, o, value), private(i, j, k)
+  for (i = 0; i < m; i++)
+    for (j = 0; j < n; j++)
+      for (k = 0; k < o; k++)
+        A[i][j][k] = value;
+}
+
+/*
+ * Function: reset_dgrid
+ * ---------------------
+ *
+ * Fill an allocated double grid with a value, so it can be reused
+ *
+ * M: 3D grid
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * value: fill value
+ *
+ */
+void reset_dgrid(double ***M, int m, int n, int o, double value) {
+  int i, j, k;
+
+  /* Set number of processes in OpenMP */
+  int ncores = omp_get_num_procs() - 1;
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
+
+#pragma omp parallel for collapse(2) schedule(static) default(none),           \
+    shared(M, m, n, o, value), private(i, j, k)
+  for (i = 0; i < m; i++)
+    for (j = 0; j < n; j++)
+      for (k = 0; k < o; k++)
+        M[i][j][k] = value;
+}
+
+/* Atom coordinates */
+
+/*
+ * Function: _standardize_atoms
+ * ----------------------------
+ *
+ * Convert atom coordinates to 3D grid units (rotated, relative to P1)
+ *
+ * h: 3D grid spacing (A)
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ *
+ * returns: atom coordinates in grid units (x, y, z of each atom)
+ *
+ */
+double *_standardize_atoms(double h, double X1, double Y1, double Z1) {
+  int a;
+  double x, y, z, xaux, yaux, zaux, *P;
+
+  P = (double *)malloc((3 * natoms + 1) * sizeof(double));
+  for (a = 0; a < natoms; a++) {
+    x = (v[a].x - X1) / h;
+    y = (v[a].y - Y1) / h;
+    z = (v[a].z - Z1) / h;
+    xaux = x * cosb + z * sinb;
+    yaux = y;
+    zaux = (-x) * sinb + z * cosb;
+    P[3 * a] = xaux;
+    P[3 * a + 1] = yaux * cosa - zaux * sina;
+    P[3 * a + 2] = yaux * sina + zaux * cosa;
+  }
+
+  return P;
+}
+
 /* Molecular representation */
 
 /*
@@ -132,8 +235,8 @@ void SAS(int ***A, int m, int n, int o, double h, double probe, double X1,
   double distance, x, y, z, xaux, yaux, zaux, H, x1, y1, z1;
   atom *p;
 
-  /* Loop around PDB linked list */
-  for (p = v; p != NULL; p = p->next) {
+  /* Loop around PDB atom table */
+  for (p = v; p < v + natoms; p++) {
 
     /* Standardize each position */
     x1 = (p->x - X1) / h;
@@ -377,11 +480,123 @@ void filter_noise(int ***A, int m, int n, int o) {
 
 /* Ligand adjustment */
 
+/*
+ * Function: ligand_mask
+ * ---------------------
+ *
+ * Rasterize atoms of a target ligand (atom table) into a mask of grid points
+ * closer than limit to any of them (distance field thresholded at limit). On
+ * a fixed grid, the mask is built once and applied to every frame.
+ *
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * h: Grid spacing (A)
+ * limit: Radius value to limit a space around a ligand (A)
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ *
+ * returns: ligand mask (m * n * o points, 1 inside limit)
+ *
+ */
+unsigned char *ligand_mask(int m, int n, int o, double h, double limit,
+                           double X1, double Y1, double Z1) {
+  /* Declare variables */
+  int i, j, k, a, imin, jmin, kmin, imax, jmax, kmax;
+  double distance, x, y, z, xaux, yaux, zaux, H, *P;
+  unsigned char *L;
+
+  /* Set number of processes in OpenMP */
+  int ncores = omp_get_num_procs() - 1;
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
+
+  /* Ligand mask and ligand atoms in grid units */
+  L = (unsigned char *)calloc((size_t)m * n * o, sizeof(unsigned char));
+  P = _standardize_atoms(h, X1, Y1, Z1);
+  H = limit / h;
+
+  /* Loop around ligand atom table */
+  for (a = 0; a < natoms; a++) {
+    /* Loop around space within limit of ligand atom inside box (with one extra
+     * grid unit for rounding of grid units) */
+    imin = max(floor(P[3 * a] - H) - 1, 0);
+    jmin = max(floor(P[3 * a + 1] - H) - 1, 0);
+    kmin = max(floor(P[3 * a + 2] - H) - 1, 0);
+    imax = min(ceil(P[3 * a] + H) + 1, m - 1);
+    jmax = min(ceil(P[3 * a + 1] + H) + 1, n - 1);
+    kmax = min(ceil(P[3 * a + 2] + H) + 1, o - 1);
+
+#pragma omp parallel default(none),                                            \
+    shared(L, a, v, m, n, o, h, sina, sinb, cosa, cosb, limit, X1, Y1, Z1,     \
+           imin, jmin, kmin, imax, jmax, kmax),                                \
+    private(i, j, k, x, y, z, xaux, yaux, zaux, distance)
+#pragma omp for collapse(3)
+    for (i = imin; i <= imax; i++)
+      for (j = jmin; j <= jmax; j++)
+        for (k = kmin; k <= kmax; k++) {
+          /* Get grid point coordinates */
+          x = i * h;
+          y = j * h;
+          z = k * h;
+          xaux = x * cosb + y * sina * sinb - z * cosa * sinb;
+          yaux = y * cosa + z * sina;
+          zaux = x * sinb - y * sina * cosb + z * cosa * cosb;
+          xaux += X1;
+          yaux += Y1;
+          zaux += Z1;
+
+          /* Get distance between ligand atom and grid point inside box */
+          distance = sqrt(pow(xaux - v[a].x, 2) + pow(yaux - v[a].y, 2) +
+                          pow(zaux - v[a].z, 2));
+
+          /* Mark Point (i,j,k) is inside limited region */
+          if (distance < limit)
+            L[((size_t)i * n + j) * o + k] = 1;
+        }
+  }
+
+  free(P);
+
+  return L;
+}
+
+/*
+ * Function: apply_ligand_mask
+ * ---------------------------
+ *
+ * Turn cavity points outside a ligand mask into medium points
+ *
+ * A: cavities 3D grid
+ * L: ligand mask (see ligand_mask())
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ *
+ */
+void apply_ligand_mask(int ***A, unsigned char *L, int m, int n, int o) {
+  int i, j, k;
+
+  /* Set number of processes in OpenMP */
+  int ncores = omp_get_num_procs() - 1;
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
+
+#pragma omp parallel for collapse(3) schedule(static) default(none),           \
+    shared(A, L, m, n, o), private(i, j, k)
+  for (i = 0; i < m; i++)
+    for (j = 0; j < n; j++)
+      for (k = 0; k < o; k++)
+        if (A[i][j][k] && !L[((size_t)i * n + j) * o + k])
+          A[i][j][k] = -1;
+}
+
 /*
  * Function: adjust2ligand
  * -----------------------
  *
- * Adjust cavities to a radius around atoms of a target ligand.
+ * Adjust cavities to a radius around atoms of a target ligand (atom table)
  *
  * A: cavities 3D grid
  * m: x grid units
@@ -396,50 +611,10 @@ void filter_noise(int ***A, int m, int n, int o) {
  */
 void adjust2ligand(int ***A, int m, int n, int o, double h, double limit,
                    double X1, double Y1, double Z1) {
-  /* Declare variables */
-  int i, j, k, inside, aux;
-  double distance, x, y, z, xaux, yaux, zaux;
-  atom *p;
-
-  /* Loop around analysis box */
-#pragma omp parallel default(none),                                            \
-    shared(A, m, n, o, h, sina, sinb, cosa, cosb, limit, X1, Y1, Z1, p, v),    \
-    private(inside, i, j, k, x, y, z, xaux, yaux, zaux, distance)
-  {
-#pragma omp for collapse(3) schedule(static) // nowait
-    for (i = 0; i < m; i++)
-      for (j = 0; j < n; j++)
-        for (k = 0; k < o; k++) {
-          inside = 0;
-
-          /* Loop around ligand information linked list */
-          for (p = v; p != NULL && !inside; p = p->next) {
-
-            /* Get ligand atom coordinates */
-            x = i * h;
-            y = j * h;
-            z = k * h;
-            xaux = x * cosb + y * sina * sinb - z * cosa * sinb;
-            yaux = y * cosa + z * sina;
-            zaux = x * sinb - y * sina * cosb + z * cosa * cosb;
-            xaux += X1;
-            yaux += Y1;
-            zaux += Z1;
-
-            /* Get distance between protein and grid point inside box */
-            distance = sqrt(pow(xaux - p->x, 2) + pow(yaux - p->y, 2) +
-                            pow(zaux - p->z, 2));
-
-            /* Mark Point (i,j,k) is inside limited region */
-            if (distance < limit)
-              inside = 1;
-          }
+  unsigned char *L = ligand_mask(m, n, o, h, limit, X1, Y1, Z1);
 
-          /* Cavity point is not inside ligand search space */
-          if (inside == 0 && A[i][j][k])
-            A[i][j][k] = -1;
-        }
-  }
+  apply_ligand_mask(A, L, m, n, o);
+  free(L);
 }
 
 /* Box adjustment */
@@ -940,169 +1115,260 @@ void area(int ***S, int m, int n, int o, double h, int ncav) {
   free(area);
 }
 
-/* Constituional characterization */
-
-/*
- * Function: create
- * ----------------
- *
- * Create a res node
- *
- * resnumber: residue number
- * resname: residue name
- * chain: chain identifier
- *
- * returns: residues_info node with residue information (residue number, residue
- * name, chain identier)
- */
-residues_info *_create_residue(int resnumber, char resname, char chain) {
-  residues_info *new = (residues_info *)malloc(sizeof(residues_info));
-
-  new->resnumber = resnumber;
-  new->resname = resname;
-  new->chain = chain;
-  new->next = NULL;
-
-  return new;
-}
+/* Nearest atom mapping */
 
 /*
- * Function: _insert_residue
+ * Function: _index_residues
  * -------------------------
  *
- * Insert residues_info node in linked list
+ * Build residue table (residues), sorted by residue number and chain
+ * identifier, from atom table
  *
- * head: pointer to linked list head
- * new: residues_info node
+ * returns: residue index of each atom in atom table
  *
  */
-void _insert_residue(residues_info **head, residues_info *new) {
-  residues_info *current;
-
-  if (*head == NULL || (*head)->resnumber > new->resnumber) {
-    new->next = *head;
-    *head = new;
-  } else {
-    current = *head;
-    while (current->next != NULL && current->next->resnumber < new->resnumber) {
-      current = current->next;
+int *_index_residues() {
+  int a, *order, *R;
+  atom *p, *q;
+
+  order = sort_atoms_by_residue();
+  R = (int *)malloc(natoms * sizeof(int));
+
+  residues = (residues_info *)malloc(natoms * sizeof(residues_info));
+  nresidues = 0;
+  for (a = 0; a < natoms; a++) {
+    p = &v[order[a]];
+    q = &v[order[a > 0 ? a - 1 : 0]];
+    if (a == 0 || p->resnumber != q->resnumber || strcmp(p->chain, q->chain)) {
+      residues[nresidues].resnumber = p->resnumber;
+      residues[nresidues].resname = p->resname;
+      strcpy(residues[nresidues].RESIDUE, p->RESIDUE);
+      strcpy(residues[nresidues].chain, p->chain);
+      nresidues++;
     }
-    new->next = current->next;
-    current->next = new;
+    R[order[a]] = nresidues - 1;
   }
+
+  free(order);
+  return R;
 }
 
 /*
- * Function: _remove_duplicate_residue
- * -----------------------------------
+ * Function: _insert_contact
+ * -------------------------
  *
- * Remove duplicated residues_info nodes from linked list
+ * Insert residue-cavity contact in a thread-local hash set, if not present
  *
- * head: pointer to linked list head
+ * set: contact set
+ * key: residue-cavity contact packed as (tag << 32 | residue)
  *
  */
-void _remove_duplicate_residue(residues_info *head) {
-  /* Pointer to traverse the linked list */
-  residues_info *current = head;
-
-  /* Pointer to store the next pointer of a node to be deleted*/
-  residues_info *next_next;
-
-  /* do nothing if the list is empty */
-  if (current == NULL)
-    return;
-
-  /* Traverse the list till last node */
-  while (current->next != NULL) {
-    /* Compare current node with next node */
-    if (current->resnumber == current->next->resnumber &&
-        current->chain == current->next->chain) {
-      /* The sequence of steps is important*/
-      next_next = current->next->next;
-      free(current->next);
-      current->next = next_next;
-    } else /* This is tricky: only advance if no deletion */
-    {
-      current = current->next;
-    }
+void _insert_contact(contact_set *set, unsigned long long key) {
+  int i, capacity;
+  unsigned long long slot, *keys;
+
+  /* Grow set to keep load factor below 1/2 */
+  if (2 * (set->size + 1) > set->capacity) {
+    keys = set->keys;
+    capacity = set->capacity;
+    set->capacity = capacity ? 2 * capacity : 64;
+    set->keys = (unsigned long long *)malloc(set->capacity *
+                                             sizeof(unsigned long long));
+    memset(set->keys, 0xff, set->capacity * sizeof(unsigned long long));
+    set->size = 0;
+    for (i = 0; i < capacity; i++)
+      if (keys[i] != ~0ULL)
+        _insert_contact(set, keys[i]);
+    free(keys);
   }
+
+  /* Linear probing */
+  slot = (key * 0x9E3779B97F4A7C15ULL) >> 32;
+  for (i = slot & (set->capacity - 1); set->keys[i] != ~0ULL;
+       i = (i + 1) & (set->capacity - 1))
+    if (set->keys[i] == key)
+      return;
+  set->keys[i] = key;
+  set->size++;
 }
 
 /*
- * Function: interface
+ * Function: map_atoms
  * -------------------
  *
- * Retrieve interface residues surrounding cavities.
+ * Map, for each cavity point, the closest atom whose probe-expanded box
+ * contains it (N), querying a cell list of atoms around each point. In the
+ * same pass, collect the residue-cavity contacts within Probe In plus atomic
+ * radius in thread-local sets, merged afterwards into contacts. interface()
+ * and project_hydropathy() read from these instead of sweeping the atoms.
  *
  * A: cavities 3D grid
+ * N: nearest atom 3D grid (atom index or -1)
  * m: x grid units
  * n: y grid units
  * o: z grid units
  * h: 3D grid spacing (A)
- * probe_in: Probe In size (A)
- * ncav: number of cavities
+ * probe: Probe In size (A)
  * X1: x coordinate of P1
  * Y1: y coordinate of P1
  * Z1: z coordinate of P1
  *
  */
-void interface(int ***A, int m, int n, int o, double h, double probe, int ncav,
+void map_atoms(int ***A, int ***N, int m, int n, int o, double h, double probe,
                double X1, double Y1, double Z1) {
-  int i, j, k, imax, jmax, kmax, tag, old_num = -1, old_tag = -1;
-  double x, y, z, xaux, yaux, zaux, distance, H;
-  atom *p;
-  residues_info *new;
+  int i, j, k, a, b, l, tag, nsets, nfound, capacity, *found, *R;
+  double x, y, z, distance, nearest, H, Hmax, r, *P;
+  contact_set *sets;
+  cell_list *C;
 
-  /* Loop around PDB linked list */
-  for (p = v; p != NULL; p = p->next) {
+  /* Set number of processes in OpenMP */
+  int ncores = omp_get_num_procs() - 1;
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
 
-    /* Standardize each position */
-    x = (p->x - X1) / h;
-    y = (p->y - Y1) / h;
-    z = (p->z - Z1) / h;
-    xaux = x * cosb + z * sinb;
-    yaux = y;
-    zaux = (-x) * sinb + z * cosb;
-    x = xaux;
-    y = yaux * cosa - zaux * sina;
-    z = yaux * sina + zaux * cosa;
+  /* Index atoms in grid units. An atom box reaches at most Hmax + 1 grid units
+   * from the atom along each axis */
+  P = _standardize_atoms(h, X1, Y1, Z1);
+  Hmax = 0.0;
+  for (a = 0; a < natoms; a++)
+    Hmax = max(Hmax, (probe + v[a].radius) / h);
+  r = sqrt(3.0) * (Hmax + 1.0);
+  C = build_cell_list(P, natoms, Hmax + 1.0);
 
-    /* Create a variable for space occupied by probe and radius of atom */
-    H = (probe + p->radius) / h;
+  /* Residue index of each atom and one contact set per thread */
+  R = _index_residues();
+  nsets = omp_get_max_threads();
+  sets = (contact_set *)calloc(nsets, sizeof(contact_set));
 
-    /* Loop around space occupied by probe and radius of atom from atom
-     * position */
-    imax = ceil(x + H);
-    jmax = ceil(y + H);
-    kmax = ceil(z + H);
 #pragma omp parallel default(none),                                            \
-    shared(p, KVFinder_results, H, x, y, z, m, n, o, A, imax, jmax, kmax),     \
-    private(i, j, k, distance, tag, new, old_tag, old_num)
-#pragma omp for collapse(3)
-    for (i = floor(x - H); i <= imax; i++)
-      for (j = floor(y - H); j <= jmax; j++)
-        for (k = floor(z - H); k <= kmax; k++)
-          /* If inside box, do ... */
-          if (i < m && i > 0 && j < n && j > 0 && k < o && k > 0) {
-            if (abs(A[i][j][k]) > 1) {
-              tag = A[i][j][k] - 2;
+    shared(A, N, P, R, C, v, m, n, o, h, probe, r, sets),                      \
+    private(i, j, k, a, b, l, tag, x, y, z, H, distance, nearest, nfound,      \
+            capacity, found)
+  {
+    found = NULL;
+    capacity = 0;
+#pragma omp for collapse(3) schedule(dynamic, 64)
+    for (i = 0; i < m; i++)
+      for (j = 0; j < n; j++)
+        for (k = 0; k < o; k++) {
+          N[i][j][k] = -1;
+          if (A[i][j][k] > 1) {
+            tag = A[i][j][k] - 2;
+            nearest = 0.0;
+
+            /* Loop around atoms near cavity point */
+            nfound = query_radius(C, i, j, k, r, &found, &capacity);
+            for (l = 0; l < nfound; l++) {
+              a = found[l];
+              x = P[3 * a];
+              y = P[3 * a + 1];
+              z = P[3 * a + 2];
+
+              /* Create a variable for space occupied by probe and radius of
+               * atom */
+              H = (probe + v[a].radius) / h;
+
+              /* Skip atom if point is outside its box */
+              if (i < floor(x - H) || i > ceil(x + H) || j < floor(y - H) ||
+                  j > ceil(y + H) || k < floor(z - H) || k > ceil(z + H))
+                continue;
+
               distance = sqrt(pow(i - x, 2) + pow(j - y, 2) + pow(k - z, 2));
-              if (distance <= H) {
-                if (old_num != p->resnumber || old_tag != tag) {
-                  new = _create_residue(p->resnumber, p->resname, p->chain);
-                  _insert_residue(&KVFinder_results[tag].res_info, new);
-                }
-                old_num = p->resnumber;
-                old_tag = tag;
+
+              /* Keep closest atom (lowest atom index on ties) */
+              b = N[i][j][k];
+              if (b < 0 || distance < nearest ||
+                  (distance == nearest && a < b)) {
+                N[i][j][k] = a;
+                nearest = distance;
               }
+
+              /* Record residue-cavity contact in this thread's set */
+              if (distance <= H)
+                _insert_contact(&sets[omp_get_thread_num()],
+                                ((unsigned long long)tag << 32) |
+                                    (unsigned int)R[a]);
             }
           }
+        }
+    free(found);
   }
 
-  /* Remove duplicates */
-  for (i = 0; i < ncav; i++) {
-    _remove_duplicate_residue(KVFinder_results[i].res_info);
+  /* Merge thread-local sets into contacts */
+  ncontacts = 0;
+  for (b = 0; b < nsets; b++)
+    ncontacts += sets[b].size;
+  contacts = (contact *)malloc((ncontacts + 1) * sizeof(contact));
+  ncontacts = 0;
+  for (b = 0; b < nsets; b++) {
+    for (i = 0; i < sets[b].capacity; i++)
+      if (sets[b].keys[i] != ~0ULL) {
+        contacts[ncontacts].tag = (int)(sets[b].keys[i] >> 32);
+        contacts[ncontacts].residue = (int)(sets[b].keys[i] & 0xffffffffULL);
+        ncontacts++;
+      }
+    free(sets[b].keys);
   }
+
+  free(sets);
+  free(R);
+  free_cell_list(C);
+  free(P);
+}
+
+/* Constituional characterization */
+
+/*
+ * Function: _compare_contact
+ * --------------------------
+ *
+ * Compare two residue-cavity contacts by cavity index and residue index
+ *
+ */
+int _compare_contact(const void *a, const void *b) {
+  const contact *p = (const contact *)a, *q = (const contact *)b;
+
+  if (p->tag != q->tag)
+    return p->tag < q->tag ? -1 : 1;
+  return (p->residue > q->residue) - (p->residue < q->residue);
+}
+
+/*
+ * Function: interface
+ * -------------------
+ *
+ * Retrieve interface residues surrounding cavities from residue-cavity
+ * contacts collected by map_atoms(). Each cavity receives a sorted,
+ * duplicate-free array of residues.
+ *
+ */
+void interface() {
+  int i, first, tag;
+
+  /* Sort contacts by cavity and residue (residue table is already sorted) */
+  qsort(contacts, ncontacts, sizeof(contact), _compare_contact);
+
+  /* Copy residues of each cavity, skipping duplicates among threads */
+  for (first = 0; first < ncontacts; first = i) {
+    tag = contacts[first].tag;
+    for (i = first; i < ncontacts && contacts[i].tag == tag; i++)
+      ;
+    KVFinder_results[tag].res_info =
+        (residues_info *)malloc((i - first) * sizeof(residues_info));
+    KVFinder_results[tag].nres = 0;
+    for (i = first; i < ncontacts && contacts[i].tag == tag; i++)
+      if (i == first || contacts[i].residue != contacts[i - 1].residue)
+        KVFinder_results[tag].res_info[KVFinder_results[tag].nres++] =
+            residues[contacts[i].residue];
+  }
+
+  /* Free residue-cavity contacts and residue table */
+  free(contacts);
+  contacts = NULL;
+  ncontacts = 0;
+  free(residues);
+  residues = NULL;
+  nresidues = 0;
 }
 
 /* Cavity boundary and depth estimation */
@@ -1212,8 +1478,9 @@ void remove_boundary(int ***A, int m, int n, int o, int ncav) {
 }
 
 void depth(int ***A, double ***M, int m, int n, int o, double h, int ncav) {
-  int i, j, k, i2, j2, k2, count, tag;
-  double distance, tmp;
+  int i, j, k, i2, j2, k2, count, tag, nb, b;
+  double tmp, r, *P;
+  cell_list *C;
 
   // Set number of threads in OpenMP
   int ncores = omp_get_num_procs();
@@ -1222,7 +1489,7 @@ void depth(int ***A, double ***M, int m, int n, int o, double h, int ncav) {
 
 #pragma omp parallel default(none),                                            \
     shared(A, M, m, n, o, h, ncav, cavity, boundary, KVFinder_results),        \
-    private(tmp, tag, i, j, k, i2, j2, k2, distance, count)
+    private(tmp, tag, i, j, k, i2, j2, k2, count, nb, b, r, P, C)
   {
 #pragma omp for schedule(dynamic)
     for (tag = 0; tag < ncav; tag++) {
@@ -1230,34 +1497,48 @@ void depth(int ***A, double ***M, int m, int n, int o, double h, int ncav) {
       KVFinder_results[tag].avg_depth = 0.0;
       count = 0;
 
+      // Index cavity-bulk boundary points of cavity tag (none in a void)
+      nb = 0;
+      for (i2 = boundary[tag].Xmin; i2 <= boundary[tag].Xmax; i2++)
+        for (j2 = boundary[tag].Ymin; j2 <= boundary[tag].Ymax; j2++)
+          for (k2 = boundary[tag].Zmin; k2 <= boundary[tag].Zmax; k2++)
+            if (A[i2][j2][k2] == -(tag + 2))
+              nb++;
+      P = (double *)malloc((3 * nb + 1) * sizeof(double));
+      nb = 0;
+      for (i2 = boundary[tag].Xmin; i2 <= boundary[tag].Xmax; i2++)
+        for (j2 = boundary[tag].Ymin; j2 <= boundary[tag].Ymax; j2++)
+          for (k2 = boundary[tag].Zmin; k2 <= boundary[tag].Zmax; k2++)
+            if (A[i2][j2][k2] == -(tag + 2)) {
+              P[3 * nb] = i2;
+              P[3 * nb + 1] = j2;
+              P[3 * nb + 2] = k2;
+              nb++;
+            }
+      C = build_cell_list(P, nb, 2.0);
+
       for (i = cavity[tag].Xmin; i <= cavity[tag].Xmax; i++)
         for (j = cavity[tag].Ymin; j <= cavity[tag].Ymax; j++)
           for (k = cavity[tag].Zmin; k <= cavity[tag].Zmax; k++)
             if (abs(A[i][j][k]) == (tag + 2)) {
-              tmp = sqrt(pow(m, 2) + pow(n, 2) + pow(o, 2)) * h;
               count++;
 
-              if (boundary[tag].Xmin == m && boundary[tag].Ymin == n &&
-                  boundary[tag].Zmin == o && boundary[tag].Xmax == 0.0 &&
-                  boundary[tag].Ymax == 0.0 && boundary[tag].Zmax == 0.0) {
+              if (nb == 0) {
                 // Cavity without boundary (void)
                 tmp = 0.0;
               } else {
-                for (i2 = boundary[tag].Xmin; i2 <= boundary[tag].Xmax; i2++)
-                  for (j2 = boundary[tag].Ymin; j2 <= boundary[tag].Ymax; j2++)
-                    for (k2 = boundary[tag].Zmin; k2 <= boundary[tag].Zmax;
-                         k2++)
-                      if (A[i2][j2][k2] == -(tag + 2)) {
-                        distance = sqrt(pow(i2 - i, 2) + pow(j2 - j, 2) +
-                                        pow(k2 - k, 2)) *
-                                   h;
-                        if (distance < tmp)
-                          tmp = distance;
-                      }
+                // Nearest boundary point, widening query radius until found
+                for (r = C->size;
+                     (b = query_nearest(C, i, j, k, r)) < 0; r *= 2.0)
+                  ;
+                tmp = sqrt(pow(P[3 * b] - i, 2) + pow(P[3 * b + 1] - j, 2) +
+                           pow(P[3 * b + 2] - k, 2)) *
+                      h;
               }
 
-              // Save depth for cavity point
-              M[i][j][k] = tmp;
+              // Save depth for cavity point (M is NULL in metrics only mode)
+              if (M != NULL)
+                M[i][j][k] = tmp;
 
               // Save maximum depth for cavity tag
               if (tmp > KVFinder_results[tag].max_depth)
@@ -1268,6 +1549,9 @@ void depth(int ***A, double ***M, int m, int n, int o, double h, int ncav) {
             }
       // Divide sum of depths by number of cavity points for cavity tag
       KVFinder_results[tag].avg_depth /= count;
+
+      free_cell_list(C);
+      free(P);
     }
   }
 
@@ -1275,6 +1559,184 @@ void depth(int ***A, double ***M, int m, int n, int o, double h, int ncav) {
   remove_boundary(A, m, n, o, ncav);
 }
 
+/* Cavity selection */
+
+/*
+ * Function: select_cavities
+ * -------------------------
+ *
+ * Untag cavities not selected and renumber selected ones in their original
+ * order, compacting their results, cavity and boundary regions. Must not be
+ * called while cavity-bulk boundary points are tagged (between
+ * filter_boundary and depth).
+ *
+ * A: cavities 3D grid
+ * S: surface points 3D grid (NULL before filter_surface)
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * ncav: number of cavities
+ * keep: whether each cavity is selected (ncav entries)
+ *
+ * returns: number of selected cavities
+ *
+ */
+int select_cavities(int ***A, int ***S, int m, int n, int o, int ncav,
+                    int *keep) {
+  int i, j, k, tag, nkept, *remap;
+
+  /* Set number of processes in OpenMP */
+  int ncores = omp_get_num_procs() - 1;
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
+
+  /* New tag of each cavity (-1 when not selected) */
+  remap = (int *)malloc((ncav + 2) * sizeof(int));
+  for (nkept = 0, tag = 0; tag < ncav; tag++) {
+    if (keep[tag]) {
+      remap[tag + 2] = nkept + 2;
+      KVFinder_results[nkept] = KVFinder_results[tag];
+      cavity[nkept] = cavity[tag];
+      boundary[nkept] = boundary[tag];
+      nkept++;
+    } else {
+      remap[tag + 2] = -1;
+      free(KVFinder_results[tag].res_info);
+    }
+  }
+
+  /* Retag grids */
+  if (nkept < ncav) {
+#pragma omp parallel default(none), shared(A, S, m, n, o, ncav, remap),       \
+    private(i, j, k)
+#pragma omp for collapse(3) schedule(static)
+    for (i = 0; i < m; i++)
+      for (j = 0; j < n; j++)
+        for (k = 0; k < o; k++) {
+          if (A[i][j][k] > 1 && A[i][j][k] <= ncav + 1)
+            A[i][j][k] = remap[A[i][j][k]];
+          if (S != NULL && S[i][j][k] > 1 && S[i][j][k] <= ncav + 1)
+            S[i][j][k] = remap[S[i][j][k]];
+        }
+  }
+
+  free(remap);
+
+  return nkept;
+}
+
+/*
+ * Function: keep_largest_cavities
+ * -------------------------------
+ *
+ * Select the top_k cavities with largest volume (ties kept in original
+ * order)
+ *
+ * A: cavities 3D grid
+ * S: surface points 3D grid (NULL before filter_surface)
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * ncav: number of cavities
+ * top_k: number of cavities to keep
+ *
+ * returns: number of selected cavities
+ *
+ */
+int keep_largest_cavities(int ***A, int ***S, int m, int n, int o, int ncav,
+                          int top_k) {
+  int i, tag, rank, *keep;
+
+  if (top_k >= ncav)
+    return ncav;
+
+  /* Rank cavities by volume */
+  keep = (int *)malloc(ncav * sizeof(int));
+  for (tag = 0; tag < ncav; tag++) {
+    for (rank = 0, i = 0; i < ncav; i++)
+      if (KVFinder_results[i].volume > KVFinder_results[tag].volume ||
+          (KVFinder_results[i].volume == KVFinder_results[tag].volume &&
+           i < tag))
+        rank++;
+    keep[tag] = rank < top_k;
+  }
+
+  ncav = select_cavities(A, S, m, n, o, ncav, keep);
+  free(keep);
+
+  return ncav;
+}
+
+/*
+ * Function: keep_cavities_near_residues
+ * -------------------------------------
+ *
+ * Select cavities with any of the listed residues among their interface
+ * residues
+ *
+ * A: cavities 3D grid
+ * S: surface points 3D grid
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * ncav: number of cavities
+ * list: residues (residue number and chain identifier)
+ * nlist: number of residues
+ *
+ * returns: number of selected cavities
+ *
+ */
+int keep_cavities_near_residues(int ***A, int ***S, int m, int n, int o,
+                                int ncav, residues_info *list, int nlist) {
+  int i, r, tag, *keep;
+  residues_info *res;
+
+  keep = (int *)calloc(ncav, sizeof(int));
+  for (tag = 0; tag < ncav; tag++)
+    for (i = 0; i < KVFinder_results[tag].nres && !keep[tag]; i++) {
+      res = &KVFinder_results[tag].res_info[i];
+      for (r = 0; r < nlist && !keep[tag]; r++)
+        keep[tag] = res->resnumber == list[r].resnumber &&
+                    !strcmp(res->chain, list[r].chain);
+    }
+
+  ncav = select_cavities(A, S, m, n, o, ncav, keep);
+  free(keep);
+
+  return ncav;
+}
+
+/*
+ * Function: keep_deep_cavities
+ * ----------------------------
+ *
+ * Select cavities with maximum depth of at least min_depth
+ *
+ * A: cavities 3D grid
+ * S: surface points 3D grid
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * ncav: number of cavities
+ * min_depth: minimum depth (A)
+ *
+ * returns: number of selected cavities
+ *
+ */
+int keep_deep_cavities(int ***A, int ***S, int m, int n, int o, int ncav,
+                       double min_depth) {
+  int tag, *keep;
+
+  keep = (int *)malloc(ncav * sizeof(int));
+  for (tag = 0; tag < ncav; tag++)
+    keep[tag] = KVFinder_results[tag].max_depth >= min_depth;
+
+  ncav = select_cavities(A, S, m, n, o, ncav, keep);
+  free(keep);
+
+  return ncav;
+}
+
 /* Export cavity PDB file */
 
 /*
@@ -1313,11 +1775,148 @@ int _filter_cavity(int ***A, int m, int n, int o, int i, int j, int k) {
   return 0;
 }
 
+/*
+ * Function: _cavity_voxels
+ * ------------------------
+ *
+ * List cavity points grouped by cavity tag, in grid order inside each
+ * cavity. The grid is swept twice (counting, then filling) in parallel over
+ * x slabs, with per-slab offsets keeping the order deterministic.
+ *
+ * A: cavities 3D grid
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * ncav: number of cavities
+ * start: pointer to offsets of each cavity in list (ncav + 1 entries)
+ *
+ * returns: grid indexes ((i * n + j) * o + k) of cavity points
+ *
+ */
+long *_cavity_voxels(int ***A, int m, int n, int o, int ncav, long **start) {
+  int i, j, k, tag;
+  long *offset, *voxels, total;
+
+  /* Set number of threads in OpenMP */
+  int ncores = omp_get_num_procs();
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
+
+  /* Points of each cavity in each x slab */
+  offset = (long *)calloc((size_t)m * ncav + 1, sizeof(long));
+#pragma omp parallel for schedule(static) private(j, k, tag)
+  for (i = 0; i < m; i++)
+    for (j = 0; j < n; j++)
+      for (k = 0; k < o; k++) {
+        tag = A[i][j][k];
+        if (tag >= 2 && tag <= ncav + 1)
+          offset[(long)i * ncav + tag - 2]++;
+      }
+
+  /* Position of first point of each cavity and of each slab of a cavity */
+  *start = (long *)malloc((ncav + 1) * sizeof(long));
+  for (total = 0, tag = 0; tag < ncav; tag++) {
+    (*start)[tag] = total;
+    for (i = 0; i < m; i++) {
+      total += offset[(long)i * ncav + tag];
+      offset[(long)i * ncav + tag] = total - offset[(long)i * ncav + tag];
+    }
+  }
+  (*start)[ncav] = total;
+
+  /* Fill cavity points list */
+  voxels = (long *)malloc((total + 1) * sizeof(long));
+#pragma omp parallel for schedule(static) private(j, k, tag)
+  for (i = 0; i < m; i++)
+    for (j = 0; j < n; j++)
+      for (k = 0; k < o; k++) {
+        tag = A[i][j][k];
+        if (tag >= 2 && tag <= ncav + 1)
+          voxels[offset[(long)i * ncav + tag - 2]++] =
+              ((long)i * n + j) * o + k;
+      }
+
+  free(offset);
+
+  return voxels;
+}
+
+/*
+ * Function: _cavity_record
+ * ------------------------
+ *
+ * Format a cavity point PDB record with fixed-width fields (RECORD_SIZE
+ * bytes while values fit their fields), without stdio or locale
+ *
+ * buffer: destination (at least RECORD_BUFFER_SIZE bytes)
+ * serial: atom serial number
+ * surface: whether point is a surface point (HA) or not (H)
+ * tag: cavity tag
+ * x: x coordinate
+ * y: y coordinate
+ * z: z coordinate
+ * hydropathy: hydropathy of point
+ * depth: depth of point
+ *
+ * returns: record length
+ *
+ */
+int _cavity_record(char *buffer, long serial, int surface, int tag, double x,
+                   double y, double z, double hydropathy, double depth) {
+  char *p = buffer;
+
+  memcpy(p, "ATOM  ", 6);
+  p += 6;
+  p += _format_int(p, serial % 100000, 5, 0);
+  memcpy(p, surface ? "  HA  K" : "  H   K", 7);
+  p += 7;
+  *p++ = 65 + (((tag - 2) / 26) % 26);
+  *p++ = 65 + ((tag - 2) % 26);
+  memcpy(p, "   259    ", 10);
+  p += 10;
+  p += _format_fixed(p, x, 8, 3);
+  p += _format_fixed(p, y, 8, 3);
+  p += _format_fixed(p, z, 8, 3);
+  p += _format_fixed(p, hydropathy, 6, 2);
+  p += _format_fixed(p, depth, 6, 2);
+  *p++ = '\n';
+
+  return p - buffer;
+}
+
+/*
+ * Function: _cavity_point
+ * -----------------------
+ *
+ * Get real coordinates of a grid point
+ *
+ * i: x grid coordinate
+ * j: y grid coordinate
+ * k: z grid coordinate
+ * h: Grid spacing (A)
+ * X1: x coordinate of P1
+ * Y1: y coordinate of P1
+ * Z1: z coordinate of P1
+ * P: real coordinates (x, y, z)
+ *
+ */
+void _cavity_point(int i, int j, int k, double h, double X1, double Y1,
+                   double Z1, double P[3]) {
+  double x = i * h, y = j * h, z = k * h;
+
+  P[0] = x * cosb + y * sina * sinb - z * cosa * sinb + X1;
+  P[1] = y * cosa + z * sina + Y1;
+  P[2] = x * sinb - y * sina * cosb + z * cosa * cosb + Z1;
+}
+
 /*
  * Function: export
  * ----------------
  *
- * Export cavities to PDB file.
+ * Export cavities to PDB file, cavity by cavity in grid order. Record byte
+ * offsets are computed up front from record lengths, then each thread
+ * formats its share of records in a buffer and writes it with pwrite, so
+ * the file is the same for any number of threads.
  *
  * output_pdb: cavity PDB filename
  * A: cavities 3D grid
@@ -1337,82 +1936,117 @@ void export(char *output_pdb, int ***A, int ***S, double ***M, double ***HP,
             int kvp_mode, int m, int n, int o, double h, int ncav, double X1,
             double Y1, double Z1) {
   /* Declare variables */
-  int i, j, k, count, tag;
-  double x, y, z, xaux, yaux, zaux;
-  FILE *output;
+  int i, j, k, tag, fd, thread, nthreads, nchunks = 1, failed = 0;
+  long c, first, last, used, offset, total, *voxels, *start, *chunk;
+  unsigned short *length;
+  double P[3];
+  char *buffer, line[RECORD_BUFFER_SIZE];
+  const char *header = "MODEL        1\n", *footer = "END\nENDMDL\n";
 
   // Set number of threads in OpenMP
-  int ncores = omp_get_num_procs();
+  int ncores = omp_get_num_procs() - 1;
   omp_set_num_threads(ncores);
   omp_set_nested(1);
 
+  /* Cavity points grouped by cavity */
+  voxels = _cavity_voxels(A, m, n, o, ncav, &start);
+  total = start[ncav];
+
   /* Open output PDB file (<PDB>.KVFinder.output.pdb) */
-  output = fopen(output_pdb, "w");
-  fprintf(output, "MODEL     %4.d\n", 1);
-
-  for (count = 1, tag = 2; tag <= ncav + 2; tag++)
-#pragma omp parallel default(none)                                             \
-    shared(A, S, M, HP, sina, sinb, cosa, cosb, h, ncav, tag, count, m, n, o,  \
-           output, kvp_mode, X1, Y1, Z1),                                      \
-    private(i, j, k, x, y, z, xaux, yaux, zaux)
+  fd = open(output_pdb, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Could not write cavities PDB "
+                    "file!\n");
+    exit(-1);
+  }
+
+  length = (unsigned short *)malloc((total + 1) * sizeof(unsigned short));
+  chunk = (long *)calloc(omp_get_max_threads() + 1, sizeof(long));
+
+#pragma omp parallel default(shared)                                           \
+    private(c, i, j, k, tag, P, line, first, last, used, offset, buffer,       \
+            thread, nthreads)
   {
-#pragma omp for schedule(static) collapse(3) ordered nowait
-    for (i = 0; i < m; i++)
-      for (j = 0; j < n; j++)
-        for (k = 0; k < o; k++) {
-          // Check if cavity point with value tag
-          if (A[i][j][k] == tag) {
-            // Convert 3D grid coordinates to real coordinates
-            x = i * h;
-            y = j * h;
-            z = k * h;
-            xaux = x * cosb + y * sina * sinb - z * cosa * sinb;
-            yaux = y * cosa + z * sina;
-            zaux = x * sinb - y * sina * cosb + z * cosa * cosb;
-            xaux += X1;
-            yaux += Y1;
-            zaux += Z1;
-
-            /* Save cavity point coordinates */
-#pragma omp critical
-            if (S[i][j][k] == tag) {
-
-              /* Write each cavity point */
-              fprintf(output,
-                      "ATOM  %5.d  HA  K%c%c   259    %8.3lf%8.3lf%8.3lf"
-                      "%6.2lf%6.2lf\n",
-                      count % 100000, 65 + (((S[i][j][k] - 2) / 26) % 26),
-                      65 + ((S[i][j][k] - 2) % 26), xaux, yaux, zaux,
-                      HP[i][j][k], M[i][j][k]);
-
-            } else {
-              if (kvp_mode)
-                fprintf(output,
-                        "ATOM  %5.d  H   K%c%c   259    %8.3lf%8.3lf%8.3lf"
-                        "%6.2lf%6.2lf\n",
-                        count % 100000,
-                        65 + (((abs(A[i][j][k]) - 2) / 26) % 26),
-                        65 + ((abs(A[i][j][k]) - 2) % 26), xaux, yaux, zaux,
-                        HP[i][j][k], M[i][j][k]);
-              else if (_filter_cavity(A, m, n, o, i, j, k) != 0)
-                fprintf(output,
-                        "ATOM  %5.d  H   K%c%c   259    %8.3lf%8.3lf%8.3lf"
-                        "%6.2lf%6.2lf\n",
-                        count % 100000,
-                        65 + (((abs(A[i][j][k]) - 2) / 26) % 26),
-                        65 + ((abs(A[i][j][k]) - 2) % 26), xaux, yaux, zaux,
-                        HP[i][j][k], M[i][j][k]);
-            }
-            count++;
-          }
-        }
+    thread = omp_get_thread_num();
+    nthreads = omp_get_num_threads();
+    first = total * thread / nthreads;
+    last = total * (thread + 1) / nthreads;
+
+    /* Record lengths (0 for points that are not written). Interior points
+     * are written for filled cavities only. Atom serial numbers count every
+     * cavity point, written or not. */
+    for (c = first; c < last; c++) {
+      i = voxels[c] / ((long)n * o);
+      j = (voxels[c] / o) % n;
+      k = voxels[c] % o;
+      tag = A[i][j][k];
+      length[c] = 0;
+      if (S[i][j][k] == tag || kvp_mode ||
+          _filter_cavity(A, m, n, o, i, j, k) != 0) {
+        _cavity_point(i, j, k, h, X1, Y1, Z1, P);
+        if (fabs(P[0]) < 999.0 && fabs(P[1]) < 999.0 && fabs(P[2]) < 999.0 &&
+            fabs(HP[i][j][k]) < 99.0 && fabs(M[i][j][k]) < 99.0)
+          length[c] = RECORD_SIZE;
+        else
+          length[c] = _cavity_record(line, c + 1, S[i][j][k] == tag, tag,
+                                     P[0], P[1], P[2], HP[i][j][k],
+                                     M[i][j][k]);
+      }
+      chunk[thread + 1] += length[c];
+    }
+
+#pragma omp barrier
+#pragma omp single
+    {
+      /* Byte offset of each thread share, after header */
+      nchunks = nthreads;
+      chunk[0] = strlen(header);
+      for (i = 0; i < nthreads; i++)
+        chunk[i + 1] += chunk[i];
+    }
+
+    /* Format and write records of thread share */
+    buffer = (char *)malloc(WRITE_BUFFER_SIZE);
+    offset = chunk[thread];
+    used = 0;
+    for (c = first; c < last; c++) {
+      if (length[c] == 0)
+        continue;
+      if (used + RECORD_BUFFER_SIZE > WRITE_BUFFER_SIZE) {
+        if (!_write_at(fd, buffer, used, offset))
+          failed = 1;
+        offset += used;
+        used = 0;
+      }
+      i = voxels[c] / ((long)n * o);
+      j = (voxels[c] / o) % n;
+      k = voxels[c] % o;
+      tag = A[i][j][k];
+      _cavity_point(i, j, k, h, X1, Y1, Z1, P);
+      used += _cavity_record(buffer + used, c + 1, S[i][j][k] == tag, tag,
+                             P[0], P[1], P[2], HP[i][j][k], M[i][j][k]);
+    }
+    if (used > 0 && !_write_at(fd, buffer, used, offset))
+      failed = 1;
+    free(buffer);
   }
 
-  fprintf(output, "END\n");
-  fprintf(output, "ENDMDL\n");
+  /* Header and footer */
+  if (!_write_at(fd, header, strlen(header), 0) ||
+      !_write_at(fd, footer, strlen(footer), chunk[nchunks]))
+    failed = 1;
+
+  close(fd);
+  if (failed) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Could not write cavities PDB "
+                    "file!\n");
+    exit(-1);
+  }
 
-  // Close file
-  fclose(output);
+  free(length);
+  free(chunk);
+  free(voxels);
+  free(start);
 }
 
 /* Clean memory */
@@ -1518,72 +2152,37 @@ double get_hydrophobicity_value(char *resname, char *resn[], double *scale) {
  * Function: project_hydropathy
  * ---------------------------
  *
- * Map a hydrophobicity scale per surface point of detected cavities.
+ * Map a hydrophobicity scale per surface point of detected cavities, using the
+ * hydropathy of the closest atom mapped by map_atoms().
  *
  * HP: hydrophobicity scale 3D grid
  * S: surface points 3D grid
+ * N: nearest atom 3D grid
  * m: x grid units
  * n: y grid units
  * o: z grid units
- * h: 3D grid spacing (A)
- * probe: Probe In size (A)
- * X1: x coordinate of P1
- * Y1: y coordinate of P1
- * Z1: z coordinate of P1
  *
  */
-void project_hydropathy(double ***HP, int ***S, int m, int n, int o, double h,
-                        double probe, double X1, double Y1, double Z1) {
+void project_hydropathy(double ***HP, int ***S, int ***N, int m, int n,
+                        int o) {
   int i, j, k;
-  double x, y, z, xaux, yaux, zaux, distance, H, ***ref;
-  atom *p;
 
-  // Initiliaze 3D grid for residues distances
-  ref = dgrid(m, n, o);
-
-  /* Loop around PDB linked list */
-  for (p = v; p != NULL; p = p->next) {
-
-    /* Standardize each position */
-    x = (p->x - X1) / h;
-    y = (p->y - Y1) / h;
-    z = (p->z - Z1) / h;
-    xaux = x * cosb + z * sinb;
-    yaux = y;
-    zaux = (-x) * sinb + z * cosb;
-    x = xaux;
-    y = yaux * cosa - zaux * sina;
-    z = yaux * sina + zaux * cosa;
-
-    /* Create a variable for space occupied by probe and radius of atom */
-    H = (probe + p->radius) / h;
+  /* Set number of processes in OpenMP */
+  int ncores = omp_get_num_procs() - 1;
+  omp_set_num_threads(ncores);
+  omp_set_nested(1);
 
-    for (i = floor(x - H); i <= ceil(x + H); i++)
-      for (j = floor(y - H); j <= ceil(y + H); j++)
-        for (k = floor(z - H); k <= ceil(z + H); k++) {
-          if (i < m && i >= 0 && j < n && j >= 0 && k < o && k >= 0)
-            // Found a surface point
-            if (S[i][j][k] > 1) {
-              // Calculate distance bewteen atom and surface point
-              distance = sqrt(pow(i - x, 2) + pow(j - y, 2) + pow(k - z, 2));
-              // Check if surface point was not checked before
-              if (ref[i][j][k] == 0.0) {
-                ref[i][j][k] = distance;
-                HP[i][j][k] = get_hydrophobicity_value(
-                    _code2residue(p->resname), resn, scale);
-              }
-              // Check if this atom is closer to the previous one assigned
-              else if (ref[i][j][k] > distance) {
-                ref[i][j][k] = distance;
-                HP[i][j][k] = get_hydrophobicity_value(
-                    _code2residue(p->resname), resn, scale);
-              }
-            }
-        }
+#pragma omp parallel default(none), shared(HP, S, N, v, m, n, o),             \
+    private(i, j, k)
+  {
+#pragma omp for collapse(3) schedule(static)
+    for (i = 0; i < m; i++)
+      for (j = 0; j < n; j++)
+        for (k = 0; k < o; k++)
+          // Found a surface point with a neighbouring atom
+          if (S[i][j][k] > 1 && N[i][j][k] >= 0)
+            HP[i][j][k] = v[N[i][j][k]].hydropathy;
   }
-
-  // Free 3D grid for residues distances
-  free_dgrid(ref, m, n, o);
 }
 
 /*
@@ -1594,16 +2193,18 @@ void project_hydropathy(double ***HP, int ***S, int m, int n, int o, double h,
  *
  * avgh: empty array of average hydropathy
  * ncav: number of cavities
- * hydropathy: hydrophobicity scale 3D grid
+ * hydropathy: hydrophobicity scale 3D grid (NULL to take hydropathy of
+ * nearest atoms, without projecting it on a grid)
  * surface: surface points 3D grid
+ * N: nearest atom 3D grid
  * nx: x grid units
  * ny: y grid units
  * nz: z grid units
  * nthreads: number of threads for OpenMP
  *
  */
-void estimate_average_hydropathy(double ***HP, int ***S, int m, int n, int o,
-                                 int ncav) {
+void estimate_average_hydropathy(double ***HP, int ***S, int ***N, int m,
+                                 int n, int o, int ncav) {
   int i, j, k, *pts;
   double *avgh;
 
@@ -1620,7 +2221,7 @@ void estimate_average_hydropathy(double ***HP, int ***S, int m, int n, int o,
     avgh[i] = 0.0;
   }
 
-#pragma omp parallel default(none), shared(avgh, HP, S, pts, m, n, o),         \
+#pragma omp parallel default(none), shared(avgh, HP, S, N, v, pts, m, n, o),   \
     private(i, j, k)
   {
 #pragma omp for collapse(3) ordered
@@ -1630,7 +2231,10 @@ void estimate_average_hydropathy(double ***HP, int ***S, int m, int n, int o,
 #pragma omp critical
           if (S[i][j][k] > 1) {
             pts[S[i][j][k] - 2]++;
-            avgh[S[i][j][k] - 2] += HP[i][j][k];
+            if (HP != NULL)
+              avgh[S[i][j][k] - 2] += HP[i][j][k];
+            else if (N[i][j][k] >= 0)
+              avgh[S[i][j][k] - 2] += v[N[i][j][k]].hydropathy;
           }
         }
   }
@@ -4,6 +4,11 @@
 /* Grid initialization */
 int ***igrid(int m, int n, int o);
 double ***dgrid(int m, int n, int o);
+void reset_igrid(int ***A, int m, int n, int o, int value);
+void reset_dgrid(double ***M, int m, int n, int o, double value);
+
+/* Atom coordinates */
+double *_standardize_atoms(double h, double X1, double Y1, double Z1);
 
 /* Molecular representation */
 int check_protein_neighbours(int ***A, int i, int j, int k, int m, int n,
@@ -18,6 +23,9 @@ void subtract(int ***A, int ***S, int m, int n, int o, double h,
 void filter_noise(int ***A, int m, int n, int o);
 
 /* Ligand adjustment */
+unsigned char *ligand_mask(int m, int n, int o, double h, double limit,
+                           double X1, double Y1, double Z1);
+void apply_ligand_mask(int ***A, unsigned char *L, int m, int n, int o);
 void adjust2ligand(int ***A, int m, int n, int o, double h, double limit,
                    double X1, double Y1, double Z1);
 
@@ -38,28 +46,48 @@ void filter_surface(int ***A, int ***S, int m, int n, int o);
 double check_voxel_class(int ***S, int i, int j, int k);
 void area(int ***S, int m, int n, int o, double h, int ncav);
 
-/* Constitutional characterization */
-residues_info *_create_residue(int resnumber, char resname, char chain);
-void _insert_residue(residues_info **head, residues_info *new);
-void _remove_duplicate_residue(residues_info *head);
-void interface(int ***A, int m, int n, int o, double h, double probe, int ncav,
+/* Nearest atom mapping */
+int *_index_residues();
+void _insert_contact(contact_set *set, unsigned long long key);
+void map_atoms(int ***A, int ***N, int m, int n, int o, double h, double probe,
                double X1, double Y1, double Z1);
 
+/* Constitutional characterization */
+int _compare_contact(const void *a, const void *b);
+void interface();
+
 /* Cavity boundary and depth estimation */
 int define_boundary_points(int ***A, int m, int n, int o, int i, int j, int k);
 void filter_boundary(int ***A, int m, int n, int o, int ncav);
 void remove_boundary(int ***A, int m, int n, int o, int ncav);
 void depth(int ***A, double ***M, int m, int n, int o, double h, int ncav);
 
+/* Cavity selection */
+int select_cavities(int ***A, int ***S, int m, int n, int o, int ncav,
+                    int *keep);
+int keep_largest_cavities(int ***A, int ***S, int m, int n, int o, int ncav,
+                          int top_k);
+int keep_cavities_near_residues(int ***A, int ***S, int m, int n, int o,
+                                int ncav, residues_info *list, int nlist);
+int keep_deep_cavities(int ***A, int ***S, int m, int n, int o, int ncav,
+                       double min_depth);
+
 /* Cavity hydropathy */
+extern char *resn[];
+extern double scale[20];
 double get_hydrophobicity_value(char *resname, char *resn[], double *scale);
-void project_hydropathy(double ***HP, int ***S, int m, int n, int o, double h,
-                        double probe, double X1, double Y1, double Z1);
-void estimate_average_hydropathy(double ***HP, int ***S, int m, int n, int o,
-                                 int ncav);
+void project_hydropathy(double ***HP, int ***S, int ***N, int m, int n,
+                        int o);
+void estimate_average_hydropathy(double ***HP, int ***S, int ***N, int m,
+                                 int n, int o, int ncav);
 
 /* Export cavity PDB file */
 int _filter_cavity(int ***A, int m, int n, int o, int i, int j, int k);
+int _cavity_record(char *buffer, long serial, int surface, int tag, double x,
+                   double y, double z, double hydropathy, double depth);
+void _cavity_point(int i, int j, int k, double h, double X1, double Y1,
+                   double Z1, double P[3]);
+long *_cavity_voxels(int ***A, int m, int n, int o, int ncav, long **start);
 void export(char *output_pdb, int ***A, int ***S, double ***M, double ***HP,
             int kvp_mode, int m, int n, int o, double h, int ncav, double X1,
             double Y1, double Z1);
@@ -0,0 +1,621 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kvarchive.h"
+
+/* Results archive encoding and decoding. Standalone: depends on
+ * kvarchive.h only, so tools can build it without parKVFinder sources. */
+
+/* Bytes read at a time when looking for next record magic */
+#define KV_ARCHIVE_SCAN_SIZE 65536
+
+/* Results archive encoding */
+
+/*
+ * Function: _store_le
+ * -------------------
+ *
+ * Store an unsigned integer in little-endian byte order
+ *
+ * bytes: destination
+ * value: integer value
+ * size: number of bytes
+ *
+ */
+void _store_le(unsigned char *bytes, unsigned long value, int size) {
+  int i;
+
+  for (i = 0; i < size; i++)
+    bytes[i] = (value >> (8 * i)) & 0xff;
+}
+
+/*
+ * Function: _load_le
+ * ------------------
+ *
+ * Load an unsigned little-endian integer
+ *
+ * bytes: source
+ * size: number of bytes
+ *
+ * returns: integer value
+ *
+ */
+unsigned long _load_le(unsigned char *bytes, int size) {
+  int i;
+  unsigned long value = 0;
+
+  for (i = size - 1; i >= 0; i--)
+    value = (value << 8) | bytes[i];
+
+  return value;
+}
+
+/*
+ * Function: _write_all
+ * --------------------
+ *
+ * Write a buffer to a file descriptor, resuming short or interrupted writes
+ *
+ * fd: file descriptor
+ * buffer: data
+ * size: size of data
+ *
+ * returns: 1 if every byte was written, 0 otherwise
+ *
+ */
+int _write_all(int fd, unsigned char *buffer, unsigned long size) {
+  ssize_t written;
+
+  while (size > 0) {
+    written = write(fd, buffer, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return 0;
+    buffer += written;
+    size -= written;
+  }
+
+  return 1;
+}
+
+/*
+ * Function: append_kv_archive
+ * ---------------------------
+ *
+ * Append a record to an archive, and its entry to index file, writing
+ * archive and index headers first when files are empty. Record and entry
+ * are built in memory and written while holding a write lock on the whole
+ * archive; a failed write is truncated away from both files before
+ * unlocking.
+ *
+ * fd: archive file descriptor (opened with O_WRONLY | O_CREAT | O_APPEND)
+ * index_fd: index file descriptor (opened as fd) or -1 for no index
+ * name: record name
+ * nmembers: number of members
+ * names: name of each member
+ * data: data of each member
+ * sizes: size of each member data
+ *
+ * returns: 0 on success, -1 on failure (files unchanged) or -2 on failure
+ * to truncate a failed write (archive may end with an incomplete record)
+ *
+ */
+int append_kv_archive(int fd, int index_fd, const char *name, int nmembers,
+                      char **names, unsigned char **data,
+                      unsigned long *sizes) {
+  int i, ok;
+  unsigned long size, entry_size, pos, epos, start;
+  unsigned char header[KV_ARCHIVE_INDEX_HEADER_SIZE], *record, *entry;
+  off_t end, index_end = 0;
+  struct flock lock;
+
+  /* Build record and its index entry (record offset is stored later) */
+  size = KV_ARCHIVE_RECORD_SIZE + strlen(name);
+  entry_size = KV_ARCHIVE_ENTRY_SIZE + strlen(name);
+  for (i = 0; i < nmembers; i++) {
+    size += KV_ARCHIVE_MEMBER_SIZE + strlen(names[i]) + sizes[i];
+    entry_size += KV_ARCHIVE_ENTRY_MEMBER_SIZE + strlen(names[i]);
+  }
+  record = (unsigned char *)malloc(size);
+  entry = (unsigned char *)malloc(entry_size);
+  if (record == NULL || entry == NULL) {
+    free(record);
+    free(entry);
+    return -1;
+  }
+  memcpy(record, KV_ARCHIVE_RECORD_MAGIC, 8);
+  _store_le(record + 8, size, 8);
+  _store_le(record + 16, strlen(name), 4);
+  _store_le(record + 20, nmembers, 4);
+  memcpy(record + KV_ARCHIVE_RECORD_SIZE, name, strlen(name));
+  memcpy(entry, KV_ARCHIVE_ENTRY_MAGIC, 8);
+  _store_le(entry + 16, size, 8);
+  memcpy(entry + 24, record + 16, 8);
+  memcpy(entry + KV_ARCHIVE_ENTRY_SIZE, name, strlen(name));
+  pos = KV_ARCHIVE_RECORD_SIZE + strlen(name);
+  epos = KV_ARCHIVE_ENTRY_SIZE + strlen(name);
+  for (i = 0; i < nmembers; i++) {
+    _store_le(record + pos, strlen(names[i]), 4);
+    _store_le(record + pos + 4, 0, 4);
+    _store_le(record + pos + 8, sizes[i], 8);
+    pos += KV_ARCHIVE_MEMBER_SIZE;
+    memcpy(record + pos, names[i], strlen(names[i]));
+    pos += strlen(names[i]);
+    _store_le(entry + epos, strlen(names[i]), 4);
+    _store_le(entry + epos + 4, 0, 4);
+    _store_le(entry + epos + 8, pos, 8);
+    _store_le(entry + epos + 16, sizes[i], 8);
+    epos += KV_ARCHIVE_ENTRY_MEMBER_SIZE;
+    memcpy(entry + epos, names[i], strlen(names[i]));
+    epos += strlen(names[i]);
+    memcpy(record + pos, data[i], sizes[i]);
+    pos += sizes[i];
+  }
+
+  /* Lock whole archive (index is only written under this lock) */
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  while ((ok = fcntl(fd, F_SETLKW, &lock)) == -1 && errno == EINTR)
+    ;
+  if (ok == -1) {
+    free(record);
+    free(entry);
+    return -1;
+  }
+
+  /* Index entries left from a removed archive are dropped */
+  end = lseek(fd, 0, SEEK_END);
+  ok = end >= 0;
+  if (ok && index_fd >= 0) {
+    index_end = lseek(index_fd, 0, SEEK_END);
+    if (index_end > 0 && end == 0)
+      index_end = ftruncate(index_fd, 0) == 0 ? 0 : -1;
+    ok = index_end >= 0;
+  }
+  start = end ? (unsigned long)end : KV_ARCHIVE_HEADER_SIZE;
+
+  /* Headers of a new archive and index, then record and its entry */
+  if (ok && end == 0) {
+    memset(header, 0, KV_ARCHIVE_HEADER_SIZE);
+    memcpy(header, KV_ARCHIVE_MAGIC, 8);
+    _store_le(header + 8, KV_ARCHIVE_VERSION, 4);
+    ok = _write_all(fd, header, KV_ARCHIVE_HEADER_SIZE) ? 1 : -1;
+  }
+  if (ok == 1 && index_fd >= 0 && index_end == 0) {
+    memset(header, 0, KV_ARCHIVE_INDEX_HEADER_SIZE);
+    memcpy(header, KV_ARCHIVE_INDEX_MAGIC, 8);
+    _store_le(header + 8, KV_ARCHIVE_VERSION, 4);
+    _store_le(header + 16, start, 8);
+    ok = _write_all(index_fd, header, KV_ARCHIVE_INDEX_HEADER_SIZE) ? 1 : -1;
+  }
+  if (ok == 1)
+    ok = _write_all(fd, record, size) ? 1 : -1;
+  _store_le(entry + 8, start, 8);
+  if (ok == 1 && index_fd >= 0)
+    ok = _write_all(index_fd, entry, entry_size) ? 1 : -1;
+
+  /* Truncate failed write back to previous end of files */
+  if (ok == -1)
+    ok = ftruncate(fd, end) == 0 &&
+                 (index_fd < 0 || ftruncate(index_fd, index_end) == 0)
+             ? 0
+             : -2;
+
+  /* Unlock */
+  lock.l_type = F_UNLCK;
+  fcntl(fd, F_SETLK, &lock);
+  free(record);
+  free(entry);
+
+  return ok == 1 ? 0 : ok == 0 ? -1 : -2;
+}
+
+/* Results archive decoding */
+
+/*
+ * Function: _free_kv_record
+ * -------------------------
+ *
+ * Free names and members of a record index entry
+ *
+ * record: index entry
+ *
+ */
+void _free_kv_record(kv_archive_record *record) {
+  int i;
+
+  for (i = 0; i < record->nmembers; i++)
+    free(record->members[i].name);
+  free(record->members);
+  free(record->name);
+}
+
+/*
+ * Function: _read_kv_record
+ * -------------------------
+ *
+ * Read index entry of a record, checking that record and its members fit
+ * in record size and file
+ *
+ * R: opened archive
+ * offset: offset of record
+ * file_size: size of archive file
+ * record: index entry
+ *
+ * returns: 1 if a complete record was read, 0 otherwise
+ *
+ */
+int _read_kv_record(kv_archive *R, unsigned long offset,
+                    unsigned long file_size, kv_archive_record *record) {
+  int i;
+  unsigned long length, end, pos;
+  unsigned char header[KV_ARCHIVE_RECORD_SIZE];
+  kv_archive_member *member;
+
+  if (fseek(R->file, offset, SEEK_SET) ||
+      fread(header, 1, KV_ARCHIVE_RECORD_SIZE, R->file) !=
+          KV_ARCHIVE_RECORD_SIZE ||
+      memcmp(header, KV_ARCHIVE_RECORD_MAGIC, 8))
+    return 0;
+
+  record->offset = offset;
+  record->size = _load_le(header + 8, 8);
+  length = _load_le(header + 16, 4);
+  record->nmembers = _load_le(header + 20, 4);
+  end = offset + record->size;
+  if (record->size < KV_ARCHIVE_RECORD_SIZE + length || end > file_size ||
+      end < offset ||
+      (unsigned long)record->nmembers * KV_ARCHIVE_MEMBER_SIZE > record->size)
+    return 0;
+
+  record->name = (char *)calloc(length + 1, 1);
+  record->members = (kv_archive_member *)calloc(
+      record->nmembers ? record->nmembers : 1, sizeof(kv_archive_member));
+  if (fread(record->name, 1, length, R->file) != length)
+    record->nmembers = -1;
+
+  /* Members */
+  pos = offset + KV_ARCHIVE_RECORD_SIZE + length;
+  for (i = 0; i < record->nmembers; i++) {
+    member = &record->members[i];
+    if (pos + KV_ARCHIVE_MEMBER_SIZE > end || fseek(R->file, pos, SEEK_SET) ||
+        fread(header, 1, KV_ARCHIVE_MEMBER_SIZE, R->file) !=
+            KV_ARCHIVE_MEMBER_SIZE)
+      break;
+    length = _load_le(header, 4);
+    member->size = _load_le(header + 8, 8);
+    member->offset = pos + KV_ARCHIVE_MEMBER_SIZE + length;
+    if (member->offset > end || member->size > end - member->offset)
+      break;
+    member->name = (char *)calloc(length + 1, 1);
+    if (fread(member->name, 1, length, R->file) != length)
+      break;
+    pos = member->offset + member->size;
+  }
+
+  /* Incomplete record */
+  if (i != record->nmembers || pos != end) {
+    _free_kv_record(record);
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Function: _next_kv_record
+ * -------------------------
+ *
+ * Look for next record magic, to resume indexing after an incomplete record
+ *
+ * file: archive file
+ * offset: offset where search starts
+ * file_size: size of archive file
+ *
+ * returns: offset of next record magic or file_size if there is none
+ *
+ */
+unsigned long _next_kv_record(FILE *file, unsigned long offset,
+                              unsigned long file_size) {
+  unsigned long i, nread;
+  unsigned char *buffer;
+
+  buffer = (unsigned char *)malloc(KV_ARCHIVE_SCAN_SIZE);
+  while (offset + 8 <= file_size && !fseek(file, offset, SEEK_SET)) {
+    nread = fread(buffer, 1, KV_ARCHIVE_SCAN_SIZE, file);
+    if (nread < 8)
+      break;
+    for (i = 0; i + 8 <= nread; i++)
+      if (buffer[i] == 'K' && !memcmp(buffer + i, KV_ARCHIVE_RECORD_MAGIC, 8)) {
+        free(buffer);
+        return offset + i;
+      }
+    offset += nread - 7;
+  }
+  free(buffer);
+
+  return file_size;
+}
+
+/*
+ * Function: _new_kv_record
+ * ------------------------
+ *
+ * Make room for one more record in record index of an archive
+ *
+ * R: opened archive
+ *
+ * returns: next free index entry (counted once filled by caller)
+ *
+ */
+kv_archive_record *_new_kv_record(kv_archive *R) {
+  if (R->nrecords == R->capacity) {
+    R->capacity = R->capacity ? 2 * R->capacity : 64;
+    R->records = (kv_archive_record *)realloc(
+        R->records, R->capacity * sizeof(kv_archive_record));
+  }
+
+  return &R->records[R->nrecords];
+}
+
+/*
+ * Function: _walk_kv_records
+ * --------------------------
+ *
+ * Index records by walking record sizes from offset up to end, skipping
+ * incomplete records
+ *
+ * R: opened archive
+ * offset: offset of first record
+ * end: offset where walk stops
+ * file_size: size of archive file
+ *
+ * returns: offset where walk stopped (end of last record, at least end)
+ *
+ */
+unsigned long _walk_kv_records(kv_archive *R, unsigned long offset,
+                               unsigned long end, unsigned long file_size) {
+  unsigned long next;
+
+  while (offset < end) {
+    if (_read_kv_record(R, offset, file_size, _new_kv_record(R))) {
+      offset += R->records[R->nrecords++].size;
+    } else {
+      next = _next_kv_record(R->file, offset + 1, file_size);
+      if (next > end)
+        next = end;
+      R->skipped += next - offset;
+      offset = next;
+    }
+  }
+
+  return offset;
+}
+
+/*
+ * Function: _read_kv_entry
+ * ------------------------
+ *
+ * Read next entry of index file, checking that it describes a record at
+ * or after offset that fits in archive, and members that fit in record
+ *
+ * index: index file
+ * offset: end of previous record
+ * file_size: size of archive file
+ * record: index entry
+ *
+ * returns: 1 if a valid entry was read, 0 otherwise
+ *
+ */
+int _read_kv_entry(FILE *index, unsigned long offset,
+                   unsigned long file_size, kv_archive_record *record) {
+  int i;
+  unsigned long length, minimum;
+  unsigned char header[KV_ARCHIVE_ENTRY_SIZE];
+  kv_archive_member *member;
+
+  if (fread(header, 1, KV_ARCHIVE_ENTRY_SIZE, index) !=
+          KV_ARCHIVE_ENTRY_SIZE ||
+      memcmp(header, KV_ARCHIVE_ENTRY_MAGIC, 8))
+    return 0;
+
+  record->offset = _load_le(header + 8, 8);
+  record->size = _load_le(header + 16, 8);
+  length = _load_le(header + 24, 4);
+  record->nmembers = _load_le(header + 28, 4);
+  minimum = KV_ARCHIVE_RECORD_SIZE + length +
+            (unsigned long)record->nmembers * KV_ARCHIVE_MEMBER_SIZE;
+  if (record->offset < offset || record->size < minimum ||
+      record->offset > file_size || record->size > file_size - record->offset)
+    return 0;
+
+  record->name = (char *)calloc(length + 1, 1);
+  record->members = (kv_archive_member *)calloc(
+      record->nmembers ? record->nmembers : 1, sizeof(kv_archive_member));
+  if (fread(record->name, 1, length, index) != length)
+    record->nmembers = -1;
+
+  /* Members */
+  for (i = 0; i < record->nmembers; i++) {
+    member = &record->members[i];
+    if (fread(header, 1, KV_ARCHIVE_ENTRY_MEMBER_SIZE, index) !=
+        KV_ARCHIVE_ENTRY_MEMBER_SIZE)
+      break;
+    length = _load_le(header, 4);
+    member->offset = _load_le(header + 8, 8);
+    member->size = _load_le(header + 16, 8);
+    if (member->offset > record->size ||
+        member->size > record->size - member->offset)
+      break;
+    member->offset += record->offset;
+    member->name = (char *)calloc(length + 1, 1);
+    if (fread(member->name, 1, length, index) != length)
+      break;
+  }
+
+  /* Incomplete or invalid entry */
+  if (i != record->nmembers) {
+    _free_kv_record(record);
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Function: open_kv_archive
+ * -------------------------
+ *
+ * Open an archive and index its records, from its index file where it
+ * covers archive and by walking records elsewhere
+ *
+ * filename: archive file
+ *
+ * returns: opened archive or NULL if it is not a valid archive
+ *
+ */
+kv_archive *open_kv_archive(const char *filename) {
+  unsigned long offset, file_size;
+  unsigned char header[KV_ARCHIVE_INDEX_HEADER_SIZE];
+  char *index_name;
+  kv_archive *R;
+  kv_archive_record entry;
+  FILE *file, *index;
+
+  file = fopen(filename, "rb");
+  if (file == NULL)
+    return NULL;
+  if (fread(header, 1, KV_ARCHIVE_HEADER_SIZE, file) !=
+          KV_ARCHIVE_HEADER_SIZE ||
+      memcmp(header, KV_ARCHIVE_MAGIC, 8) ||
+      _load_le(header + 8, 4) != KV_ARCHIVE_VERSION ||
+      fseek(file, 0, SEEK_END)) {
+    fclose(file);
+    return NULL;
+  }
+  file_size = ftell(file);
+
+  R = (kv_archive *)calloc(1, sizeof(kv_archive));
+  R->file = file;
+  offset = KV_ARCHIVE_HEADER_SIZE;
+
+  /* Index file: walk archive bytes written before it, then load entries,
+   * walking gaps between them (records whose entry was lost) */
+  index_name = (char *)malloc(strlen(filename) +
+                              strlen(KV_ARCHIVE_INDEX_SUFFIX) + 1);
+  strcpy(index_name, filename);
+  strcat(index_name, KV_ARCHIVE_INDEX_SUFFIX);
+  index = fopen(index_name, "rb");
+  free(index_name);
+  if (index != NULL) {
+    if (fread(header, 1, KV_ARCHIVE_INDEX_HEADER_SIZE, index) ==
+            KV_ARCHIVE_INDEX_HEADER_SIZE &&
+        !memcmp(header, KV_ARCHIVE_INDEX_MAGIC, 8) &&
+        _load_le(header + 8, 4) == KV_ARCHIVE_VERSION &&
+        _load_le(header + 16, 8) <= file_size) {
+      offset = _walk_kv_records(R, offset, _load_le(header + 16, 8),
+                                file_size);
+      while (_read_kv_entry(index, offset, file_size, &entry)) {
+        if (entry.offset > offset)
+          offset = _walk_kv_records(R, offset, entry.offset, file_size);
+        if (offset > entry.offset) {
+          _free_kv_record(&entry);
+          break;
+        }
+        *_new_kv_record(R) = entry;
+        R->nrecords++;
+        R->indexed++;
+        offset = entry.offset + entry.size;
+      }
+    }
+    fclose(index);
+  }
+
+  /* Records not covered by index file */
+  _walk_kv_records(R, offset, file_size, file_size);
+
+  return R;
+}
+
+/*
+ * Function: find_kv_archive_record
+ * --------------------------------
+ *
+ * Look up a record by name (latest one when a name was appended again)
+ *
+ * R: opened archive
+ * name: record name
+ *
+ * returns: record index or -1 if there is no such record
+ *
+ */
+int find_kv_archive_record(kv_archive *R, const char *name) {
+  int i;
+
+  for (i = R->nrecords - 1; i >= 0; i--)
+    if (!strcmp(R->records[i].name, name))
+      return i;
+
+  return -1;
+}
+
+/*
+ * Function: read_kv_archive_member
+ * --------------------------------
+ *
+ * Read data of a record member
+ *
+ * R: opened archive
+ * record: record index
+ * member: member index
+ *
+ * returns: member data followed by a null byte (free with free) or NULL if
+ * it could not be read
+ *
+ */
+unsigned char *read_kv_archive_member(kv_archive *R, int record, int member) {
+  unsigned char *data;
+  kv_archive_member *m;
+
+  if (record < 0 || record >= R->nrecords || member < 0 ||
+      member >= R->records[record].nmembers)
+    return NULL;
+  m = &R->records[record].members[member];
+
+  data = (unsigned char *)malloc(m->size + 1);
+  if (fseek(R->file, m->offset, SEEK_SET) ||
+      fread(data, 1, m->size, R->file) != m->size) {
+    free(data);
+    return NULL;
+  }
+  data[m->size] = '\0';
+
+  return data;
+}
+
+/*
+ * Function: close_kv_archive
+ * --------------------------
+ *
+ * Close an archive and free its record index
+ *
+ * R: opened archive
+ *
+ */
+void close_kv_archive(kv_archive *R) {
+  int i;
+
+  for (i = 0; i < R->nrecords; i++)
+    _free_kv_record(&R->records[i]);
+  free(R->records);
+  fclose(R->file);
+  free(R);
+}
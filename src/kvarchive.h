@@ -0,0 +1,152 @@
+#ifndef KVARCHIVE_H
+#define KVARCHIVE_H
+
+#include <stdio.h>
+
+/*
+ * Results archive file (--archive <file>)
+ * ---------------------------------------
+ *
+ * Little-endian binary file storing output files of many runs as records
+ * appended at end of file. parKVFinder appends a <base> record holding the
+ * parameters file of each run, then a <base>.structure record (or one
+ * <base>.modelN or <base>.frameN record per model or frame) holding its
+ * results and a <base>.log record holding its log (KVFinder.log):
+ *
+ * header (KV_ARCHIVE_HEADER_SIZE bytes):
+ *   0: magic (KV_ARCHIVE_MAGIC)
+ *   8: uint32 version (KV_ARCHIVE_VERSION), uint32 0
+ * record (KV_ARCHIVE_RECORD_SIZE bytes, then name and members):
+ *   0: magic (KV_ARCHIVE_RECORD_MAGIC)
+ *   8: uint64 record size (header, name and members)
+ *   16: uint32 name length, uint32 nmembers
+ * member (KV_ARCHIVE_MEMBER_SIZE bytes, then name and data):
+ *   0: uint32 name length, uint32 0, uint64 data size
+ *
+ * Each record also gets an entry in an index file next to archive
+ * (<archive>.idx, KV_ARCHIVE_INDEX_SUFFIX), so readers load the index
+ * without reading archive:
+ *
+ * index header (KV_ARCHIVE_INDEX_HEADER_SIZE bytes):
+ *   0: magic (KV_ARCHIVE_INDEX_MAGIC)
+ *   8: uint32 version (KV_ARCHIVE_VERSION), uint32 0
+ *   16: uint64 archive size when index was created (first indexed offset)
+ * entry (KV_ARCHIVE_ENTRY_SIZE bytes, then name and members):
+ *   0: magic (KV_ARCHIVE_ENTRY_MAGIC)
+ *   8: uint64 record offset, 16: uint64 record size
+ *   24: uint32 name length, uint32 nmembers
+ * entry member (KV_ARCHIVE_ENTRY_MEMBER_SIZE bytes, then name):
+ *   0: uint32 name length, uint32 0
+ *   8: uint64 data offset (from record offset), 16: uint64 data size
+ *
+ * Records and their entries are appended whole while holding a write lock
+ * (fcntl) on archive, so processes may append to the same archive
+ * concurrently. Each process must use a single descriptor (fcntl locks are
+ * per process). Readers walk record sizes wherever the index does not
+ * cover archive (archive bytes before index creation, records whose entry
+ * was lost and everything after an invalid entry); a record left
+ * incomplete by a killed writer is skipped, resuming at next record magic.
+ *
+ */
+
+#define KV_ARCHIVE_MAGIC "KVFARC01"
+#define KV_ARCHIVE_RECORD_MAGIC "KVFREC01"
+#define KV_ARCHIVE_INDEX_MAGIC "KVFIDX01"
+#define KV_ARCHIVE_ENTRY_MAGIC "KVFENT01"
+#define KV_ARCHIVE_INDEX_SUFFIX ".idx"
+#define KV_ARCHIVE_VERSION 1
+#define KV_ARCHIVE_HEADER_SIZE 16
+#define KV_ARCHIVE_RECORD_SIZE 24
+#define KV_ARCHIVE_MEMBER_SIZE 16
+#define KV_ARCHIVE_INDEX_HEADER_SIZE 24
+#define KV_ARCHIVE_ENTRY_SIZE 32
+#define KV_ARCHIVE_ENTRY_MEMBER_SIZE 24
+
+/* Structs */
+
+/*
+ * Struct: KV_ARCHIVE_MEMBER
+ * -------------------------
+ *
+ * A struct containing a member (file) of an archive record
+ *
+ * name: member name
+ * offset: offset of member data
+ * size: size of member data
+ *
+ */
+typedef struct KV_ARCHIVE_MEMBER {
+  char *name;
+  unsigned long offset;
+  unsigned long size;
+} kv_archive_member;
+
+/*
+ * Struct: KV_ARCHIVE_RECORD
+ * -------------------------
+ *
+ * A struct containing an index entry of an archive record
+ *
+ * name: record name
+ * offset: offset of record
+ * size: size of record
+ * nmembers: number of members
+ * members: members of record
+ *
+ */
+typedef struct KV_ARCHIVE_RECORD {
+  char *name;
+  unsigned long offset;
+  unsigned long size;
+  int nmembers;
+  kv_archive_member *members;
+} kv_archive_record;
+
+/*
+ * Struct: KV_ARCHIVE
+ * ------------------
+ *
+ * A struct containing an opened archive and its record index
+ *
+ * file: archive file
+ * nrecords: number of records
+ * capacity: room for records
+ * records: record index, in file order
+ * indexed: number of records loaded from index file
+ * skipped: bytes skipped as incomplete records
+ *
+ */
+typedef struct KV_ARCHIVE {
+  FILE *file;
+  int nrecords;
+  int capacity;
+  kv_archive_record *records;
+  int indexed;
+  unsigned long skipped;
+} kv_archive;
+
+/* Results archive encoding */
+void _store_le(unsigned char *bytes, unsigned long value, int size);
+unsigned long _load_le(unsigned char *bytes, int size);
+int _write_all(int fd, unsigned char *buffer, unsigned long size);
+int append_kv_archive(int fd, int index_fd, const char *name, int nmembers,
+                      char **names, unsigned char **data,
+                      unsigned long *sizes);
+
+/* Results archive decoding */
+void _free_kv_record(kv_archive_record *record);
+int _read_kv_record(kv_archive *R, unsigned long offset,
+                    unsigned long file_size, kv_archive_record *record);
+unsigned long _next_kv_record(FILE *file, unsigned long offset,
+                              unsigned long file_size);
+kv_archive_record *_new_kv_record(kv_archive *R);
+unsigned long _walk_kv_records(kv_archive *R, unsigned long offset,
+                               unsigned long end, unsigned long file_size);
+int _read_kv_entry(FILE *index, unsigned long offset,
+                   unsigned long file_size, kv_archive_record *record);
+kv_archive *open_kv_archive(const char *filename);
+int find_kv_archive_record(kv_archive *R, const char *name);
+unsigned char *read_kv_archive_member(kv_archive *R, int record, int member);
+void close_kv_archive(kv_archive *R);
+
+#endif
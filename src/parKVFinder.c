@@ -4,8 +4,11 @@ according to the user definitions. A brief explanation of the most important
 parts may be found in the source code */
 
 /* Import builtin modules */
+#define _GNU_SOURCE
+#include <fcntl.h>
 #include <math.h>
 #include <omp.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,9 +22,433 @@ parts may be found in the source code */
 /* WARNING: keep this importing order */
 #include "argparser.h"
 #include "fileprocessing.h"
+#include "gridoutput.h"
 #include "gridprocessing.h"
+#include "trajectory.h"
 #include "utils.h"
 
+/* Voxels per thread below which voxel-level threads hardly scale */
+#define FRAME_SCHEDULE_VOXELS (1 << 21)
+
+/*
+ * Struct: FRAME_RECORD
+ * --------------------
+ *
+ * Header of a frame log written by a worker process
+ *
+ * frame: frame index
+ * ncav: number of cavities of frame
+ * size: length of frame log in bytes
+ *
+ */
+typedef struct FRAME_RECORD {
+  int frame;
+  int ncav;
+  size_t size;
+} frame_record;
+
+/*
+ * Function: frame_workers
+ * -----------------------
+ *
+ * Choose between running whole frames concurrently (one worker process per
+ * frame, each with its own grids) and running frames one at a time with
+ * voxel-level threads, based on grid size and core count. An explicit frame
+ * schedule runs at least two workers (sharing cores if needed), unless their
+ * grids do not fit in memory, which is warned about.
+ *
+ * schedule: requested schedule (auto, frames or voxels)
+ * nframes: number of frames (models or trajectory frames)
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * metrics_mode: whether M and HP grids are skipped
+ *
+ * returns: number of worker processes or 0 for voxel-level threads
+ *
+ */
+int frame_workers(int schedule, int nframes, int m, int n, int o,
+                  int metrics_mode) {
+  int ncores = omp_get_num_procs() - 1, nworkers;
+  double voxels = (double)m * n * o, memory, grids;
+
+  if (schedule == VOXEL_SCHEDULE || nframes < 2)
+    return 0;
+
+  /* Automatic schedule keeps voxel-level threads for large grids */
+  if (schedule == AUTO_SCHEDULE &&
+      (ncores < 2 || voxels >= (double)FRAME_SCHEDULE_VOXELS * ncores))
+    return 0;
+
+  nworkers = ncores < nframes ? ncores : nframes;
+  if (nworkers < 2)
+    nworkers = 2;
+
+  /* Grids of all workers (A, S, N, M and HP) fit in half of memory */
+  memory = (double)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE) / 2;
+  grids = voxels * 3 * sizeof(int);
+  if (!metrics_mode)
+    grids += voxels * 2 * sizeof(double);
+  if (memory > 0 && nworkers * grids > memory)
+    nworkers = (int)(memory / grids);
+
+  if (nworkers < 2) {
+    fprintf(stderr, "Warning: Grids of two frames do not fit in memory, "
+                    "running frames one at a time!\n");
+    return 0;
+  }
+  return nworkers;
+}
+
+/*
+ * Function: run_frame_workers
+ * ---------------------------
+ *
+ * Run frames in worker processes and append their frame logs to log file
+ * in frame order. Workers restart this program with a trailing hidden
+ * option (--worker <index>:<workers>:<fd>), since the OpenMP runtime can not
+ * be used after fork, and each one gets a share of the cores. Worker index
+ * w runs frames w, w + nworkers, ..., writing a frame_record and frame log
+ * per frame to file descriptor fd.
+ *
+ * argc: number of command line arguments
+ * argv: command line arguments
+ * nworkers: number of worker processes
+ * nframes: number of frames
+ * ensemble_mode: whether frames are models of an ensemble
+ * log_file: log file
+ *
+ */
+void run_frame_workers(int argc, char **argv, int nworkers, int nframes,
+                       int ensemble_mode, FILE *log_file) {
+  int w, c, i, ncpus, *list, status, failed = 0, frame, devnull;
+  char **args, option[64], *text;
+  cpu_set_t available, *cpus;
+  pid_t *pids;
+  FILE **logs;
+  frame_record record;
+
+  /* Share available cores among workers, round robin (workers share cores
+   * when there are fewer cores than workers) */
+  CPU_ZERO(&available);
+  sched_getaffinity(0, sizeof(cpu_set_t), &available);
+  ncpus = CPU_COUNT(&available);
+  list = (int *)malloc((ncpus + 1) * sizeof(int));
+  for (c = 0, i = 0; c < CPU_SETSIZE; c++)
+    if (CPU_ISSET(c, &available))
+      list[i++] = c;
+  cpus = (cpu_set_t *)calloc(nworkers, sizeof(cpu_set_t));
+  for (i = 0; ncpus > 0 && i < (ncpus > nworkers ? ncpus : nworkers); i++)
+    CPU_SET(list[i % ncpus], &cpus[i % nworkers]);
+
+  args = (char **)malloc((argc + 3) * sizeof(char *));
+  memcpy(args, argv, argc * sizeof(char *));
+  args[argc] = "--worker";
+  args[argc + 1] = option;
+  args[argc + 2] = NULL;
+
+  pids = (pid_t *)malloc(nworkers * sizeof(pid_t));
+  logs = (FILE **)malloc(nworkers * sizeof(FILE *));
+  devnull = open("/dev/null", O_WRONLY);
+  fflush(stdout);
+  fflush(log_file);
+
+  for (w = 0; w < nworkers; w++) {
+    logs[w] = tmpfile();
+    snprintf(option, 64, "%d:%d:%d", w, nworkers, fileno(logs[w]));
+    pids[w] = fork();
+    if (pids[w] == 0) {
+      if (ncpus > 0)
+        sched_setaffinity(0, sizeof(cpu_set_t), &cpus[w]);
+      dup2(devnull, STDOUT_FILENO);
+      execv("/proc/self/exe", args);
+      execvp(argv[0], args);
+      _exit(127);
+    } else if (pids[w] < 0) {
+      fprintf(stderr, "\033[0;31mError:\033[0m Could not start worker "
+                      "process!\n");
+      exit(-1);
+    }
+  }
+
+  for (w = 0; w < nworkers; w++) {
+    waitpid(pids[w], &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      failed = 1;
+    rewind(logs[w]);
+  }
+  if (failed) {
+    fprintf(stderr, "\033[0;31mError:\033[0m A worker process failed!\n");
+    exit(-1);
+  }
+
+  /* Frame logs in frame order */
+  for (frame = 0; frame < nframes; frame++) {
+    w = frame % nworkers;
+    if (fread(&record, sizeof(frame_record), 1, logs[w]) != 1 ||
+        record.frame != frame) {
+      fprintf(stderr,
+              "\033[0;31mError:\033[0m Missing results of %s %d!\n",
+              ensemble_mode ? "model" : "frame", frame + 1);
+      exit(-1);
+    }
+    text = (char *)malloc(record.size + 1);
+    if (fread(text, 1, record.size, logs[w]) != record.size) {
+      fprintf(stderr,
+              "\033[0;31mError:\033[0m Missing results of %s %d!\n",
+              ensemble_mode ? "model" : "frame", frame + 1);
+      exit(-1);
+    }
+    fwrite(text, 1, record.size, log_file);
+    free(text);
+
+    if (record.ncav == 0)
+      fprintf(stdout, "> parKVFinder found no cavities in %s %d!\n",
+              ensemble_mode ? "model" : "frame", frame + 1);
+  }
+
+  for (w = 0; w < nworkers; w++)
+    fclose(logs[w]);
+  close(devnull);
+  free(logs);
+  free(pids);
+  free(args);
+  free(list);
+  free(cpus);
+}
+
+/*
+ * Function: detect_cavities
+ * -------------------------
+ *
+ * Detect and characterize cavities of a frame (atom table) on allocated
+ * grids, then write its cavity PDB and results files (only results file in
+ * metrics only mode)
+ *
+ * A: cavities 3D grid (filled with 1)
+ * S: surface points 3D grid (filled with 1)
+ * N: nearest atom 3D grid
+ * M: depth 3D grid (filled with 0.0)
+ * HP: hydropathy 3D grid (filled with 0.0)
+ * L: ligand mask (NULL when ligand mode is off)
+ * m: x grid units
+ * n: y grid units
+ * o: z grid units
+ * h: grid spacing (step)
+ * probe_in: Probe In size
+ * probe_out: Probe Out size
+ * removal_distance: length removed from cavities-bulk frontier
+ * volume_cutoff: cavities volume filter
+ * surface_mode: SES (1) or SAS (0) surface
+ * box_mode: whether a custom search box is applied
+ * kvp_mode: filled (1) or filtered (0) cavities
+ * X1, Y1, Z1: coordinates of P1
+ * bX1, bY1, bZ1, bX2, bY2, bZ2: coordinates of search box vertices
+ * norm1: grid length along x axis
+ * pdb_name: path to target PDB file
+ * output: output path without suffixes
+ * output_pdb: path to cavity PDB file
+ * output_results: path to results file
+ * LIGAND_NAME: path to target ligand PDB file
+ * grid_format: volumetric grid output format (NO_GRID, CCP4_GRID, DX_GRID,
+ * NPY_GRID, NPZ_GRID, RLE8_GRID or RLE16_GRID)
+ * mesh_format: cavity surface mesh output format (NO_MESH, PLY_MESH or
+ * OBJ_MESH)
+ * metrics_mode: whether only results file is written (M and HP are NULL)
+ * results_format: JSONL_RESULTS and/or CSV_RESULTS flags of per-cavity
+ * results files (0 for TOML results file only)
+ * archive_mode: whether output files are moved into a results archive (results
+ * file then refers to cavity PDB file by its member name)
+ * top_k: number of largest cavities kept after clustering (0 keeps all)
+ * min_depth: minimum depth of cavities kept after depth estimation
+ * near_residues: residues of which cavities kept after interface residues
+ * retrieval need at least one (NULL keeps all)
+ * nnear: number of near residues
+ * verbose_flag: whether to print progress
+ *
+ * returns: number of cavities (after selection)
+ *
+ */
+int detect_cavities(int ***A, int ***S, int ***N, double ***M, double ***HP,
+                    unsigned char *L, int m, int n, int o, double h,
+                    double probe_in, double probe_out, double removal_distance,
+                    double volume_cutoff, int surface_mode, int box_mode,
+                    int kvp_mode, double X1, double Y1, double Z1, double bX1,
+                    double bY1, double bZ1, double bX2, double bY2, double bZ2,
+                    double norm1, char *pdb_name, char *output,
+                    char *output_pdb, char *output_results,
+                    char LIGAND_NAME[500], int grid_format, int mesh_format,
+                    int metrics_mode, int results_format, int archive_mode,
+                    int top_k, double min_depth, residues_info *near_residues,
+                    int nnear, int verbose_flag) {
+  int ncav, i;
+
+  if (verbose_flag)
+    fprintf(stdout, "> Filling grid with probe in surface\n");
+  /* Mark the grid with 0, leaving a small probe size around the protein */
+  SAS(A, m, n, o, h, probe_in, X1, Y1, Z1);
+
+  /* Mark space occupied by a small probe size from protein surface */
+  if (surface_mode) {
+    SES(A, m, n, o, h, probe_in);
+  }
+
+  if (verbose_flag)
+    fprintf(stdout, "> Filling grid with probe out surface\n");
+  /* Mark the grid with 0, leaving a big probe size around the protein */
+  SAS(S, m, n, o, h, probe_out, X1, Y1, Z1);
+  /* Mark space occupied by a big probe size from protein surface */
+  SES(S, m, n, o, h, probe_out);
+
+  if (verbose_flag)
+    fprintf(stdout, "> Defining biomolecular cavities\n");
+  /* Mark points where small probe passed and big probe did not */
+  subtract(A, S, m, n, o, h, removal_distance);
+
+  /* Ligand adjustment mode */
+  if (L != NULL) {
+    if (verbose_flag)
+      fprintf(stdout, "> Adjusting ligand\n");
+    /* Mark regions that do not belong to ligand_cutoff */
+    apply_ligand_mask(A, L, m, n, o);
+  }
+
+  /* The points outside the user defined search space are excluded here */
+  if (box_mode) {
+    if (verbose_flag)
+      fprintf(stdout, "> Filtering grid points\n");
+
+    filter2box(A, m, n, o, h, bX1, bY1, bZ1, bX2, bY2, bZ2, norm1);
+  }
+
+  /*Remove outlier points*/
+  filter_noise(A, m, n, o);
+
+  /* Grouping Cavities and calculating Volume and */
+  if (verbose_flag)
+    fprintf(stdout, "> Clustering cavities and calculating volume\n");
+  ncav = clustering(A, m, n, o, h, volume_cutoff);
+
+  if (ncav > 0) {
+    /* Create KVFinder_results structure */
+    KVFinder_results = (KVresults *)calloc(ncav, sizeof(KVresults));
+    cavity = (coords *)calloc(ncav, sizeof(coords));
+    boundary = (coords *)calloc(ncav, sizeof(coords));
+
+    /* Pass volume to KVFinder_results structure */
+    node *p;
+    for (p = V; p != NULL; p = p->next)
+      KVFinder_results[(p->pos)].volume = p->volume;
+    free_node();
+
+    /* Keep largest cavities */
+    if (top_k > 0) {
+      if (verbose_flag)
+        fprintf(stdout, "> Selecting %d largest cavities\n", top_k);
+      ncav = keep_largest_cavities(A, NULL, m, n, o, ncav, top_k);
+    }
+
+    /* Defining surface points and calculating area*/
+    if (verbose_flag)
+      fprintf(stdout, "> Defining surface points and calculating area\n");
+    filter_surface(A, S, m, n, o);
+    area(S, m, n, o, h, ncav);
+
+    /* Map closest atom of each cavity point and atom-cavity contacts */
+    if (verbose_flag)
+      fprintf(stdout, "> Mapping atoms surrounding cavities\n");
+    map_atoms(A, N, m, n, o, h, probe_in, X1, Y1, Z1);
+
+    /* Define interface residues for each cavity */
+    if (verbose_flag)
+      fprintf(stdout, "> Retrieving interface residues\n");
+    interface();
+
+    /* Keep cavities near residues */
+    if (near_residues != NULL) {
+      if (verbose_flag)
+        fprintf(stdout, "> Selecting cavities near residues\n");
+      ncav = keep_cavities_near_residues(A, S, m, n, o, ncav, near_residues,
+                                         nnear);
+    }
+  }
+
+  if (ncav > 0) {
+    /* Computing depth */
+    if (verbose_flag)
+      fprintf(stdout,
+              "> Defining cavity-bulk boundary and calculating depth\n");
+    filter_boundary(A, m, n, o, ncav);
+    depth(A, M, m, n, o, h, ncav);
+
+    /* Keep deep cavities */
+    if (min_depth > 0.0) {
+      if (verbose_flag)
+        fprintf(stdout, "> Selecting cavities by depth\n");
+      ncav = keep_deep_cavities(A, S, m, n, o, ncav, min_depth);
+    }
+  }
+
+  if (ncav > 0) {
+    /* Computing hydropathy */
+    if (verbose_flag)
+      fprintf(stdout, "> Mapping hydrophobicity scale at surface points\n");
+    if (!metrics_mode)
+      project_hydropathy(HP, S, N, m, n, o);
+    if (verbose_flag)
+      fprintf(stdout, "> Estimating average hydropathy\n");
+    estimate_average_hydropathy(HP, S, N, m, n, o, ncav);
+
+    /* Turn ON(1) filled cavities option */
+    if (!metrics_mode) {
+      if (verbose_flag)
+        fprintf(stdout, "> Writing cavities PDB file\n");
+      /* Export Cavities PDB */
+      export(output_pdb, A, S, M, HP, kvp_mode, m, n, o, h, ncav, X1, Y1,
+             Z1);
+    }
+
+    /* Export volumetric grids */
+    if (grid_format != NO_GRID) {
+      if (verbose_flag)
+        fprintf(stdout, "> Writing cavity grid files\n");
+      export_grids(output, A, S, M, HP, m, n, o, h, ncav, X1, Y1, Z1,
+                   grid_format);
+    }
+
+    /* Export cavity surface meshes */
+    if (mesh_format != NO_MESH) {
+      if (verbose_flag)
+        fprintf(stdout, "> Writing cavity mesh file\n");
+      export_meshes(output, A, m, n, o, h, ncav, X1, Y1, Z1, mesh_format);
+    }
+
+    /* Write results file */
+    if (verbose_flag)
+      fprintf(stdout, "> Writing results file\n");
+    write_results(output_results, pdb_name,
+                  metrics_mode   ? "-"
+                  : archive_mode ? strrchr(output_pdb, '/') + 1
+                                 : output_pdb,
+                  LIGAND_NAME, h, ncav);
+    if (results_format)
+      write_results_records(output, results_format, pdb_name, ncav);
+  }
+
+  /* Free results of frame */
+  for (i = 0; i < ncav; i++)
+    free(KVFinder_results[i].res_info);
+  free(KVFinder_results);
+  KVFinder_results = NULL;
+
+  free(cavity);
+  free(boundary);
+  cavity = NULL;
+  boundary = NULL;
+
+  return ncav;
+}
+
 /* Main function */
 int main(int argc, char **argv) {
 
@@ -44,22 +471,41 @@ int main(int argc, char **argv) {
   double h, probe_in, probe_out, volume_cutoff, ligand_cutoff, removal_distance,
       norm1, norm2, norm3, Vvoxel, multiple;
   double X1, Y1, Z1, X2, Y2, Z2, X3, Y3, Z3, X4, Y4, Z4;
+  double lX1, lY1, lZ1, lX2, lY2, lZ2, margin, min_depth = 0.0;
   double bX1, bY1, bZ1, bX2, bY2, bZ2, bX3, bY3, bZ3, bX4, bY4, bZ4;
   int ligand_mode, surface_mode, whole_protein_mode, resolution_mode, box_mode,
-      kvp_mode;
+      kvp_mode, ensemble_mode = 0, trajectory_mode = 0,
+      schedule = AUTO_SCHEDULE, grid_format = NO_GRID, mesh_format = NO_MESH,
+      metrics_mode = 0, results_format = 0, top_k = 0, nnear = 0,
+      archive = -1, archive_index = -1;
   static int verbose_flag = 0;
-  int m, n, o, i, j, k, ncav, tablesize;
-  char TABLE[500][4], PDB_NAME[500], LIGAND_NAME[500], dictionary_name[500],
-      OUTPUT[500], BASE_NAME[500];
+  int m, n, o, i, j, k, ncav, frame, nframes, worker = -1, nworkers = 0,
+      worker_fd;
+  char PDB_NAME[500], LIGAND_NAME[500], TRAJECTORY_NAME[500],
+      NEAR_RESIDUES[500] = "", ARCHIVE_NAME[500] = "", dictionary_name[500],
+      OUTPUT[500], BASE_NAME[500], frame_name[600], archive_folder[600];
   char boxmode_flag[6], resolution_flag[7], whole_protein_flag[6], mode_flag[6],
       surface_flag[6], step_flag[6], kvpmode_flag[6];
   char log_buffer[4096], *output, *output_folder, *output_pdb, *output_results,
-      *pdb_name;
-  vdw *DIC[500];
-  FILE *parameters_file, *log_file;
-  atom *p;
-  int ***A, ***S;
+      *pdb_name, *frame_text, *log_text;
+  size_t frame_size, log_size;
+  FILE *parameters_file, *log_file, *frame_log, *worker_file = NULL;
+  frame_record record;
+  structure *pdb, *topology = NULL;
+  pdb_atom *q;
+  trajectory *T;
+  int ***A, ***S, ***N;
   double ***M, ***HP;
+  unsigned char *L;
+  residues_info *near_residues;
+
+  /* Worker process of frame schedule: trailing hidden option set by
+   * run_frame_workers */
+  if (argc > 2 && !strcmp(argv[argc - 2], "--worker")) {
+    sscanf(argv[argc - 1], "%d:%d:%d", &worker, &nworkers, &worker_fd);
+    worker_file = fdopen(worker_fd, "w");
+    argc -= 2;
+  }
 
   if (argc == 1) {
     /* Check if parameters.toml exists */
@@ -124,12 +570,16 @@ int main(int argc, char **argv) {
   } else {
     /* Save command line arguments inside KVFinder variables */
     verbose_flag =
-        argparser(argc, argv, &box_mode, &kvp_mode, &ligand_mode, &surface_mode,
-                  &whole_protein_mode, PDB_NAME, LIGAND_NAME, dictionary_name,
-                  OUTPUT, BASE_NAME, resolution_flag, &h, &probe_in, &probe_out,
-                  &volume_cutoff, &ligand_cutoff, &removal_distance, &X1, &Y1,
-                  &Z1, &X2, &Y2, &Z2, &X3, &Y3, &Z3, &X4, &Y4, &Z4, &bX1, &bY1,
-                  &bZ1, &bX2, &bY2, &bZ2, &bX3, &bY3, &bZ3, &bX4, &bY4, &bZ4);
+        argparser(argc, argv, worker, &box_mode, &kvp_mode, &ligand_mode,
+                  &surface_mode, &whole_protein_mode, &ensemble_mode,
+                  &trajectory_mode, &schedule, &grid_format, &mesh_format,
+                  &metrics_mode, &results_format, &top_k, PDB_NAME,
+                  LIGAND_NAME, TRAJECTORY_NAME, NEAR_RESIDUES, ARCHIVE_NAME,
+                  dictionary_name, OUTPUT, BASE_NAME, resolution_flag, &h,
+                  &probe_in, &probe_out, &volume_cutoff, &ligand_cutoff,
+                  &removal_distance, &min_depth, &X1, &Y1, &Z1, &X2, &Y2,
+                  &Z2, &X3, &Y3, &Z3, &X4, &Y4, &Z4, &bX1, &bY1, &bZ1, &bX2,
+                  &bY2, &bZ2, &bX3, &bY3, &bZ3, &bX4, &bY4, &bZ4);
   }
   /* Set step size (h) and resolution_mode */
   if (!strcmp(resolution_flag, "Off"))
@@ -140,12 +590,9 @@ int main(int argc, char **argv) {
   }
 
   /* Load vdW dictionary */
-  tablesize = _get_residues_information(
-      dictionary_name,
-      TABLE); /*Read dictionary file and return number of residues*/
   if (verbose_flag)
     fprintf(stdout, "> Loading atomic dictionary file\n");
-  read_vdw(dictionary_name, DIC, tablesize); /*Dictionary Loaded*/
+  read_vdw(dictionary_name); /*Dictionary Loaded*/
 
   /* Preparing files paths */
   if (OUTPUT[strlen(OUTPUT) - 1] == '/') {
@@ -160,20 +607,45 @@ int main(int argc, char **argv) {
   }
   pdb_name = realpath(PDB_NAME, NULL);
 
-  /* Create KV_Files folder */
-  mkdir(output, S_IRWXU);
+  /* Create KV_Files folder (not used in archive mode) */
+  if (!ARCHIVE_NAME[0])
+    mkdir(output, S_IRWXU);
 
-  /* Create log_file */
-  log_file = fopen(_combine(output, "KVFinder.log"),
-                   "a+"); /* Open log file and append information */
-  memset(log_buffer, '\0', sizeof(log_buffer)); /* Create buffer */
-  setvbuf(log_file, log_buffer, _IOFBF,
-          4096); /* Define buffer as writing buffer of size 4096 */
+  /* Create log_file (workers send frame logs to their parent instead, and
+   * log of archive mode is appended to results archive at the end) */
+  if (worker < 0 && ARCHIVE_NAME[0]) {
+    log_file = open_memstream(&log_text, &log_size);
+  } else {
+    if (worker >= 0)
+      log_file = fopen("/dev/null", "w");
+    else
+      log_file = fopen(_combine(output, "KVFinder.log"),
+                       "a+"); /* Open log file and append information */
+    memset(log_buffer, '\0', sizeof(log_buffer)); /* Create buffer */
+    setvbuf(log_file, log_buffer, _IOFBF,
+            4096); /* Define buffer as writing buffer of size 4096 */
+  }
 
-  /* Create BASE_NAME folder for the running analysis */
-  output =
-      _combine(output, BASE_NAME); /* Include BASE_NAME folder in KV_Files */
-  mkdir(output, S_IRWXU);          /* Create BASE_NAME folder in KV_Files */
+  /* Archive mode: output files are written to a private temporary folder
+   * and moved into results archive after each model or frame */
+  if (ARCHIVE_NAME[0]) {
+    archive = open_archive(ARCHIVE_NAME, &archive_index);
+    snprintf(archive_folder, sizeof(archive_folder), "%s/parKVFinder.XXXXXX",
+             getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+    if (mkdtemp(archive_folder) == NULL) {
+      fprintf(stderr, "\033[0;31mError:\033[0m Could not create temporary "
+                      "folder: %s\n",
+              archive_folder);
+      exit(-1);
+    }
+    output = archive_folder;
+    fprintf(log_file, "Archive: %s\n", ARCHIVE_NAME);
+  } else {
+    /* Create BASE_NAME folder for the running analysis */
+    output =
+        _combine(output, BASE_NAME); /* Include BASE_NAME folder in KV_Files */
+    mkdir(output, S_IRWXU);          /* Create BASE_NAME folder in KV_Files */
+  }
   output_folder =
       _combine(output, "/"); /* Include bar after appending BASE_NAME */
   output = _combine(
@@ -188,6 +660,19 @@ int main(int argc, char **argv) {
       output,
       ".KVFinder.output.pdb"); /* Create a output path to output PDB file */
 
+  /* Parameters file of archive mode, appended as <base> record of run */
+  if (archive >= 0 && worker < 0) {
+    write_parameters(
+        _combine(_combine(_combine(output_folder, "parameters_"), BASE_NAME),
+                 ".toml"),
+        OUTPUT, BASE_NAME, dictionary_name, PDB_NAME, LIGAND_NAME,
+        whole_protein_mode, resolution_flag, box_mode, surface_mode, kvp_mode,
+        ligand_mode, h, probe_in, probe_out, volume_cutoff, ligand_cutoff,
+        removal_distance, X1, Y1, Z1, X2, Y2, Z2, X3, Y3, Z3, X4, Y4, Z4, bX1,
+        bY1, bZ1, bX2, bY2, bZ2, bX3, bY3, bZ3, bX4, bY4, bZ4);
+    write_archive_record(archive, archive_index, BASE_NAME, archive_folder);
+  }
+
   /* Print in shell the PDB path that is running in KVFinder */
   if (!verbose_flag)
     fprintf(stdout, "[PID %u] Running parKVFinder for: %s\n", getpid(),
@@ -209,6 +694,17 @@ int main(int argc, char **argv) {
   else
     fprintf(log_file, "Resolution: %s\n", resolution_flag);
 
+  /* Trajectory mode: topology is parsed once and frames are read one at a
+   * time, moving topology atoms */
+  T = NULL;
+  if (trajectory_mode) {
+    if (verbose_flag)
+      fprintf(stdout, "> Opening trajectory\n");
+    topology = load_structure(PDB_NAME);
+    T = open_trajectory(TRAJECTORY_NAME, topology->natoms);
+    fprintf(log_file, "Trajectory: %s\n", TRAJECTORY_NAME);
+  }
+
   if (verbose_flag)
     fprintf(stdout, "> Calculating grid dimensions\n");
 
@@ -221,29 +717,28 @@ int main(int argc, char **argv) {
     Y3 = -999999;
     Z4 = -999999;
 
-    /* Create a linked list (dictionary) for PDB file | saves only position
-     * (x,y,z) and chain */
-    soft_read_pdb(PDB_NAME, 0, 0);
-
-    /*Reduces box to protein size*/
-    for (p = v; p != NULL; p = p->next) {
-
-      if (p->x < X1)
-        X1 = (p->x);
-      if (p->y < Y1)
-        Y1 = (p->y);
-      if (p->z < Z1)
-        Z1 = (p->z);
-      if (p->x > X2)
-        X2 = (p->x);
-      if (p->y > Y3)
-        Y3 = (p->y);
-      if (p->z > Z4)
-        Z4 = (p->z);
-    }
+    /* Get parsed PDB, shared with the steps reading it later */
+    pdb = load_structure(PDB_NAME);
 
-    /* Free van der Waals radius dictionary from memory */
-    _free_atom();
+    /*Reduces box to protein size (in every frame of a trajectory)*/
+    if (trajectory_mode)
+      trajectory_box(T, &X1, &Y1, &Z1, &X2, &Y3, &Z4);
+    else
+      for (q = pdb->atoms; q < pdb->atoms + pdb->natoms; q++) {
+
+        if (q->x < X1)
+          X1 = (q->x);
+        if (q->y < Y1)
+          Y1 = (q->y);
+        if (q->z < Z1)
+          Z1 = (q->z);
+        if (q->x > X2)
+          X2 = (q->x);
+        if (q->y > Y3)
+          Y3 = (q->y);
+        if (q->z > Z4)
+          Z4 = (q->z);
+      }
 
     /* Prepare vertices */
     X1 = X1 - probe_out - h;
@@ -259,6 +754,50 @@ int main(int argc, char **argv) {
     Z2 = Z1;
     Z3 = Z1;
 
+    /* Restrict grid to ligand neighbourhood, keeping the points of the whole
+     * protein grid. Cavities within ligand cutoff depend on Probe Out
+     * centers within Probe Out of them, which depend on atoms within Probe
+     * Out plus atomic radius of those centers */
+    if (ligand_mode) {
+      pdb = load_structure(LIGAND_NAME);
+
+      if (pdb->natoms > 0) {
+        lX1 = lX2 = pdb->atoms[0].x;
+        lY1 = lY2 = pdb->atoms[0].y;
+        lZ1 = lZ2 = pdb->atoms[0].z;
+        for (q = pdb->atoms; q < pdb->atoms + pdb->natoms; q++) {
+          lX1 = min(lX1, q->x);
+          lY1 = min(lY1, q->y);
+          lZ1 = min(lZ1, q->z);
+          lX2 = max(lX2, q->x);
+          lY2 = max(lY2, q->y);
+          lZ2 = max(lZ2, q->z);
+        }
+
+        /* Largest van der Waals radius */
+        margin = max_vdw_radius() + ligand_cutoff + 2 * probe_out +
+                 removal_distance + 2 * h;
+
+        /* Snap lower corner to grid points */
+        lX1 = X1 + h * max(floor((lX1 - margin - X1) / h), 0.0);
+        lY1 = Y1 + h * max(floor((lY1 - margin - Y1) / h), 0.0);
+        lZ1 = Z1 + h * max(floor((lZ1 - margin - Z1) / h), 0.0);
+        lX2 = min(lX2 + margin, X2);
+        lY2 = min(lY2 + margin, Y3);
+        lZ2 = min(lZ2 + margin, Z4);
+
+        /* Ligand neighbourhood inside protein grid */
+        if (lX1 < lX2 && lY1 < lY2 && lZ1 < lZ2) {
+          X1 = X3 = X4 = lX1;
+          Y1 = Y2 = Y4 = lY1;
+          Z1 = Z2 = Z3 = lZ1;
+          X2 = lX2;
+          Y3 = lY2;
+          Z4 = lZ2;
+        }
+      }
+    }
+
     fprintf(log_file, "p1: [%.3lf %.3lf %.3lf]\n", X1, Y1, Z1);
     fprintf(log_file, "p2: [%.3lf %.3lf %.3lf]\n", X2, Y1, Z1);
     fprintf(log_file, "p3: [%.3lf %.3lf %.3lf]\n", X1, Y3, Z1);
@@ -330,152 +869,200 @@ int main(int argc, char **argv) {
   fprintf(log_file, "sina: %.2lf\tsinb: %.2lf\t\ncosa: %.2lf\tcosb: %.2lf\n",
           sina, sinb, cosa, cosb);
 
-  if (verbose_flag)
-    fprintf(stdout, "> Reading PDB coordinates\n");
-
-  /* Protein Coordinates Extraction */
-  /* Create a linked list for PDB information */
-  /* Save coordinates (x,y,z), atom radius, residue number and chain */
-  if (read_pdb(PDB_NAME, DIC, tablesize, TABLE, probe_in, m, n, o, h, X1, Y1,
-               Z1, &log_file)) {
-
+  /* Ligand adjustment mode: ligand mask is built once on the fixed grid */
+  L = NULL;
+  if (ligand_mode) {
     if (verbose_flag)
-      fprintf(stdout, "> Creating grid\n");
-
-    /* Matrix Allocation and Initialization */
-    /* int ***A: Grid representing empty spaces and surface points along marked
-    by small probe int ***S: Grid representing empty spaces and surface points
-    along marked by big probe double ***M: Grid representing depth in each
-    cavity point */
-    A = igrid(m, n, o);
-    S = igrid(m, n, o);
-    M = dgrid(m, n, o);
-    HP = dgrid(m, n, o);
+      fprintf(stdout, "> Reading ligand coordinates\n");
+    read_pdb(LIGAND_NAME, probe_in, m, n, o, h, X1, Y1, Z1, &log_file);
+    /* Mark regions that belong to ligand_cutoff */
+    L = ligand_mask(m, n, o, h, ligand_cutoff, X1, Y1, Z1);
+    _free_atom();
+  }
 
-    if (verbose_flag)
-      fprintf(stdout, "> Filling grid with probe in surface\n");
-    /* Mark the grid with 0, leaving a small probe size around the protein */
-    SAS(A, m, n, o, h, probe_in, X1, Y1, Z1);
+  /* Cavity selection: residues list is read once for every frame */
+  near_residues = NULL;
+  if (NEAR_RESIDUES[0]) {
+    near_residues = read_residues_list(NEAR_RESIDUES, &nnear);
+    fprintf(log_file, "Near residues: %s\n", NEAR_RESIDUES);
+  }
+  if (top_k)
+    fprintf(log_file, "Top k: %d\n", top_k);
+  if (min_depth > 0.0)
+    fprintf(log_file, "Minimum depth: %.2lf\n", min_depth);
 
-    /* Mark space occupied by a small probe size from protein surface */
-    if (surface_mode) {
-      SES(A, m, n, o, h, probe_in);
+  /* Ensemble mode: one frame per model on the grid of the whole ensemble */
+  nframes = 1;
+  if (ensemble_mode) {
+    nframes = load_structure(PDB_NAME)->nmodels;
+    fprintf(log_file, "Models: %d\n", nframes);
+    if (nframes == 0) {
+      fprintf(stdout, "> No models found, running for the whole structure\n");
+      nframes = 1;
+      ensemble_mode = 0;
     }
+  }
+  if (trajectory_mode) {
+    nframes = count_frames(T);
+    fprintf(log_file, "Frames: %d\n", nframes);
+  }
 
-    if (verbose_flag)
-      fprintf(stdout, "> Filling grid with probe out surface\n");
-    /* Mark the grid with 0, leaving a big probe size around the protein */
-    SAS(S, m, n, o, h, probe_out, X1, Y1, Z1);
-    /* Mark space occupied by a big probe size from protein surface */
-    SES(S, m, n, o, h, probe_out);
+  /* Schedule: whole frames in concurrent workers or voxel-level threads */
+  if (worker < 0) {
+    nworkers = frame_workers(schedule, nframes, m, n, o, metrics_mode);
+    if (nworkers > 0)
+      fprintf(log_file, "Schedule: frames (%d workers)\n", nworkers);
+    else if (nframes > 1)
+      fprintf(log_file, "Schedule: voxels\n");
+  }
 
+  /* Whole frames run concurrently in worker processes */
+  if (worker < 0 && nworkers > 0) {
     if (verbose_flag)
-      fprintf(stdout, "> Defining biomolecular cavities\n");
-    /* Mark points where small probe passed and big probe did not */
-    subtract(A, S, m, n, o, h, removal_distance);
+      fprintf(stdout, "> Running %d frames in %d worker processes\n",
+              nframes, nworkers);
+    run_frame_workers(argc, argv, nworkers, nframes, ensemble_mode, log_file);
+  } else {
 
-    /* Ligand adjustment mode */
-    if (ligand_mode) {
-      if (verbose_flag)
-        fprintf(stdout, "> Adjusting ligand\n");
-      /* Free linked list (dictionary) from memory */
-      _free_atom();
-      /* Creates a linked list for Ligand information* | saves position (x,y,z),
-       * atom radius, resnumber, chain */
-      read_pdb(LIGAND_NAME, DIC, tablesize, TABLE, probe_in, m, n, o, h, X1, Y1,
-               Z1, &log_file);
-      /* Mark regions that do not belong to ligand_cutoff */
-      adjust2ligand(A, m, n, o, h, ligand_cutoff, X1, Y1, Z1);
-      /* Free linked list (dictionary) from memory */
-      _free_atom();
-      /* Create a linked list for PDB information* | saves position (x,y,z),
-       * atom radius, resnumber, chain */
-      read_pdb(PDB_NAME, DIC, tablesize, TABLE, probe_in, m, n, o, h, X1, Y1,
-               Z1, &log_file);
+    /* Matrix Allocation and Initialization, reused by every frame */
+    /* int ***A: Grid representing empty spaces and surface points along
+    marked by small probe int ***S: Grid representing empty spaces and
+    surface points along marked by big probe double ***M: Grid representing
+    depth in each cavity point */
+    if (verbose_flag)
+      fprintf(stdout, "> Creating grid\n");
+    A = igrid(m, n, o);
+    S = igrid(m, n, o);
+    N = igrid(m, n, o);
+    /* Depth and hydropathy grids only feed cavity files */
+    M = HP = NULL;
+    if (!metrics_mode) {
+      M = dgrid(m, n, o);
+      HP = dgrid(m, n, o);
     }
 
-    /* The points outside the user defined search space are excluded here */
-    if (box_mode) {
-      if (verbose_flag)
-        fprintf(stdout, "> Filtering grid points\n");
+    for (frame = 0; frame < nframes; frame++) {
 
-      filter2box(A, m, n, o, h, bX1, bY1, bZ1, bX2, bY2, bZ2, norm1);
-    }
+      /* Frames of other workers */
+      if (worker >= 0 && frame % nworkers != worker) {
+        if (trajectory_mode)
+          skip_frame(T);
+        continue;
+      }
 
-    /*Remove outlier points*/
-    filter_noise(A, m, n, o);
+      /* Move topology atoms to next trajectory frame */
+      if (trajectory_mode) {
+        if (!read_frame(T))
+          break;
+        apply_frame(T, topology);
+      }
 
-    /* Grouping Cavities and calculating Volume and */
-    if (verbose_flag)
-      fprintf(stdout, "> Clustering cavities and calculating volume\n");
-    ncav = clustering(A, m, n, o, h, volume_cutoff);
-
-    if (ncav > 0) {
-      /* Create KVFinder_results structure */
-      KVFinder_results = (KVresults *)calloc(ncav, sizeof(KVresults));
-      cavity = (coords *)calloc(ncav, sizeof(coords));
-      boundary = (coords *)calloc(ncav, sizeof(coords));
-
-      /* Pass volume to KVFinder_results structure */
-      node *p;
-      for (p = V; p != NULL; p = p->next)
-        KVFinder_results[(p->pos)].volume = p->volume;
-      free_node();
-      free(p);
-      free(V);
-
-      /* Defining surface points and calculating area*/
-      if (verbose_flag)
-        fprintf(stdout, "> Defining surface points and calculating area\n");
-      filter_surface(A, S, m, n, o);
-      area(S, m, n, o, h, ncav);
+      /* Output files of frame */
+      if (ensemble_mode || trajectory_mode) {
+        if (verbose_flag)
+          fprintf(stdout, "> %s %d\n", ensemble_mode ? "Model" : "Frame",
+                  frame + 1);
+        snprintf(frame_name, 600, "%s.%s%d", output,
+                 ensemble_mode ? "model" : "frame", frame + 1);
+        output_pdb = _combine(frame_name, ".KVFinder.output.pdb");
+        output_results = _combine(frame_name, ".KVFinder.results.toml");
+      }
 
-      /* Define interface residues for each cavity */
-      if (verbose_flag)
-        fprintf(stdout, "> Retrieving interface residues\n");
-      interface(A, m, n, o, h, probe_in, ncav, X1, Y1, Z1);
+      /* Log of frame, sent to parent process by workers */
+      frame_log = log_file;
+      if (worker >= 0)
+        frame_log = open_memstream(&frame_text, &frame_size);
 
-      /* Computing depth */
-      if (verbose_flag)
-        fprintf(stdout,
-                "> Defining cavity-bulk boundary and calculating depth\n");
-      filter_boundary(A, m, n, o, ncav);
-      depth(A, M, m, n, o, h, ncav);
+      /* Reuse grids of previous frame */
+      if (frame > 0) {
+        reset_igrid(A, m, n, o, 1);
+        reset_igrid(S, m, n, o, 1);
+        if (!metrics_mode) {
+          reset_dgrid(M, m, n, o, 0.0);
+          reset_dgrid(HP, m, n, o, 0.0);
+        }
+      }
 
-      /* Computing hydropathy */
-      if (verbose_flag)
-        fprintf(stdout,
-                "> Mapping hydrophobicity scale at surface points\n");
-      project_hydropathy(HP, S, m, n, o, h, probe_in, X1, Y1, Z1);
       if (verbose_flag)
-        fprintf(stdout,
-                "> Estimating average hydropathy\n");
-      estimate_average_hydropathy(HP, S, m, n, o, ncav);
+        fprintf(stdout, "> Reading PDB coordinates\n");
 
-      /* Turn ON(1) filled cavities option */
-      if (verbose_flag)
-        fprintf(stdout, "> Writing cavities PDB file\n");
-      /* Export Cavities PDB */
-      export(output_pdb, A, S, M, HP, kvp_mode, m, n, o, h, ncav, X1, Y1, Z1);
+      /* Protein Coordinates Extraction */
+      /* Save coordinates (x,y,z), atom radius, residue number and chain.
+       * Radii of every atom are looked up (and warned about) in first frame
+       * of a process, so only the worker running frame 0 logs them */
+      read_model(PDB_NAME, ensemble_mode ? frame + 1 : ALL_MODELS, probe_in,
+                 m, n, o, h, X1, Y1, Z1, worker > 0 ? &log_file : &frame_log);
 
-      /* Write results file */
-      if (verbose_flag)
-        fprintf(stdout, "> Writing results file\n");
-      write_results(output_results, pdb_name, output_pdb, LIGAND_NAME, h, ncav);
+      /* Detect and characterize cavities */
+      ncav = detect_cavities(A, S, N, M, HP, L, m, n, o, h, probe_in,
+                             probe_out, removal_distance, volume_cutoff,
+                             surface_mode, box_mode, kvp_mode, X1, Y1, Z1,
+                             bX1, bY1, bZ1, bX2, bY2, bZ2, norm1, pdb_name,
+                             ensemble_mode || trajectory_mode ? frame_name
+                                                              : output,
+                             output_pdb, output_results, LIGAND_NAME,
+                             grid_format, mesh_format, metrics_mode,
+                             results_format, archive >= 0, top_k, min_depth,
+                             near_residues, nnear, verbose_flag);
+      /* Move output files of frame (<base>.modelN or <base>.frameN) or of
+       * structure (<base>.structure) into results archive */
+      if (archive >= 0)
+        write_archive_record(archive, archive_index,
+                             ensemble_mode || trajectory_mode
+                                 ? frame_name + strlen(output_folder)
+                                 : _combine(BASE_NAME, ".structure"),
+                             archive_folder);
+      if (ensemble_mode || trajectory_mode)
+        fprintf(frame_log, "%s %d: %d cavities\n",
+                ensemble_mode ? "Model" : "Frame", frame + 1, ncav);
+
+      if (ncav == 0) {
+        if (ensemble_mode || trajectory_mode)
+          fprintf(stdout, "> parKVFinder found no cavities in %s %d!\n",
+                  ensemble_mode ? "model" : "frame", frame + 1);
+        else
+          fprintf(stdout, "> parKVFinder found no cavities!\n");
+      }
 
-    } else {
-      fprintf(stdout, "> parKVFinder found no cavities!\n");
+      /* Send frame log to parent process */
+      if (worker >= 0) {
+        fclose(frame_log);
+        record.frame = frame;
+        record.ncav = ncav;
+        record.size = frame_size;
+        fwrite(&record, sizeof(frame_record), 1, worker_file);
+        fwrite(frame_text, 1, frame_size, worker_file);
+        free(frame_text);
+      }
+
+      /* Free atom table of frame */
+      _free_atom();
     }
 
-    /*Free data structures used for depth calculation*/
-    _free_atom();
-    free(cavity);
-    free(boundary);
     free_igrid(A, m, n, o);
     free_igrid(S, m, n, o);
-    free_dgrid(M, m, n, o);
+    free_igrid(N, m, n, o);
+    if (!metrics_mode) {
+      free_dgrid(M, m, n, o);
+      free_dgrid(HP, m, n, o);
+    }
   }
 
+  if (trajectory_mode)
+    close_trajectory(T);
+  if (worker >= 0)
+    fclose(worker_file);
+
+  /* Archive mode: remove temporary folder */
+  if (archive >= 0)
+    rmdir(archive_folder);
+
+  /*Free data structures used for depth calculation*/
+  free_structures();
+  free_vdw();
+  free(L);
+  free(near_residues);
+
   /*Evaluate elapsed time*/
   gettimeofday(&toc, NULL);
   printf("done!\n");
@@ -495,5 +1082,16 @@ int main(int argc, char **argv) {
   fflush(log_file);
   fclose(log_file);
 
+  /* Archive mode: log of run, appended as <base>.log record */
+  if (archive >= 0) {
+    if (worker < 0) {
+      write_archive_log(archive, archive_index, _combine(BASE_NAME, ".log"),
+                        log_text, log_size);
+      free(log_text);
+    }
+    close(archive);
+    close(archive_index);
+  }
+
   return 0;
 }
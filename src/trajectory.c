@@ -0,0 +1,864 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fileprocessing.h"
+#include "trajectory.h"
+#include "utils.h"
+
+/* Magic number of XTC frames */
+#define XTC_MAGIC 1995
+
+/* First usable index of XTC magic integers */
+#define FIRSTIDX 9
+
+/* Spare bytes after XTC compressed coordinates, more than one atom may read */
+#define XTC_PADDING 256
+
+/* Integer ranges of XTC small (run) coordinates, one per bit count / 3 */
+static const int magicints[] = {
+    0,        0,        0,       0,       0,       0,        0,
+    0,        0,        8,       10,      12,      16,       20,
+    25,       32,       40,      50,      64,      80,       101,
+    128,      161,      203,     256,     322,     406,      512,
+    645,      812,      1024,    1290,    1625,    2048,     2580,
+    3250,     4096,     5060,    6501,    8192,    10321,    13003,
+    16384,    20642,    26007,   32768,   41285,   52015,    65536,
+    82570,    104031,   131072,  165140,  208063,  262144,   330280,
+    416127,   524287,   660561,  832255,  1048576, 1321122,  1664510,
+    2097152,  2642245,  3329021, 4194304, 5284491, 6658042,  8388607,
+    10568983, 13316085, 16777216};
+
+#define NMAGICINTS ((int)(sizeof(magicints) / sizeof(*magicints)))
+
+/* Binary records */
+
+/*
+ * Function: _swap_bytes
+ * ---------------------
+ *
+ * Reverse byte order of a 32-bit word
+ *
+ * value: 32-bit word
+ *
+ * returns: word with reversed byte order
+ *
+ */
+unsigned int _swap_bytes(unsigned int value) {
+  return (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) |
+         (value << 24);
+}
+
+/*
+ * Function: _read_bytes
+ * ---------------------
+ *
+ * Read bytes from trajectory file
+ *
+ * T: trajectory
+ * data: destination
+ * size: number of bytes
+ *
+ * returns: 1 if all bytes were read, 0 otherwise
+ *
+ */
+int _read_bytes(trajectory *T, void *data, int size) {
+  return fread(data, 1, size, T->file) == (size_t)size;
+}
+
+/*
+ * Function: _read_xdr_int
+ * -----------------------
+ *
+ * Read a big-endian (XDR) integer from trajectory file
+ *
+ * T: trajectory
+ * value: pointer to integer
+ *
+ * returns: 1 if integer was read, 0 otherwise
+ *
+ */
+int _read_xdr_int(trajectory *T, int *value) {
+  unsigned char b[4];
+
+  if (!_read_bytes(T, b, 4))
+    return 0;
+  *value = (int)(((unsigned int)b[0] << 24) | ((unsigned int)b[1] << 16) |
+                 ((unsigned int)b[2] << 8) | (unsigned int)b[3]);
+  return 1;
+}
+
+/*
+ * Function: _read_xdr_float
+ * -------------------------
+ *
+ * Read a big-endian (XDR) single precision float from trajectory file
+ *
+ * T: trajectory
+ * value: pointer to float
+ *
+ * returns: 1 if float was read, 0 otherwise
+ *
+ */
+int _read_xdr_float(trajectory *T, float *value) {
+  int i;
+
+  if (!_read_xdr_int(T, &i))
+    return 0;
+  memcpy(value, &i, sizeof(float));
+  return 1;
+}
+
+/*
+ * Function: _reserve_buffer
+ * -------------------------
+ *
+ * Grow raw record buffer of trajectory, kept across frames
+ *
+ * T: trajectory
+ * size: required capacity in bytes
+ *
+ */
+void _reserve_buffer(trajectory *T, int size) {
+  if (size > T->size) {
+    T->size = size;
+    T->buffer = (unsigned char *)realloc(T->buffer, size);
+  }
+}
+
+/* DCD trajectory processing */
+
+/*
+ * Function: _read_dcd_record
+ * --------------------------
+ *
+ * Read a Fortran unformatted record of a DCD file into trajectory buffer
+ *
+ * T: trajectory
+ * size: expected record length in bytes or -1 for any length
+ *
+ * returns: record length or -1 at end of file
+ *
+ */
+int _read_dcd_record(trajectory *T, int size) {
+  unsigned int marker, end;
+
+  if (!_read_bytes(T, &marker, 4))
+    return -1;
+  if (T->swap)
+    marker = _swap_bytes(marker);
+
+  if ((size >= 0 && marker != (unsigned int)size) || marker > 0x7fffffff) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Invalid DCD record!\n");
+    exit(-1);
+  }
+  _reserve_buffer(T, marker + 1);
+  if (!_read_bytes(T, T->buffer, marker) || !_read_bytes(T, &end, 4) ||
+      (T->swap ? _swap_bytes(end) : end) != marker) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Truncated DCD file!\n");
+    exit(-1);
+  }
+
+  return marker;
+}
+
+/*
+ * Function: _open_dcd
+ * -------------------
+ *
+ * Read DCD header (CHARMM and X-PLOR layouts, either byte order) and leave
+ * file at first frame
+ *
+ * T: trajectory
+ *
+ */
+void _open_dcd(trajectory *T) {
+  unsigned int marker, icntrl[20];
+  int i, natoms;
+
+  /* Byte order from length of first record */
+  _read_bytes(T, &marker, 4);
+  T->swap = marker != 84;
+  rewind(T->file);
+
+  /* Header: "CORD" and 20 control integers */
+  _read_dcd_record(T, 84);
+  memcpy(icntrl, T->buffer + 4, sizeof(icntrl));
+  if (T->swap)
+    for (i = 0; i < 20; i++)
+      icntrl[i] = _swap_bytes(icntrl[i]);
+
+  /* CHARMM files (non-zero version) may carry unit cell and 4D records */
+  T->has_unit_cell = icntrl[19] && icntrl[10];
+  T->has_4d = icntrl[19] && icntrl[11];
+
+  /* Fixed atoms are only written in first frame */
+  if (icntrl[8]) {
+    fprintf(stderr, "\033[0;31mError:\033[0m DCD files with fixed atoms are "
+                    "not supported!\n");
+    exit(-1);
+  }
+
+  /* Title */
+  if (_read_dcd_record(T, -1) < 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Truncated DCD file!\n");
+    exit(-1);
+  }
+
+  /* Number of atoms */
+  if (_read_dcd_record(T, 4) < 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Truncated DCD file!\n");
+    exit(-1);
+  }
+  memcpy(&natoms, T->buffer, 4);
+  T->natoms = T->swap ? (int)_swap_bytes(natoms) : natoms;
+}
+
+/*
+ * Function: _read_dcd_frame
+ * -------------------------
+ *
+ * Read next DCD frame into trajectory coordinates
+ *
+ * T: trajectory
+ *
+ * returns: 1 if a frame was read, 0 at end of file
+ *
+ */
+int _read_dcd_frame(trajectory *T) {
+  int i, axis, first = 1;
+  unsigned int word;
+  float value;
+
+  /* Unit cell */
+  if (T->has_unit_cell) {
+    if (_read_dcd_record(T, 48) < 0)
+      return 0;
+    first = 0;
+  }
+
+  /* X, Y and Z records */
+  for (axis = 0; axis < 3; axis++) {
+    if (_read_dcd_record(T, 4 * T->natoms) < 0) {
+      if (first)
+        return 0;
+      fprintf(stderr, "\033[0;31mError:\033[0m Truncated DCD file!\n");
+      exit(-1);
+    }
+    first = 0;
+    for (i = 0; i < T->natoms; i++) {
+      memcpy(&word, T->buffer + 4 * i, 4);
+      if (T->swap)
+        word = _swap_bytes(word);
+      memcpy(&value, &word, 4);
+      T->coordinates[3 * i + axis] = value;
+    }
+  }
+
+  /* Fourth dimension */
+  if (T->has_4d && _read_dcd_record(T, 4 * T->natoms) < 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Truncated DCD file!\n");
+    exit(-1);
+  }
+
+  return 1;
+}
+
+/* XTC trajectory processing */
+
+/*
+ * Function: _size_of_int
+ * ----------------------
+ *
+ * Get number of bits needed to store integers in [0, size)
+ *
+ * size: integer range
+ *
+ * returns: number of bits
+ *
+ */
+int _size_of_int(int size) {
+  unsigned int num = 1;
+  int nbits = 0;
+
+  while (size >= (int)num && nbits < 32) {
+    nbits++;
+    num <<= 1;
+  }
+
+  return nbits;
+}
+
+/*
+ * Function: _size_of_ints
+ * -----------------------
+ *
+ * Get number of bits needed to store a tuple of integers packed as one
+ * mixed-radix number
+ *
+ * nints: number of integers
+ * sizes: range of each integer
+ *
+ * returns: number of bits
+ *
+ */
+int _size_of_ints(int nints, unsigned int sizes[]) {
+  int i, nbytes = 1, bytecnt, nbits = 0;
+  unsigned int bytes[32], num, tmp;
+
+  bytes[0] = 1;
+  for (i = 0; i < nints; i++) {
+    tmp = 0;
+    for (bytecnt = 0; bytecnt < nbytes; bytecnt++) {
+      tmp = bytes[bytecnt] * sizes[i] + tmp;
+      bytes[bytecnt] = tmp & 0xff;
+      tmp >>= 8;
+    }
+    while (tmp != 0) {
+      bytes[bytecnt++] = tmp & 0xff;
+      tmp >>= 8;
+    }
+    nbytes = bytecnt;
+  }
+
+  num = 1;
+  nbytes--;
+  while (bytes[nbytes] >= num) {
+    nbits++;
+    num *= 2;
+  }
+
+  return nbits + nbytes * 8;
+}
+
+/*
+ * Function: _receive_bits
+ * -----------------------
+ *
+ * Read an integer from a big-endian bit stream
+ *
+ * state: stream state (byte count, pending bits and last byte)
+ * bytes: bit stream
+ * nbits: number of bits of integer
+ *
+ * returns: integer
+ *
+ */
+int _receive_bits(int state[], unsigned char *bytes, int nbits) {
+  int cnt = state[0], num = 0, mask = nbits < 32 ? (1 << nbits) - 1 : -1;
+  unsigned int lastbits = (unsigned int)state[1],
+               lastbyte = (unsigned int)state[2];
+
+  while (nbits >= 8) {
+    lastbyte = (lastbyte << 8) | bytes[cnt++];
+    num |= (lastbyte >> lastbits) << (nbits - 8);
+    nbits -= 8;
+  }
+  if (nbits > 0) {
+    if ((int)lastbits < nbits) {
+      lastbits += 8;
+      lastbyte = (lastbyte << 8) | bytes[cnt++];
+    }
+    lastbits -= nbits;
+    num |= (lastbyte >> lastbits) & ((1 << nbits) - 1);
+  }
+
+  state[0] = cnt;
+  state[1] = (int)lastbits;
+  state[2] = (int)lastbyte;
+
+  return num & mask;
+}
+
+/*
+ * Function: _receive_ints
+ * -----------------------
+ *
+ * Read three integers packed as one mixed-radix number from a bit stream
+ *
+ * state: stream state
+ * bytes: bit stream
+ * nbits: number of bits of packed number
+ * sizes: range of each integer
+ * nums: unpacked integers
+ *
+ */
+void _receive_ints(int state[], unsigned char *bytes, int nbits,
+                   unsigned int sizes[], int nums[]) {
+  int packed[32], i, j, nbytes = 0;
+  unsigned int num, p;
+
+  packed[1] = packed[2] = packed[3] = 0;
+  while (nbits > 8) {
+    packed[nbytes++] = _receive_bits(state, bytes, 8);
+    nbits -= 8;
+  }
+  if (nbits > 0)
+    packed[nbytes++] = _receive_bits(state, bytes, nbits);
+
+  for (i = 2; i > 0; i--) {
+    num = 0;
+    for (j = nbytes - 1; j >= 0; j--) {
+      num = (num << 8) | (unsigned int)packed[j];
+      p = num / sizes[i];
+      packed[j] = (int)p;
+      num = num - p * sizes[i];
+    }
+    nums[i] = (int)num;
+  }
+  nums[0] =
+      packed[0] | (packed[1] << 8) | (packed[2] << 16) | (packed[3] << 24);
+}
+
+/*
+ * Function: _decompress_xtc
+ * -------------------------
+ *
+ * Decompress XTC coordinates: each atom is stored relative to the frame
+ * minimum, possibly followed by a run of atoms stored as small differences
+ * to the previous atom (with the first two atoms of a run interchanged)
+ *
+ * T: trajectory
+ * bytes: compressed coordinates (followed by XTC_PADDING zero bytes)
+ * nbytes: number of compressed bytes
+ * minint: minimum integer coordinates
+ * maxint: maximum integer coordinates
+ * smallidx: initial index of small coordinates range in magicints
+ * precision: integer units per nanometer
+ *
+ */
+void _decompress_xtc(trajectory *T, unsigned char *bytes, int nbytes,
+                     int minint[3], int maxint[3], int smallidx,
+                     float precision) {
+  int i, k, run = 0, is_smaller, smaller, smallnum, bitsize, tmp;
+  int state[3] = {0, 0, 0}, bitsizeint[3], prevcoord[3], *lip = T->ints,
+      *thiscoord;
+  unsigned int sizeint[3], sizesmall[3];
+  float inv_precision = 1.0 / precision;
+
+  for (k = 0; k < 3; k++)
+    sizeint[k] = maxint[k] - minint[k] + 1;
+
+  /* Large ranges are stored one integer at a time */
+  if ((sizeint[0] | sizeint[1] | sizeint[2]) > 0xffffff) {
+    for (k = 0; k < 3; k++)
+      bitsizeint[k] = _size_of_int(sizeint[k]);
+    bitsize = 0;
+  } else
+    bitsize = _size_of_ints(3, sizeint);
+
+  if (smallidx < FIRSTIDX || smallidx >= NMAGICINTS) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Invalid XTC frame!\n");
+    exit(-1);
+  }
+  smaller = magicints[smallidx - 1 > FIRSTIDX ? smallidx - 1 : FIRSTIDX] / 2;
+  smallnum = magicints[smallidx] / 2;
+  sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx];
+
+  i = 0;
+  while (i < T->natoms) {
+    thiscoord = lip + 3 * i;
+    if (bitsize == 0)
+      for (k = 0; k < 3; k++)
+        thiscoord[k] = _receive_bits(state, bytes, bitsizeint[k]);
+    else
+      _receive_ints(state, bytes, bitsize, sizeint, thiscoord);
+    i++;
+    for (k = 0; k < 3; k++) {
+      thiscoord[k] += minint[k];
+      prevcoord[k] = thiscoord[k];
+    }
+
+    is_smaller = 0;
+    if (_receive_bits(state, bytes, 1)) {
+      run = _receive_bits(state, bytes, 5);
+      is_smaller = run % 3;
+      run -= is_smaller;
+      is_smaller--;
+    }
+    if (i + run / 3 > T->natoms) {
+      fprintf(stderr, "\033[0;31mError:\033[0m Invalid XTC frame!\n");
+      exit(-1);
+    }
+
+    if (run > 0) {
+      for (k = 0; k < run; k += 3) {
+        thiscoord += 3;
+        _receive_ints(state, bytes, smallidx, sizesmall, thiscoord);
+        i++;
+        thiscoord[0] += prevcoord[0] - smallnum;
+        thiscoord[1] += prevcoord[1] - smallnum;
+        thiscoord[2] += prevcoord[2] - smallnum;
+        if (k == 0) {
+          /* Interchange first and second atoms (water molecules compress
+           * better with oxygen in the middle) */
+          tmp = thiscoord[0];
+          thiscoord[0] = prevcoord[0];
+          prevcoord[0] = tmp;
+          tmp = thiscoord[1];
+          thiscoord[1] = prevcoord[1];
+          prevcoord[1] = tmp;
+          tmp = thiscoord[2];
+          thiscoord[2] = prevcoord[2];
+          prevcoord[2] = tmp;
+          thiscoord[-3] = prevcoord[0];
+          thiscoord[-2] = prevcoord[1];
+          thiscoord[-1] = prevcoord[2];
+        } else {
+          prevcoord[0] = thiscoord[0];
+          prevcoord[1] = thiscoord[1];
+          prevcoord[2] = thiscoord[2];
+        }
+      }
+    }
+
+    /* Adapt small coordinates range */
+    smallidx += is_smaller;
+    if (smallidx < FIRSTIDX || smallidx >= NMAGICINTS) {
+      fprintf(stderr, "\033[0;31mError:\033[0m Invalid XTC frame!\n");
+      exit(-1);
+    }
+    if (is_smaller < 0) {
+      smallnum = smaller;
+      smaller = smallidx > FIRSTIDX ? magicints[smallidx - 1] / 2 : 0;
+    } else if (is_smaller > 0) {
+      smaller = smallnum;
+      smallnum = magicints[smallidx] / 2;
+    }
+    sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx];
+
+    if (state[0] > nbytes) {
+      fprintf(stderr, "\033[0;31mError:\033[0m Invalid XTC frame!\n");
+      exit(-1);
+    }
+  }
+
+  /* Nanometers to angstroms */
+  for (i = 0; i < 3 * T->natoms; i++)
+    T->coordinates[i] = 10.0 * (double)(lip[i] * inv_precision);
+}
+
+/*
+ * Function: _read_xtc_frame
+ * -------------------------
+ *
+ * Read next XTC frame into trajectory coordinates
+ *
+ * T: trajectory
+ *
+ * returns: 1 if a frame was read, 0 at end of file
+ *
+ */
+int _read_xtc_frame(trajectory *T) {
+  int i, magic, natoms, step, lsize, minint[3], maxint[3], smallidx, nbytes,
+      ok = 1;
+  float time, box[9], precision, value;
+
+  /* Header */
+  if (!_read_xdr_int(T, &magic))
+    return 0;
+  if (magic != XTC_MAGIC) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Invalid XTC frame!\n");
+    exit(-1);
+  }
+  ok = _read_xdr_int(T, &natoms) && _read_xdr_int(T, &step) &&
+       _read_xdr_float(T, &time);
+  for (i = 0; ok && i < 9; i++)
+    ok = _read_xdr_float(T, &box[i]);
+  ok = ok && _read_xdr_int(T, &lsize);
+  if (ok && (natoms != T->natoms || lsize != natoms)) {
+    fprintf(stderr, "\033[0;31mError:\033[0m XTC frames must have the same "
+                    "number of atoms!\n");
+    exit(-1);
+  }
+
+  /* Few atoms are stored uncompressed */
+  if (ok && natoms <= 9) {
+    for (i = 0; ok && i < 3 * natoms; i++) {
+      ok = _read_xdr_float(T, &value);
+      T->coordinates[i] = 10.0 * (double)value;
+    }
+  } else if (ok) {
+    ok = _read_xdr_float(T, &precision);
+    for (i = 0; ok && i < 3; i++)
+      ok = _read_xdr_int(T, &minint[i]);
+    for (i = 0; ok && i < 3; i++)
+      ok = _read_xdr_int(T, &maxint[i]);
+    ok = ok && _read_xdr_int(T, &smallidx) && _read_xdr_int(T, &nbytes);
+    if (ok && (nbytes < 0 || nbytes > 0x7fffffff - XTC_PADDING - 3 ||
+               precision <= 0.0)) {
+      fprintf(stderr, "\033[0;31mError:\033[0m Invalid XTC frame!\n");
+      exit(-1);
+    }
+
+    /* Compressed bytes are padded to 4 bytes */
+    if (ok) {
+      _reserve_buffer(T, nbytes + 3 + XTC_PADDING);
+      ok = _read_bytes(T, T->buffer, (nbytes + 3) / 4 * 4);
+      memset(T->buffer + nbytes, 0, 3 + XTC_PADDING);
+    }
+    if (ok)
+      _decompress_xtc(T, T->buffer, nbytes, minint, maxint, smallidx,
+                      precision);
+  }
+
+  if (!ok) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Truncated XTC file!\n");
+    exit(-1);
+  }
+
+  return 1;
+}
+
+/*
+ * Function: _skip_xtc_frame
+ * -------------------------
+ *
+ * Move past next XTC frame without decompressing it
+ *
+ * T: trajectory
+ *
+ * returns: 1 if a frame was skipped, 0 at end of file
+ *
+ */
+int _skip_xtc_frame(trajectory *T) {
+  int magic, natoms, header[12], nbytes;
+
+  if (!_read_xdr_int(T, &magic))
+    return 0;
+  if (magic != XTC_MAGIC || !_read_xdr_int(T, &natoms) || natoms < 0) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Invalid XTC frame!\n");
+    exit(-1);
+  }
+
+  /* Step, time, box and number of atoms */
+  if (!_read_bytes(T, header, 48)) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Truncated XTC file!\n");
+    exit(-1);
+  }
+
+  /* Uncompressed coordinates or precision, bounds, small index and bytes */
+  if (natoms <= 9)
+    fseek(T->file, 12L * natoms, SEEK_CUR);
+  else if (!_read_bytes(T, header, 32) || !_read_xdr_int(T, &nbytes) ||
+           nbytes < 0 || fseek(T->file, (nbytes + 3L) / 4 * 4, SEEK_CUR)) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Truncated XTC file!\n");
+    exit(-1);
+  }
+
+  return 1;
+}
+
+/* Trajectory frames */
+
+/*
+ * Function: open_trajectory
+ * -------------------------
+ *
+ * Open a DCD or XTC trajectory, detected by its leading bytes, of a topology
+ * with natoms atoms
+ *
+ * TRAJECTORY_NAME: path to trajectory file
+ * natoms: number of topology atoms
+ *
+ * returns: trajectory positioned at first frame
+ *
+ */
+trajectory *open_trajectory(char TRAJECTORY_NAME[500], int natoms) {
+  unsigned char head[8];
+  trajectory *T;
+
+  T = (trajectory *)calloc(1, sizeof(trajectory));
+  if ((T->file = fopen(TRAJECTORY_NAME, "rb")) == NULL) {
+    fprintf(stderr, "\033[0;31mError:\033[0m Trajectory file does not "
+                    "exist!\n");
+    exit(-1);
+  }
+
+  /* DCD starts with an 84 byte record holding "CORD", XTC with its magic */
+  if (!_read_bytes(T, head, 8))
+    memset(head, 0, 8);
+  rewind(T->file);
+  if (!memcmp(head + 4, "CORD", 4) &&
+      ((head[0] == 84 && !head[1] && !head[2] && !head[3]) ||
+       (!head[0] && !head[1] && !head[2] && head[3] == 84))) {
+    T->format = DCD_FORMAT;
+    _open_dcd(T);
+  } else if (head[0] == 0 && head[1] == 0 && head[2] == (XTC_MAGIC >> 8) &&
+             head[3] == (XTC_MAGIC & 0xff)) {
+    T->format = XTC_FORMAT;
+    _read_xdr_int(T, &T->natoms);
+    _read_xdr_int(T, &T->natoms);
+    rewind(T->file);
+  } else {
+    fprintf(stderr, "\033[0;31mError:\033[0m Unknown trajectory format (DCD "
+                    "or XTC expected)!\n");
+    exit(-1);
+  }
+  T->start = ftell(T->file);
+
+  if (T->natoms != natoms) {
+    fprintf(stderr,
+            "\033[0;31mError:\033[0m Trajectory has %d atoms, topology has "
+            "%d atoms!\n",
+            T->natoms, natoms);
+    exit(-1);
+  }
+
+  T->coordinates = (double *)malloc((3 * natoms + 1) * sizeof(double));
+  T->ints = (int *)malloc((3 * natoms + 1) * sizeof(int));
+
+  return T;
+}
+
+/*
+ * Function: read_frame
+ * --------------------
+ *
+ * Read next trajectory frame into trajectory coordinates
+ *
+ * T: trajectory
+ *
+ * returns: 1 if a frame was read, 0 at end of trajectory
+ *
+ */
+int read_frame(trajectory *T) {
+  if (T->format == DCD_FORMAT)
+    return _read_dcd_frame(T);
+  return _read_xtc_frame(T);
+}
+
+/*
+ * Function: skip_frame
+ * --------------------
+ *
+ * Move past next trajectory frame, without decompressing XTC coordinates
+ *
+ * T: trajectory
+ *
+ * returns: 1 if a frame was skipped, 0 at end of trajectory
+ *
+ */
+int skip_frame(trajectory *T) {
+  if (T->format == DCD_FORMAT)
+    return _read_dcd_frame(T);
+  return _skip_xtc_frame(T);
+}
+
+/*
+ * Function: count_frames
+ * ----------------------
+ *
+ * Count trajectory frames, then go back to first frame
+ *
+ * T: trajectory
+ *
+ * returns: number of frames
+ *
+ */
+int count_frames(trajectory *T) {
+  int nframes = 0;
+
+  while (skip_frame(T))
+    nframes++;
+  rewind_trajectory(T);
+
+  return nframes;
+}
+
+/*
+ * Function: rewind_trajectory
+ * ---------------------------
+ *
+ * Go back to first trajectory frame
+ *
+ * T: trajectory
+ *
+ */
+void rewind_trajectory(trajectory *T) {
+  clearerr(T->file);
+  fseek(T->file, T->start, SEEK_SET);
+}
+
+/*
+ * Function: trajectory_box
+ * ------------------------
+ *
+ * Enlarge a bounding box to hold atoms of every trajectory frame, then go
+ * back to first frame
+ *
+ * T: trajectory
+ * X1: minimum x coordinate
+ * Y1: minimum y coordinate
+ * Z1: minimum z coordinate
+ * X2: maximum x coordinate
+ * Y3: maximum y coordinate
+ * Z4: maximum z coordinate
+ *
+ * returns: number of frames
+ *
+ */
+int trajectory_box(trajectory *T, double *X1, double *Y1, double *Z1,
+                   double *X2, double *Y3, double *Z4) {
+  int i, nframes = 0;
+  double *P;
+
+  while (read_frame(T)) {
+    for (i = 0, P = T->coordinates; i < T->natoms; i++, P += 3) {
+      if (P[0] < *X1)
+        *X1 = P[0];
+      if (P[1] < *Y1)
+        *Y1 = P[1];
+      if (P[2] < *Z1)
+        *Z1 = P[2];
+      if (P[0] > *X2)
+        *X2 = P[0];
+      if (P[1] > *Y3)
+        *Y3 = P[1];
+      if (P[2] > *Z4)
+        *Z4 = P[2];
+    }
+    nframes++;
+  }
+  rewind_trajectory(T);
+
+  return nframes;
+}
+
+/*
+ * Function: apply_frame
+ * ---------------------
+ *
+ * Move topology atoms to current trajectory frame coordinates. Radii and
+ * residue information of the topology are kept.
+ *
+ * T: trajectory
+ * topology: parsed topology structure
+ *
+ */
+void apply_frame(trajectory *T, structure *topology) {
+  int i;
+
+  for (i = 0; i < topology->natoms; i++) {
+    topology->atoms[i].x = T->coordinates[3 * i];
+    topology->atoms[i].y = T->coordinates[3 * i + 1];
+    topology->atoms[i].z = T->coordinates[3 * i + 2];
+  }
+}
+
+/*
+ * Function: close_trajectory
+ * --------------------------
+ *
+ * Close trajectory file and free its buffers
+ *
+ * T: trajectory
+ *
+ */
+void close_trajectory(trajectory *T) {
+  fclose(T->file);
+  free(T->coordinates);
+  free(T->buffer);
+  free(T->ints);
+  free(T);
+}
@@ -0,0 +1,41 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include "utils.h"
+
+/* Binary records */
+unsigned int _swap_bytes(unsigned int value);
+int _read_bytes(trajectory *T, void *data, int size);
+int _read_xdr_int(trajectory *T, int *value);
+int _read_xdr_float(trajectory *T, float *value);
+void _reserve_buffer(trajectory *T, int size);
+
+/* DCD trajectory processing */
+int _read_dcd_record(trajectory *T, int size);
+void _open_dcd(trajectory *T);
+int _read_dcd_frame(trajectory *T);
+
+/* XTC trajectory processing */
+int _size_of_int(int size);
+int _size_of_ints(int nints, unsigned int sizes[]);
+int _receive_bits(int state[], unsigned char *bytes, int nbits);
+void _receive_ints(int state[], unsigned char *bytes, int nbits,
+                   unsigned int sizes[], int nums[]);
+void _decompress_xtc(trajectory *T, unsigned char *bytes, int nbytes,
+                     int minint[3], int maxint[3], int smallidx,
+                     float precision);
+int _read_xtc_frame(trajectory *T);
+int _skip_xtc_frame(trajectory *T);
+
+/* Trajectory frames */
+trajectory *open_trajectory(char TRAJECTORY_NAME[500], int natoms);
+int read_frame(trajectory *T);
+int skip_frame(trajectory *T);
+int count_frames(trajectory *T);
+void rewind_trajectory(trajectory *T);
+int trajectory_box(trajectory *T, double *X1, double *Y1, double *Z1,
+                   double *X2, double *Y3, double *Z4);
+void apply_frame(trajectory *T, structure *topology);
+void close_trajectory(trajectory *T);
+
+#endif
@@ -1,6 +1,8 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 /* Functions */
 
@@ -365,3 +367,136 @@ void _initialize_string(char FROM[], int nF) {
   for (i = 0; i < nF; i++)
     FROM[i] = '\0';
 }
+
+/*
+ * Function: _format_int
+ * ---------------------
+ *
+ * Format an integer like printf "%<width>.<precision>d" (a zero precision
+ * leaves zero as blanks), without stdio or locale
+ *
+ * buffer: destination, not null-terminated
+ * value: integer
+ * width: minimum field width
+ * precision: minimum number of digits
+ *
+ * returns: number of characters written
+ *
+ */
+int _format_int(char *buffer, long value, int width, int precision) {
+  char digits[24];
+  int ndigits = 0, length, i = 0;
+  unsigned long u = value < 0 ? -(unsigned long)value : (unsigned long)value;
+
+  while (u > 0) {
+    digits[ndigits++] = '0' + u % 10;
+    u /= 10;
+  }
+  while (ndigits < precision)
+    digits[ndigits++] = '0';
+
+  length = ndigits + (value < 0);
+  for (; i < width - length; i++)
+    buffer[i] = ' ';
+  if (value < 0)
+    buffer[i++] = '-';
+  while (ndigits > 0)
+    buffer[i++] = digits[--ndigits];
+
+  return i;
+}
+
+/*
+ * Function: _format_fixed
+ * -----------------------
+ *
+ * Format a double like printf "%<width>.<precision>f", without stdio or
+ * locale. Rounding is decided on the exact binary value (ties to even), as
+ * glibc does, so output is byte-identical to printf.
+ *
+ * buffer: destination (at least width + 320 bytes), not null-terminated
+ * value: double
+ * width: minimum field width
+ * precision: number of decimals (up to 9)
+ *
+ * returns: number of characters written
+ *
+ */
+int _format_fixed(char *buffer, double value, int width, int precision) {
+  char digits[32];
+  int ndigits = 0, negative = signbit(value) != 0, length, i = 0;
+  double a = fabs(value), scale = 1.0, q, t;
+  unsigned long long u;
+
+  for (i = 0; i < precision; i++)
+    scale *= 10.0;
+
+  /* Non-finite values and values out of exact range */
+  if (!isfinite(value) || a * scale >= 4e15)
+    return snprintf(buffer, width + 320, "%*.*f", width, precision, value);
+
+  /* Floor of exact a * scale, then round half to even, where fma gives the
+   * exact sign of a * scale minus a representable number */
+  q = floor(a * scale);
+  t = fma(a, scale, -q);
+  if (t < 0.0)
+    q -= 1.0;
+  else if (t >= 1.0)
+    q += 1.0;
+  t = fma(a, scale, -(q + 0.5));
+  if (t > 0.0 || (t == 0.0 && fmod(q, 2.0) == 1.0))
+    q += 1.0;
+
+  /* Digits of q, with decimal point before the last precision digits */
+  u = (unsigned long long)q;
+  for (i = 0; i < precision; i++) {
+    digits[ndigits++] = '0' + u % 10;
+    u /= 10;
+  }
+  if (precision > 0)
+    digits[ndigits++] = '.';
+  do {
+    digits[ndigits++] = '0' + u % 10;
+    u /= 10;
+  } while (u > 0);
+
+  length = ndigits + negative;
+  for (i = 0; i < width - length; i++)
+    buffer[i] = ' ';
+  if (negative)
+    buffer[i++] = '-';
+  while (ndigits > 0)
+    buffer[i++] = digits[--ndigits];
+
+  return i;
+}
+
+/*
+ * Function: _write_at
+ * -------------------
+ *
+ * Write a buffer at an offset of a file descriptor (pwrite), retrying
+ * partial writes
+ *
+ * fd: file descriptor
+ * buffer: data
+ * size: number of bytes
+ * offset: file offset
+ *
+ * returns: 1 on success, 0 on error
+ *
+ */
+int _write_at(int fd, const char *buffer, size_t size, long offset) {
+  ssize_t written;
+
+  while (size > 0) {
+    written = pwrite(fd, buffer, size, (off_t)offset);
+    if (written <= 0)
+      return 0;
+    buffer += written;
+    size -= written;
+    offset += written;
+  }
+
+  return 1;
+}
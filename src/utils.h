@@ -1,6 +1,52 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+/* Dictionary name that selects the built-in van der Waals radii dictionary */
+#define BUILTIN_DICTIONARY "(built-in)"
+
+/* Precompiled van der Waals radii dictionaries: little-endian magic bytes,
+ * uint32 version, capacity and size, uint32 0, then keys (uint64) and radii
+ * (float64) of every table slot */
+#define VDW_BINARY_MAGIC "KVFDIC01"
+#define VDW_BINARY_VERSION 1
+#define VDW_BINARY_HEADER_SIZE 24
+
+/* Buffer sizes of chain identifiers and residue names, sized for mmCIF
+ * auth_asym_id (up to 8 characters) and CCD residue names (up to 5) */
+#define CHAIN_SIZE 9
+#define RESIDUE_SIZE 6
+
+/* Model index selecting atoms of every model of a structure */
+#define ALL_MODELS -1
+
+/* Schedules of models or frames: chosen by grid size and core count, whole
+ * frames run concurrently or one frame at a time on every core */
+#define AUTO_SCHEDULE 0
+#define FRAME_SCHEDULE 1
+#define VOXEL_SCHEDULE 2
+
+/* Trajectory file formats */
+#define DCD_FORMAT 1
+#define XTC_FORMAT 2
+
+/* Volumetric grid output formats */
+#define NO_GRID 0
+#define CCP4_GRID 1
+#define DX_GRID 2
+#define NPY_GRID 3
+#define NPZ_GRID 4
+#define RLE8_GRID 5
+#define RLE16_GRID 6
+
+/* Machine-oriented results formats, written along with TOML results file */
+#define JSONL_RESULTS 1
+#define CSV_RESULTS 2
+
+/* Cavity surface mesh output formats */
+#define NO_MESH 0
+#define PLY_MESH 1
+#define OBJ_MESH 2
+
 /* Structs */
 
 /*
@@ -25,21 +71,46 @@ typedef struct PARAMETERS {
 } parameters;
 
 /*
- * Struct: VDW
- * -----------
+ * Struct: VDW_ENTRY
+ * -----------------
  *
- * A struct containing atom name and radius
+ * A struct containing a van der Waals radii dictionary entry
  *
- * radius: atom radius
+ * RESIDUE: residue name
  * symbol: atom name
- * next: pointer to the next VDW struct
+ * radius: atom radius
  *
  */
-typedef struct VDW {
-  double radius;
+typedef struct VDW_ENTRY {
+  char RESIDUE[4];
   char symbol[6];
-  struct VDW *next;
-} vdw;
+  double radius;
+} vdw_entry;
+
+/*
+ * Struct: VDW_TABLE
+ * -----------------
+ *
+ * An open addressing hash table of van der Waals radii keyed by residue and
+ * atom name packed in 64 bits (3 bytes of residue, 5 bytes of atom name)
+ *
+ * keys: hash table slots (empty slots hold 0)
+ * radii: radius of each slot
+ * size: number of radii stored
+ * capacity: number of slots (power of two)
+ * mapped: mapped precompiled dictionary holding keys and radii (NULL if
+ * they are allocated)
+ * mapped_size: size of mapped precompiled dictionary
+ *
+ */
+typedef struct VDW_TABLE {
+  unsigned long long *keys;
+  double *radii;
+  int size;
+  int capacity;
+  char *mapped;
+  size_t mapped_size;
+} vdw_table;
 
 /*
  * Struct: ATOM
@@ -51,10 +122,11 @@ typedef struct VDW {
  * y: Y-axis coordinate
  * z: Z-axis coordinate
  * radius: atom radius
+ * hydropathy: hydrophobicity scale value of atom residue
  * resnumber: residue number
- * resname: residue name
+ * resname: residue name (one-letter code)
+ * RESIDUE: residue name
  * chain: chain identifier
- * next: pointer to next ATOM struct
  *
  */
 typedef struct ATOM {
@@ -62,12 +134,168 @@ typedef struct ATOM {
   double y;
   double z;
   double radius;
+  double hydropathy;
   int resnumber;
   char resname;
-  char chain;
-  struct ATOM *next;
+  char RESIDUE[RESIDUE_SIZE];
+  char chain[CHAIN_SIZE];
 } atom;
 
+/*
+ * Struct: PDB_ATOM
+ * ----------------
+ *
+ * A struct containing an ATOM or HETATM record of a parsed structure
+ *
+ * x: X-axis coordinate
+ * y: Y-axis coordinate
+ * z: Z-axis coordinate
+ * radius: atom radius (once looked up in van der Waals radii dictionary)
+ * resnumber: residue number
+ * model: model index (1 for first model, 0 for files without models)
+ * chain: chain identifier (up to 8 characters in mmCIF files)
+ * RESIDUE: residue name
+ * ATOM_TYPE: atom name
+ * ATOM_SYMBOL: atom symbol
+ *
+ */
+typedef struct PDB_ATOM {
+  double x;
+  double y;
+  double z;
+  double radius;
+  int resnumber;
+  int model;
+  char chain[CHAIN_SIZE];
+  char RESIDUE[RESIDUE_SIZE];
+  char ATOM_TYPE[6];
+  char ATOM_SYMBOL[3];
+} pdb_atom;
+
+/*
+ * Struct: STRUCTURE
+ * -----------------
+ *
+ * A struct containing a parsed input structure, shared by every step that
+ * reads it
+ *
+ * name: path to structure file
+ * atoms: ATOM and HETATM records in file order
+ * natoms: number of records
+ * nmodels: number of models (MODEL records or mmCIF model numbers)
+ * has_radius: whether atom radii have been looked up
+ * next: pointer to the next STRUCTURE struct
+ *
+ */
+typedef struct STRUCTURE {
+  char name[500];
+  pdb_atom *atoms;
+  int natoms;
+  int nmodels;
+  int has_radius;
+  struct STRUCTURE *next;
+} structure;
+
+/*
+ * Struct: TRAJECTORY
+ * ------------------
+ *
+ * An open trajectory file (DCD or XTC), read one frame at a time
+ *
+ * file: trajectory file
+ * format: trajectory format (DCD_FORMAT or XTC_FORMAT)
+ * natoms: number of atoms in each frame
+ * swap: whether DCD records are in non-native byte order
+ * has_unit_cell: whether DCD frames start with a unit cell record
+ * has_4d: whether DCD frames end with a fourth dimension record
+ * start: file offset of first frame
+ * coordinates: current frame coordinates in angstroms (x, y, z of each atom)
+ * buffer: raw record of current frame
+ * size: capacity of buffer in bytes
+ * ints: decompressed XTC integer coordinates
+ *
+ */
+typedef struct TRAJECTORY {
+  FILE *file;
+  int format;
+  int natoms;
+  int swap;
+  int has_unit_cell;
+  int has_4d;
+  long start;
+  double *coordinates;
+  unsigned char *buffer;
+  int size;
+  int *ints;
+} trajectory;
+
+/*
+ * Struct: CONTACT
+ * ---------------
+ *
+ * A struct containing a residue-cavity contact
+ *
+ * residue: residue index in residue table
+ * tag: cavity index
+ *
+ */
+typedef struct CONTACT {
+  int residue;
+  int tag;
+} contact;
+
+/*
+ * Struct: CONTACT_SET
+ * -------------------
+ *
+ * An open addressing hash set of residue-cavity contacts packed as
+ * (tag << 32 | residue), owned by a single thread
+ *
+ * keys: hash table slots (empty slots hold ~0)
+ * size: number of contacts stored
+ * capacity: number of slots (power of two)
+ *
+ */
+typedef struct CONTACT_SET {
+  unsigned long long *keys;
+  int size;
+  int capacity;
+} contact_set;
+
+/*
+ * Struct: CELL_LIST
+ * -----------------
+ *
+ * A uniform cell list over a set of points (e.g. atom positions), used to
+ * answer radius and nearest point queries without scanning every point
+ *
+ * P: point coordinates (x, y, z of each point)
+ * npoints: number of points
+ * size: cell edge length
+ * xmin: x coordinate of cell list origin
+ * ymin: y coordinate of cell list origin
+ * zmin: z coordinate of cell list origin
+ * nx: x cell units
+ * ny: y cell units
+ * nz: z cell units
+ * start: first entry of each cell in points (ncells + 1 entries)
+ * points: point indexes sorted by cell, in ascending order inside each cell
+ *
+ */
+typedef struct CELL_LIST {
+  double *P;
+  int npoints;
+  double size;
+  double xmin;
+  double ymin;
+  double zmin;
+  int nx;
+  int ny;
+  int nz;
+  int *start;
+  int *points;
+} cell_list;
+
 /*
  * Struct: COORDINATES
  * -------------------
@@ -99,16 +327,16 @@ typedef struct COORDINATES {
  * chain identifier)
  *
  * resnum: residue number
- * resname: residue name
+ * resname: residue name (one-letter code)
+ * RESIDUE: residue name
  * chain: chain identifier
- * next: pointer to the next RESIDUES_INFORMATION struct
  *
  */
 typedef struct RESIDUES_INFORMATION {
   int resnumber;
   char resname;
-  char chain;
-  struct RESIDUES_INFORMATION *next;
+  char RESIDUE[RESIDUE_SIZE];
+  char chain[CHAIN_SIZE];
 } residues_info;
 
 /*
@@ -122,7 +350,8 @@ typedef struct RESIDUES_INFORMATION {
  * max_depth: cavities maximum depth
  * avg_depth: cavities average depth
  * res_info: interface residues information (residue number, residue name and
- * chain identifier)
+ * chain identifier), sorted by residue number and chain identifier
+ * nres: number of interface residues
  *
  */
 typedef struct KVFINDER_RESULTS {
@@ -132,6 +361,7 @@ typedef struct KVFINDER_RESULTS {
   double avg_depth;
   double avg_hydropathy;
   residues_info *res_info;
+  int nres;
 } KVresults;
 
 /*
@@ -151,12 +381,32 @@ typedef struct NODE {
   struct NODE *next;
 } node;
 
+/*
+ * Struct: CAVITY_MESH
+ * -------------------
+ *
+ * A struct containing a triangle mesh of a cavity surface
+ *
+ * vertices: real coordinates (x, y, z) of each vertex
+ * nvertices: number of vertices
+ * faces: vertex indexes of each triangle, counterclockwise seen from outside
+ * nfaces: number of triangles
+ *
+ */
+typedef struct CAVITY_MESH {
+  float *vertices;
+  int nvertices;
+  int *faces;
+  int nfaces;
+} cavity_mesh;
+
 /* Global variables */
 double sina, sinb, cosa, cosb;
-int big, volume;
+int big, volume, natoms, ncontacts, nresidues;
 atom *v;
+contact *contacts;
 node *V;
-residues_info *t;
+residues_info *residues;
 KVresults *KVFinder_results;
 coords *cavity, *boundary;
 
@@ -174,5 +424,8 @@ int _toml2int(char flag[6]);
 void _extract(char FROM[], int nF, char TO[], int nT, int start, int end);
 void _initialize_string(char FROM[], int nF);
 void _remove_char(char FROM[], int nF, char c);
+int _format_int(char *buffer, long value, int width, int precision);
+int _format_fixed(char *buffer, double value, int width, int precision);
+int _write_at(int fd, const char *buffer, size_t size, long offset);
 
 #endif
@@ -18,3 +18,68 @@ cd "$(dirname "$0")"
 
 # Run from parameters.toml
 ../parKVFinder
+
+# Trajectory mode (DCD and XTC trajectories of 2 frames, first frame is
+# 1FMO.pdb): one result per frame, first one as in standard mode
+../parKVFinder ../input/1FMO.pdb
+for trajectory in ../input/1FMO.dcd ../input/1FMO.xtc; do
+  rm -f ../input/KV_Files/1FMO/1FMO.frame*
+  ../parKVFinder ../input/1FMO.pdb --trajectory $trajectory || exit 1
+  test $(ls ../input/KV_Files/1FMO/1FMO.frame*.results.toml | wc -l) -eq 2 ||
+    exit 1
+  cmp ../input/KV_Files/1FMO/1FMO.frame1.KVFinder.output.pdb \
+    ../input/KV_Files/1FMO/1FMO.KVFinder.output.pdb || exit 1
+done
+
+# mmCIF input, same cavities as PDB input
+../parKVFinder ../input/1FMO.cif || exit 1
+cmp ../input/KV_Files/1FMO/1FMO.KVFinder.output.pdb \
+  ../input/KV_Files/1FMO/1FMO.frame1.KVFinder.output.pdb || exit 1
+
+# Ensemble mode (gzip compressed, 2 models, first model is 1FMO.pdb), one
+# model at a time on all cores and whole models in worker processes
+for schedule in voxels frames; do
+  rm -rf ../input/KV_Files/1FMO_ensemble
+  ../parKVFinder ../input/1FMO_ensemble.pdb.gz --ensemble \
+    --schedule $schedule || exit 1
+  test -s ../input/KV_Files/1FMO_ensemble/1FMO_ensemble.model2.KVFinder.output.pdb ||
+    exit 1
+  cmp ../input/KV_Files/1FMO_ensemble/1FMO_ensemble.model1.KVFinder.output.pdb \
+    ../input/KV_Files/1FMO/1FMO.KVFinder.output.pdb || exit 1
+done
+
+# Volumetric grids, meshes and per-cavity results
+for format in ccp4 dx npy npz rle8 rle16; do
+  ../parKVFinder ../input/1FMO.pdb --grid_format $format || exit 1
+done
+for format in ply obj; do
+  ../parKVFinder ../input/1FMO.pdb --mesh_format $format || exit 1
+done
+../parKVFinder ../input/1FMO.pdb --results_format jsonl,csv || exit 1
+for file in labels.ccp4 depth.dx hydropathy.npy origin.npy grids.npz \
+  cavities.rle cavities.ply cavities.obj results.jsonl results.csv; do
+  test -s ../input/KV_Files/1FMO/1FMO.KVFinder.$file || exit 1
+done
+
+# Metrics only mode: no cavity PDB file
+rm ../input/KV_Files/1FMO/1FMO.KVFinder.output.pdb
+../parKVFinder ../input/1FMO.pdb --metrics_only || exit 1
+test ! -e ../input/KV_Files/1FMO/1FMO.KVFinder.output.pdb || exit 1
+
+# Cavity selection: 3 largest cavities, deep cavities, cavities near residues
+../parKVFinder ../input/1FMO.pdb --top_k 3 || exit 1
+test $(cut -c18-20 ../input/KV_Files/1FMO/1FMO.KVFinder.output.pdb |
+  grep K | sort -u | wc -l) -eq 3 || exit 1
+../parKVFinder ../input/1FMO.pdb --min_depth 2.0 || exit 1
+../parKVFinder ../input/1FMO.pdb \
+  --near_residues ../input/1FMO.residues.KVFinder.in || exit 1
+
+# Archive mode: output files and log in one archive, no KV_Files folder
+archive=$(mktemp -d)
+cp ../input/1FMO.pdb ../input/1FMO_ensemble.pdb.gz $archive
+../parKVFinder $archive/1FMO.pdb --archive $archive/1FMO.kva || exit 1
+../parKVFinder $archive/1FMO_ensemble.pdb.gz --ensemble \
+  --archive $archive/1FMO.kva || exit 1
+test -s $archive/1FMO.kva.idx || exit 1
+test ! -e $archive/KV_Files || exit 1
+rm -rf $archive